@@ -3,6 +3,11 @@
 #include <pthread.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
 
 #include "db.h"
 
@@ -18,8 +23,66 @@
 #define DB_PREFIX_LEN 4
 #define DB_METADATA_KEY_FORMAT DB_PREFIX "%s"
 
+#define BLOOM_KEY_FORMAT "bloom:%s"
+// 512 bit blocks, every key sets all of its bits in one cache line
+#define BLOOM_BLOCK_WORDS 8
+#define BLOOM_BLOCK_BITS (BLOOM_BLOCK_WORDS * 64)
+
 #define INVALID_DB_ID -1
 
+// DbMeta flags handled here and never passed to lmdb
+#define TRASH_DB_OWN_FLAGS (TRASH_DB_WARM | TRASH_DB_CACHE | TRASH_DB_BLOOM | TRASH_DB_TTL | TRASH_DB_KEY_MASK)
+
+#ifndef TRASH_NO_STATS
+#define STATS_CLOCK(t) ((t) = internal_now_ns())
+#define STATS_ADD(field, n) internal_stats_add(&internal_stats()->st.field, (n))
+#define STATS_SINCE(field, t) internal_stats_add(&internal_stats()->st.field, internal_now_ns() - (t))
+#define STATS_HIST(h, t) internal_stats_hist((h), internal_now_ns() - (t))
+#else
+#define STATS_CLOCK(t) ((t) = 0)
+#define STATS_ADD(field, n) ((void)0)
+#define STATS_SINCE(field, t) ((void)(t))
+#define STATS_HIST(h, t) ((void)(t))
+#endif
+
+// dbs a new txn has room for, the table of the txn is twice this
+#define TXN_DBS 8
+
+// per thread read cursor cache slots, must be a power of 2
+#define CUR_CACHE_SLOTS 16
+
+// txns and cursors kept by a thread for reuse
+#define SLAB_OBJS 32
+// a recycled txn keeps its replay log buffer up to this size
+#define SLAB_LOG_KEEP 65536
+
+#define COUNTER_TABLE_MIN 64
+
+#define TTL_DB_FORMAT "%s:ttl"
+// expiry in ms since the epoch in front of every value of a TRASH_DB_TTL db, 0 never expires
+#define TTL_PREFIX sizeof(uint64_t)
+// index keys are the big endian expiry and the key
+#define TTL_KEY_MAX 520
+
+#define SHARD_DIR_FORMAT "%s%s.shard%u/"
+#define SHARD_DATA "data"
+#define SHARD_LAYOUT "layout"
+
+// write txn can not be replayed after growing the map
+#define TRASH_TXN_NOREPLAY 0x10
+// read txn holds one of the reader slots of the env budget
+#define TRASH_TXN_POOLED 0x20
+// write txn lost its writes when the map could not be grown, it can only be returned
+#define TRASH_TXN_FAILED 0x40
+
+// reader slots left out of the budget for readers begun without a thread pool
+#define RDR_RESERVE 1
+
+// TrashTxn.expired, the watchdog only moves a reader from live to expired, its owner resets it
+#define RDR_LIVE 0
+#define RDR_EXPIRED 1
+#define RDR_RESET 2
+
 enum EnvState {
     ENV_OPEN,
     ENV_CLOSE
@@ -39,21 +102,41 @@ struct TrashCursor {
     MDB_cursor *cur;
     enum RWTxn rw;
     struct OpenDb *db;
+    struct TrashTxn *txn;
 };
 
 struct OpenDb {
     struct IL moveenv;
+    // chain for the registry bucket
+    struct OpenDb *hnext;
     
     const char *name;
+    // set when the name was copied out of the metadata db
+    char *ownname;
+    unsigned int flags;
+    // only set for TRASH_DB_KEY_FIXED
+    unsigned int keywidth;
+    // only set for TRASH_DB_TTL, ttldbi indexes the keys by expiry
+    unsigned int ttlsecs;
+    MDB_dbi ttldbi;
+    unsigned int hash;
+    // unique for the life of the env, tells a reused OpenDb allocation apart in the cursor caches
+    unsigned long dbid;
     MDB_dbi dbi;
     enum DbState state;
 
+    // shared read cursors, only used when the thread cache misses
     TrashCursor **curs;
     unsigned int curcount;
+    unsigned int curscap;
     unsigned int txncount;
 
     pthread_mutex_t odbMutex;
-    pthread_cond_t odbCond;
+
+    // NULL unless the db was created with TRASH_DB_CACHE
+    struct KeyCache *cache;
+    // NULL unless the db was created with TRASH_DB_BLOOM
+    struct BloomFilter *bloom;
 };
 
 struct TrashTxn {
@@ -66,9 +149,134 @@ struct TrashTxn {
 
     struct TrashCursor *cur;
 
+    // every db attached to the txn, each holds one txncount of the txn
     struct OpenDb **dbs;
     size_t dbscount;
     size_t dbscap;
+    // index in dbs of the db the txn is working on
+    size_t curdb;
+    // open addressing on the db hash, holds the index in dbs + 1 and 0 when empty
+    unsigned int *dbtab;
+    size_t dbtabcap;
+
+    // bytes written, used by the flusher to decide when to sync
+    size_t wbytes;
+
+    // writes of the txn, replayed into a new txn when the map is grown
+    struct TxnLog *log;
+
+    // savepoints from oldest to newest, txn is the child of the newest one
+    struct Savepoint *saves;
+    size_t numsaves;
+    size_t savescap;
+
+    // keys written to cached dbs, dropped from the caches when the txn ends
+    struct TxnLog *inval;
+
+    // dbs whose stored bloom filter was deleted by the txn
+    struct OpenDb **blooms;
+    size_t numblooms;
+    size_t bloomscap;
+
+    // pooled readers are on the active list of the pool they were taken by until returned, both under its rdrMutex
+    struct IL rdrlink;
+    struct Readers *owner;
+    unsigned long beganns;
+    size_t snapid;
+    // RDR_* through atomics, an expired reader fails every call until it is returned
+    int expired;
+};
+
+struct InvalEntry {
+    struct KeyCache *cache;
+    size_t klen;
+};
+
+/**
+ * A cached pair, the key is followed by the value in data
+ */
+struct CacheEntry {
+    struct CacheEntry *hnext;
+    unsigned int hash;
+    // set on every hit, cleared by the clock hand
+    unsigned int ref;
+    // index in the clock ring
+    size_t slot;
+    size_t klen;
+    size_t vlen;
+    char data[];
+};
+
+/**
+ * A value is only added by a reader whose snapshot has every commit that dropped keys of the shard,
+ * and no writer is between dropping its keys and committing.
+ */
+struct CacheShard {
+    struct CacheEntry **table;
+    size_t tablecap;
+    struct CacheEntry **ring;
+    size_t numring;
+    size_t ringcap;
+    size_t hand;
+
+    size_t bytes;
+    size_t cap;
+
+    // newest txn that dropped keys of the shard
+    size_t invtxn;
+    // write txns that dropped keys of the shard and have not ended yet
+    unsigned int pending;
+
+    pthread_mutex_t shardMutex;
+};
+
+struct KeyCache {
+    struct CacheShard shards[TRASH_CACHE_SHARDS];
+};
+
+/**
+ * The copy of the filter in the metadata db is only kept while it has every key of the db.
+ * The first write txn after it was stored deletes it along with its own writes, a missing copy is rebuilt on open.
+ */
+struct BloomFilter {
+    uint64_t *bits;
+    size_t nblocks;
+    // set once the filter has every key of the db
+    int ready;
+    // the stored copy matches the filter
+    int persisted;
+    // write txn that deleted the stored copy, until it ends
+    size_t deltxn;
+};
+
+struct BloomHeader {
+    size_t nblocks;
+    unsigned int hashes;
+};
+
+/**
+ * State of the txn when the savepoint was taken, put back on rollback
+ */
+struct Savepoint {
+    MDB_txn *parent;
+    size_t loglen;
+    size_t wbytes;
+    size_t curdb;
+    unsigned int actions;
+    size_t numblooms;
+};
+
+struct TxnLog {
+    char *buf;
+    size_t len;
+    size_t cap;
+};
+
+struct LogEntry {
+    MDB_dbi dbi;
+    unsigned int flags;
+    size_t klen;
+    size_t vlen;
 };
 
 struct OpenEnv {
@@ -76,91 +284,679 @@ struct OpenEnv {
     unsigned int envFlags;
     enum EnvState state;
     struct LL dbs;
+    // registry of open dbs hashed by name, cap is always a power of 2
+    struct OpenDb **dbtable;
+    size_t dbtablecap;
+    unsigned long nextDbid;
+    // bumped every time a db is freed
+    unsigned long closedDbs;
     pthread_rwlock_t envLock;
+    MDB_dbi metadbi;
+
+    struct EnvMeta meta;
+    // lmdb page size and os page size
+    unsigned int psize;
+    size_t ospsize;
+    // last committed and last synced txn ids, only updated through atomics
+    size_t lastTxnid;
+    size_t durableTxnid;
+    size_t unsyncedBytes;
+
+    // every thread pool, walked when a thread has to steal an idle reader
+    struct LL pools;
+    pthread_mutex_t poolMutex;
+    pthread_cond_t poolCond;
+    unsigned int poolWaiters;
+    // pooled readers alive across all threads, bounded by the lmdb max readers
+    unsigned int rdrsLive;
+    unsigned int rdrBudget;
+
+    // txns currently begun, the map can only be resized when there are none
+    unsigned int activeTxns;
+    int resizing;
+    size_t resizes;
+    // backups copying, the map is not grown while one runs
+    unsigned int backups;
+
+    pthread_t flusher;
+    int flushing;
+    pthread_mutex_t syncMutex;
+    pthread_cond_t syncCond;
 };
 
 struct Readers {
+    struct IL movepool;
+
     TrashTxn **txns;
     size_t numTxns;
     size_t cap;
+
+    // readers taken by this thread and not yet returned, walked by the watchdog
+    struct LL active;
+
+    // only contended when another thread steals from this pool
+    pthread_mutex_t rdrMutex;
+};
+
+/**
+ * Freed txns and cursors of one thread. Only the owning thread touches it, so no locking.
+ */
+struct Slab {
+    TrashTxn *txns[SLAB_OBJS];
+    size_t numTxns;
+
+    TrashCursor *curs[SLAB_OBJS];
+    size_t numCurs;
+};
+
+struct TrashIter {
+    TrashCursor *tc;
+    MDB_txn *txn;
+    MDB_dbi dbi;
+
+    // lo is the prefix for TRASH_ITER_PREFIX, the bounds point into the caller's buffers
+    MDB_val lo;
+    MDB_val hi;
+    bool haslo;
+    bool hashi;
+    unsigned int flags;
+    // expired pairs of a TRASH_DB_TTL db are skipped
+    bool ttl;
+
+    size_t limit;
+    size_t count;
+    bool started;
+    bool done;
+};
+
+struct BulkRec {
+    MDB_val key;
+    MDB_val val;
+};
+
+/**
+ * A sorted run, either a slice of the records in memory or a run spilled to a temp file
+ */
+struct BulkRun {
+    struct BulkRec *recs;
+    size_t pos;
+    size_t len;
+
+    FILE *fp;
+    char *buf;
+    size_t bufcap;
+
+    struct BulkRec cur;
+};
+
+struct BulkMerge {
+    struct BulkRun *runs;
+    size_t *heap;
+    size_t numheap;
+    // run handed out by the last call, advanced on the next one
+    size_t last;
+    bool haslast;
+
+    MDB_txn *txn;
+    MDB_dbi dbi;
+    bool dups;
+};
+
+struct KeySort {
+    MDB_txn *txn;
+    MDB_dbi dbi;
+    MDB_val *keys;
+};
+
+struct BulkSort {
+    struct BulkRec *recs;
+    struct BulkRec *tmp;
+    size_t len;
+
+    MDB_txn *txn;
+    MDB_dbi dbi;
+    bool dups;
+};
+
+struct BulkLoad {
+    struct TrashBulk *bl;
+    MDB_dbi dbi;
+    bool dups;
+
+    char *arena;
+    size_t arenalen;
+    size_t arenacap;
+
+    struct BulkRec *recs;
+    struct BulkRec *tmp;
+    size_t numrecs;
+    size_t reccap;
+
+    FILE **spills;
+    size_t numspills;
+};
+
+/**
+ * Dbs opened from the metadata db on startup, handed out to the warm threads through next
+ */
+struct WarmStart {
+    struct OpenDb **dbs;
+    size_t numdbs;
+    size_t next;
+    size_t warmed;
+};
+
+/**
+ * Stats of one thread. Blocks are never freed, a thread that cleans up leaves its block for the next thread.
+ */
+struct StatsLocal {
+    struct IL movestats;
+    bool inuse;
+    struct TrashStats st;
+};
+
+struct CurCache {
+    struct OpenDb *db;
+    unsigned long dbid;
+    unsigned int hash;
+    // closedDbs when the owner was last known to be open
+    unsigned long closed;
+    TrashCursor *tc;
+};
+
+struct CommitReq {
+    struct IL movequeue;
+
+    struct TrashOp *ops;
+    size_t numops;
+    int rc;
+    int done;
+    // last pass of internal_commit_pass that ran it
+    int pass;
+};
+
+struct GroupCommit {
+    pthread_t committer;
+    struct LL queue;
+    size_t queuedops;
+
+    size_t maxops;
+    unsigned int maxwaitus;
+    int running;
+
+    pthread_mutex_t gcMutex;
+    // committer waits on this for work
+    pthread_cond_t gcCond;
+    // submitters wait on this for their batch to be committed
+    pthread_cond_t doneCond;
+};
+
+/**
+ * Workers of the async api, each with its own reader pool
+ */
+struct AsyncPool {
+    pthread_t *workers;
+    unsigned int numworkers;
+    size_t numrdrs;
+    int running;
+
+    struct TrashReq *head;
+    struct TrashReq *tail;
+    pthread_mutex_t asyncMutex;
+    // workers wait on this for requests
+    pthread_cond_t asyncCond;
+
+    // completed requests without a callback
+    struct TrashReq *donehead;
+    struct TrashReq *donetail;
+    pthread_mutex_t doneMutex;
+    int efd;
+};
+
+struct CounterEntry {
+    struct CounterEntry *next;
+    // the db may be closed before the flush, so it is only looked up by its hash and dbid
+    unsigned long dbid;
+    unsigned int dbhash;
+    unsigned int hash;
+    int64_t delta;
+    size_t size;
+    char key[];
+};
+
+struct CounterTable {
+    struct CounterEntry **buckets;
+    size_t cap;
+    size_t count;
+};
+
+/**
+ * Pending counter deltas of one thread. Like the stats blocks they are never freed,
+ * a thread that cleans up leaves its deltas for the next flush and its block for the next thread.
+ */
+struct CounterBuf {
+    struct IL movecounters;
+    bool inuse;
+    // only contended by flushes and pending reads
+    pthread_mutex_t mutex;
+    struct CounterTable tab;
+};
+
+struct CounterFlusher {
+    pthread_t thread;
+    unsigned int flushms;
+    int running;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+/**
+ * mdb_env_copyfd2 writes into a pipe on the copier thread, the relay thread writes it out at the rate of the backup
+ */
+struct BackupJob {
+    struct TrashBackup *bk;
+    pthread_t relay;
+    pthread_t copier;
+    int pipefd[2];
+    int outfd;
+    int copyrc;
+};
+
+struct Shard {
+    MDB_env *env;
+    MDB_dbi dbi;
+};
+
+struct ShardLayout {
+    uint32_t mode;
+    uint32_t numshards;
+    uint32_t index;
+    uint32_t pad;
+    // hash of the range splits in order, 0 for a hash set
+    uint64_t splithash;
+};
+
+struct ShardSet {
+    unsigned int mode;
+    unsigned int numshards;
+    struct Shard *shards;
+
+    // the numshards - 1 splits of a TRASH_SHARD_RANGE set, their data copied into splitbuf
+    MDB_val *splits;
+    char *splitbuf;
+    uint64_t splithash;
+};
+
+/**
+ * Every shard gets its own lmdb txn when first used. A write txn only writes to one shard,
+ * its other txns are readers, so two threads can never wait on each other's writer locks.
+ */
+struct ShardTxn {
+    struct ShardSet *ss;
+    int rd;
+    MDB_txn **txns;
+    // shard of the write txn, -1 until the first write
+    int wrshard;
+};
+
+/**
+ * Min heap of the shards by their current key, the top one is the next pair of the scan
+ */
+struct ShardIter {
+    struct ShardTxn *st;
+    MDB_cursor **curs;
+    MDB_val *keys;
+    MDB_val *vals;
+    unsigned int *heap;
+    unsigned int heaplen;
+
+    MDB_val hi;
+    unsigned int flags;
+};
+
+/**
+ * Hands the writer lock to write txns in priority order, in front of the lmdb writer lock
+ */
+struct WriteSched {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int held;
+    unsigned int waiting[TRASH_PRIO_NUM];
+    unsigned int numwaiting;
+
+    unsigned int maxqueue;
+    unsigned long maxholdns;
+    size_t chunkops;
+};
+
+struct Reaper {
+    pthread_t thread;
+    unsigned int intervalms;
+    int running;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+struct Watchdog {
+    pthread_t thread;
+    unsigned int intervalms;
+    unsigned long expirems;
+    void (*report)(const struct TrashReaders *rdrs);
+    int running;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
 };
 
 /** INTERNAL FUNCTIONS **/
 static void init_metadata();
-static void internal_create_open_env(struct OpenEnv **oEnv, MDB_env *env);
+static void internal_create_open_env(struct OpenEnv **oEnv, MDB_env *env, unsigned int numdbs, unsigned int numrdrs, struct EnvMeta *meta);
+static unsigned int internal_env_flags(struct EnvMeta *meta);
+static void internal_start_flusher();
+static void internal_stop_flusher();
+static void *internal_flusher(void *arg);
+static void internal_txn_committed(size_t txnid, size_t wbytes);
+static size_t internal_store_max(size_t *dst, size_t val);
+static void internal_txn_enter();
+static void internal_txn_exit();
+static size_t internal_mapsize();
+static int internal_grow_map(size_t seen);
+static int internal_txn_regrow(TrashTxn *tt);
+static void internal_log_put(TrashTxn *tt, MDB_dbi dbi, MDB_val *key, MDB_val *val, unsigned int flags);
+static void internal_log_free(TrashTxn *tt);
 static int internal_set_env_fields(MDB_env *env, size_t dbsize, unsigned int numdbs, unsigned int numthreads);
-static void internal_open_all_db(TrashTxn *tt);
+static void internal_open_all_db();
+static void internal_warm_dbs(struct WarmStart *ws);
+static void *internal_warm_thread(void *arg);
+static void internal_warm_pages(struct WarmStart *ws, struct OpenDb *db, MDB_txn *txn);
 static struct OpenDb *internal_add_db(struct DbMeta *dbmeta, MDB_dbi id);
 static int internal_add_db_curs(struct OpenDb *db, TrashTxn *tt);
 static void internal_add_db_txn(TrashTxn *tt, struct OpenDb *db);
+static size_t internal_txn_find_db(TrashTxn *tt, struct OpenDb *db);
+static size_t internal_txn_find_name(TrashTxn *tt, const char *dbname);
+static void internal_txn_index_db(TrashTxn *tt, size_t i);
 static int db_match(struct OpenDb *db, const char *dbname);
-static void internal_txn_handler(TrashTxn *tt);
+static int internal_dbi_open(MDB_txn *txn, struct DbMeta *dbmeta, unsigned int flags, MDB_dbi *dbi, MDB_dbi *ttldbi);
+static bool internal_key_ok(struct OpenDb *db, MDB_val *key);
+static int internal_cmp_i64(const MDB_val *a, const MDB_val *b);
+#if SIZE_MAX != UINT64_MAX
+static int internal_cmp_u64(const MDB_val *a, const MDB_val *b);
+#endif
+static unsigned int internal_hash_name(const char *dbname);
+static void internal_registry_add(struct OpenDb *db);
+static void internal_registry_remove(struct OpenDb *db);
+static bool internal_txn_handler(TrashTxn *tt, int *rc);
+static int internal_return_txn(TrashTxn *tt);
+static void internal_end_savepoints(TrashTxn *tt);
+static void internal_savepoint_restore(TrashTxn *tt, struct Savepoint *sp);
+static int internal_reserve_reader(bool nopool);
+static void internal_release_reader();
+static TrashTxn *internal_new_reader();
+static TrashTxn *internal_steal_reader();
+static TrashTxn *internal_steal_reader_locked();
+static TrashTxn *internal_wait_reader(struct timespec *deadline, bool *begun);
+static TrashTxn *internal_track_reader(TrashTxn *tt);
+static bool internal_untrack_reader(TrashTxn *tt);
+static bool internal_reader_expired(TrashTxn *tt);
+static void *internal_watchdog(void *arg);
 static void internal_fin_db(struct OpenDb *db);
 static void internal_close_db(struct OpenDb *db);
 static int internal_begin_txn(TrashTxn **tt, int rd);
 static TrashTxn *internal_get_read_txn();
 static void internal_create_trash_txn(TrashTxn **tt, MDB_txn *txn, int rdwr);
 static void internal_create_trash_cursor(TrashCursor **tc, struct OpenDb *db, enum RWTxn rw);
+static void internal_free_trash_txn(TrashTxn *tt);
+static void internal_free_trash_cursor(TrashCursor *tc);
+static void internal_destroy_trash_txn(TrashTxn *tt);
+static unsigned int internal_hash_key(const void *data, size_t len);
+static struct KeyCache *internal_cache_create(size_t bytes);
+static void internal_cache_free(struct KeyCache *cache);
+static struct CacheEntry **internal_cache_find(struct CacheShard *sh, MDB_val *key, unsigned int hash);
+static void internal_cache_drop(struct CacheShard *sh, struct CacheEntry **link);
+static int internal_cache_lookup(struct KeyCache *cache, MDB_val *key, void *buf, size_t *len);
+static void internal_cache_insert(struct KeyCache *cache, MDB_val *key, MDB_val *val, size_t txnid);
+static void internal_cache_note(TrashTxn *tt, struct OpenDb *db, MDB_val *key);
+static void internal_cache_inval_begin(TrashTxn *tt);
+static void internal_cache_inval_end(TrashTxn *tt, size_t txnid);
+static uint64_t internal_hash64(const void *data, size_t len);
+static struct BloomFilter *internal_bloom_create(size_t keys);
+static void internal_bloom_free(struct BloomFilter *bf);
+static void internal_bloom_add(struct BloomFilter *bf, MDB_val *key);
+static bool internal_bloom_test(struct BloomFilter *bf, MDB_val *key);
+static int internal_bloom_write(TrashTxn *tt, struct OpenDb *db, MDB_val *key);
+static int internal_bloom_drop(TrashTxn *tt, struct OpenDb *db);
+static void internal_bloom_undo(TrashTxn *tt, size_t mark);
+static void internal_bloom_txn_end(TrashTxn *tt, bool committed);
+static void internal_bloom_load(struct OpenDb *db, MDB_txn *txn);
+static void internal_bloom_persist(struct OpenDb *db);
 static void internal_fin_db_locked(struct OpenDb *db);
 static void internal_db_txn_decrement(struct OpenDb *db, void (*fin_db)(struct OpenDb *));
 static struct OpenDb *internal_get_open_db(const char *dbname);
 static struct OpenDb *internal_get_open_db_locked(const char *dbname);
+static TrashCursor *internal_cached_cursor(struct OpenDb *db);
+static int internal_cache_cursor(TrashCursor *tc);
+static int internal_db_alive(unsigned int hash, unsigned long dbid);
+static void *internal_merge_sort(void *base, void *tmp, size_t n, size_t size, int (*cmp)(const void *, const void *, void *), void *ctx);
+static int internal_key_sort_cmp(const void *a, const void *b, void *ctx);
+static void internal_sort_keys(MDB_txn *txn, MDB_dbi dbi, MDB_val *keys, size_t *order, size_t numkeys);
+static void internal_prefetch(MDB_val *val);
+static int internal_iter_seek(TrashIter *it, MDB_val *key, MDB_val *val);
+static bool internal_iter_in_bounds(TrashIter *it, MDB_val *key);
+static int internal_bulk_cmp(MDB_txn *txn, MDB_dbi dbi, bool dups, struct BulkRec *a, struct BulkRec *b);
+static int internal_bulk_sort_cmp(const void *a, const void *b, void *ctx);
+static void *internal_bulk_sort(void *arg);
+static size_t internal_bulk_sort_slices(struct BulkLoad *ld, MDB_txn *txn, struct BulkRun *runs);
+static int internal_bulk_spill(struct BulkLoad *ld);
+static int internal_bulk_run_next(struct BulkRun *run);
+static bool internal_merge_less(struct BulkMerge *m, size_t a, size_t b);
+static void internal_merge_sift(struct BulkMerge *m, size_t i);
+static int internal_merge_init(struct BulkMerge *m, struct BulkRun *runs, size_t numruns);
+static int internal_merge_next(struct BulkMerge *m, struct BulkRec *rec);
+static int internal_bulk_insert(struct BulkLoad *ld, struct BulkRun *runs, size_t numruns);
+static unsigned long internal_now_ns();
+static void internal_stats_release();
+#ifndef TRASH_NO_STATS
+static struct StatsLocal *internal_stats();
+static void internal_stats_add(unsigned long *field, unsigned long n);
+static void internal_stats_hist(int h, unsigned long ns);
+#endif
+static void internal_env_rdlock();
+static void internal_env_wrlock();
+static void *internal_committer(void *arg);
+static int internal_apply_ops(MDB_txn *txn, struct TrashOp *ops, size_t numops, size_t *wbytes);
+static void internal_commit_reqs(struct LL *reqs);
+static size_t internal_commit_pass(struct LL *reqs, int pass);
+static int internal_submit_reqs(struct CommitReq *reqs, size_t numreqs);
+static void *internal_async_worker(void *arg);
+static void internal_async_reads(struct TrashReq **reqs, size_t numreqs);
+static void internal_async_writes(struct TrashReq **reqs, size_t numreqs);
+static int internal_async_get(TrashTxn *tt, struct TrashReq *req);
+static int internal_async_scan(TrashTxn *tt, struct TrashReq *req);
+static void internal_async_complete(struct AsyncPool *ap, struct TrashReq **reqs, size_t numreqs);
+static struct CounterBuf *internal_counters();
+static void internal_counters_release();
+static struct CounterEntry *internal_counter_find(struct CounterTable *tab, unsigned long dbid, MDB_val *key, unsigned int hash);
+static void internal_counter_insert(struct CounterTable *tab, struct CounterEntry *e);
+static void internal_counter_merge(struct CounterTable *tab, struct OpenDb *db, MDB_val *key, unsigned int hash, int64_t delta);
+static void internal_counter_drain(struct CounterTable *dst, struct CounterTable *src);
+static void internal_counter_clear(struct CounterTable *tab);
+static int internal_counter_attach(TrashTxn *tt, struct CounterEntry *e);
+static void *internal_counter_flusher(void *arg);
+static uint64_t internal_wall_ms();
+static uint64_t internal_ttl_expiry(struct OpenDb *db);
+static bool internal_ttl_live(MDB_val *val, uint64_t now);
+static void internal_ttl_index_key(MDB_val *ikey, unsigned char *buf, MDB_val *key, uint64_t expiry);
+static int internal_ttl_put(MDB_txn *txn, MDB_cursor *cur, struct OpenDb *db, MDB_val *key, MDB_val *val, unsigned int flags, uint64_t expiry, MDB_val *stored);
+static void internal_ttl_log(TrashTxn *tt, struct OpenDb *db, MDB_val *key, MDB_val *stored, unsigned int flags);
+static int internal_ttl_reap(TrashTxn *tt, struct OpenDb *db, uint64_t now, size_t max, size_t *visited, size_t *deleted);
+static void *internal_reaper(void *arg);
+static int internal_sched_acquire(bool bounded);
+static void internal_sched_release();
+static bool internal_sched_due(TrashTxn *tt);
+static int internal_sched_chunk(TrashTxn *tt);
+static int internal_shard_cmp(const MDB_val *a, const MDB_val *b);
+static int internal_shard_open(struct ShardSet *ss, unsigned int i, struct TrashShardMeta *meta);
+static int internal_shard_txn(struct ShardTxn *st, unsigned int i, MDB_txn **txn);
+static int internal_shard_wrtxn(struct ShardTxn *st, MDB_val *key, MDB_txn **txn, MDB_dbi *dbi);
+static bool internal_shard_in_range(struct ShardIter *it, MDB_val *key);
+static void internal_shard_sift(struct ShardIter *it, unsigned int i);
+static void *internal_backup_copier(void *arg);
+static void *internal_backup_relay(void *arg);
+static int internal_write_all(int fd, const char *buf, size_t len);
 
 // environment that is open
 static struct OpenEnv *oEnv = NULL;
 // tls for the reader txns
 static __thread struct Readers *rdrPool = NULL;
+// tls for the read cursors, indexed by the dbid
+static __thread struct CurCache *curCache = NULL;
+// tls for the recycled txns and cursors, only set up with the reader pool
+static __thread struct Slab *slab = NULL;
+// txns begun by this thread, a thread holding txns can not resize the map
+static __thread unsigned int activeLocal = 0;
+// stats block of this thread
+static __thread struct StatsLocal *tStats = NULL;
+// every stats block handed out, kept across envs
+static struct LL statsBlocks = {0};
+static pthread_mutex_t statsMutex = PTHREAD_MUTEX_INITIALIZER;
+// group commit pipeline, NULL when not running
+static struct GroupCommit *gCommit = NULL;
+// async workers, NULL when not running
+static struct AsyncPool *gAsync = NULL;
+// counter block of this thread
+static __thread struct CounterBuf *tCounters = NULL;
+// every counter block handed out and the deltas taken by the last flush, both under counterMutex
+static struct LL counterBlocks = {0};
+static struct CounterTable inflight = {0};
+// id of the txn that committed inflight, 0 while it is not committed
+static size_t inflightTxn = 0;
+static pthread_mutex_t counterMutex = PTHREAD_MUTEX_INITIALIZER;
+// one flush at a time
+static pthread_mutex_t flushMutex = PTHREAD_MUTEX_INITIALIZER;
+// periodic counter flushes, NULL when not running
+static struct CounterFlusher *gFlusher = NULL;
+// ttl reaper, NULL when not running
+static struct Reaper *gReaper = NULL;
+// write scheduler, NULL when not running
+static struct WriteSched *gSched = NULL;
+// write class of this thread, whether it holds the scheduler and since when, and the puts of the txn since
+static __thread unsigned int wrPrio = TRASH_PRIO_NORMAL;
+static __thread int wrHeld = 0;
+static __thread unsigned long wrSince = 0;
+static __thread size_t wrOps = 0;
+// reader watchdog, NULL when not running
+static struct Watchdog *gWatchdog = NULL;
 
+/**
+ * Fills the pool of this thread with up to numrdrs readers, fewer when the env budget runs out.
+ * The pool keeps at most numrdrs idle readers, readers taken from the budget or other threads on top of that are given back on return.
+ */
 void init_thread_local_readers(size_t numrdrs) {
-    int rc;
-
     if(rdrPool != NULL)
         return;
 
     rdrPool = (struct Readers *)malloc(sizeof(struct Readers));
+    assert(rdrPool != NULL);
 
     rdrPool->txns = calloc(numrdrs, sizeof(TrashTxn *));
-    rdrPool->numTxns = numrdrs;
+    rdrPool->numTxns = 0;
     rdrPool->cap = numrdrs;
+    pthread_mutex_init(&rdrPool->rdrMutex, NULL);
 
     for (size_t i = 0; i < numrdrs; i++) {
         TrashTxn *tt;
-        MDB_txn *txn;
-        
+
+        if(internal_reserve_reader(false) != TRASH_DB_SUCCESS)
+            break;
+
         /**
          * @todo    build an error handling function for lmdb error messages
         */
-        rc = mdb_txn_begin(oEnv->env, NULL, MDB_RDONLY, &txn);
-        assert(rc == 0);
-
-        internal_create_trash_txn(&tt, txn, TRASH_RD_TXN);
-        mdb_txn_reset(txn);
+        tt = internal_new_reader();
+        if(tt == NULL)
+            break;
+        mdb_txn_reset(tt->txn);
+        internal_txn_exit();
 
-        rdrPool->txns[i] = tt;
+        rdrPool->txns[rdrPool->numTxns++] = tt;
     }
+
+    init_list(&rdrPool->active);
+    init_il(&rdrPool->movepool);
+    pthread_mutex_lock(&oEnv->poolMutex);
+    list_append(&oEnv->pools, &rdrPool->movepool);
+    pthread_mutex_unlock(&oEnv->poolMutex);
+
+    curCache = (struct CurCache *)calloc(CUR_CACHE_SLOTS, sizeof(struct CurCache));
+    assert(curCache != NULL);
+
+    slab = (struct Slab *)calloc(1, sizeof(struct Slab));
+    assert(slab != NULL);
 }
 
 void clean_thread_local_readers() {
     if(rdrPool == NULL)
         return;
 
+    pthread_mutex_lock(&oEnv->poolMutex);
+    item_remove(&rdrPool->movepool);
+    oEnv->pools.len--;
+    pthread_mutex_unlock(&oEnv->poolMutex);
+
     for (size_t i = 0; i < rdrPool->numTxns; i++) {
         TrashTxn *tt = rdrPool->txns[i];
         mdb_txn_abort(tt->txn);
-        free(tt->dbs);
-        free(tt);
+        internal_release_reader();
+        internal_destroy_trash_txn(tt);
         rdrPool->txns[i] = NULL;
     }
 
+    // readers the thread never returned would pin their snapshot for good, they fail from here on
+    pthread_mutex_lock(&rdrPool->rdrMutex);
+    while(rdrPool->active.len > 0) {
+        TrashTxn *tt = CONTAINER_OF(rdrPool->active.head.next, TrashTxn, rdrlink);
+
+        item_remove(&tt->rdrlink);
+        rdrPool->active.len--;
+        if(__atomic_load_n(&tt->expired, __ATOMIC_ACQUIRE) != RDR_RESET)
+            mdb_txn_reset(tt->txn);
+        __atomic_store_n(&tt->expired, RDR_RESET, __ATOMIC_RELEASE);
+        tt->owner = NULL;
+    }
+    pthread_mutex_unlock(&rdrPool->rdrMutex);
+
+    pthread_mutex_destroy(&rdrPool->rdrMutex);
     free(rdrPool->txns);
     free(rdrPool);
+    rdrPool = NULL;
+
+    // cursors of dbs that were closed are still safe to close, their dbi is never used here
+    for (size_t i = 0; i < CUR_CACHE_SLOTS; i++) {
+        TrashCursor *tc = curCache[i].tc;
+        if(tc != NULL) {
+            mdb_cursor_close(tc->cur);
+            free(tc);
+        }
+    }
+    free(curCache);
+    curCache = NULL;
+
+    for (size_t i = 0; i < slab->numTxns; i++) {
+        internal_destroy_trash_txn(slab->txns[i]);
+    }
+    for (size_t i = 0; i < slab->numCurs; i++)
+        free(slab->curs[i]);
+    free(slab);
+    slab = NULL;
+
+    internal_stats_release();
+    internal_counters_release();
 }
 
 /**
  * @todo    this function needs logging for errors
  * @todo    check the length of the file name or pass the length of the filename as a parameter in the function
 */
-int open_env(size_t dbsize, unsigned int numdbs, unsigned int numrdrs) {
+int open_env(size_t dbsize, unsigned int numdbs, unsigned int numrdrs, struct EnvMeta *meta) {
     MDB_env *env;
     struct stat st;
     char filepath[256];
@@ -191,7 +987,7 @@ int open_env(size_t dbsize, unsigned int numdbs, unsigned int numrdrs) {
         return TRASH_DB_ERROR;
     }
     
-    if((rc = mdb_env_open(env, filepath, MDB_NOTLS | MDB_NOSYNC | MDB_NOMETASYNC, 0664)) != 0) {
+    if((rc = mdb_env_open(env, filepath, internal_env_flags(meta), 0664)) != 0) {
         /**
          * @todo    handle the different possible errors for an invalid open
         */
@@ -201,16 +997,40 @@ int open_env(size_t dbsize, unsigned int numdbs, unsigned int numrdrs) {
     };
 
     // setup open env struct
-    internal_create_open_env(&oEnv, env);
+    internal_create_open_env(&oEnv, env, numdbs, numrdrs, meta);
     // open/create metadata db
     init_metadata(env);
+    // open the dbs created before the last close_env
+    internal_open_all_db();
+
+    internal_start_flusher();
 
     return TRASH_DB_SUCCESS;
 }
 
 void close_env() {
+    struct IL *curr;
+
+    stop_group_commit();
+    internal_stop_flusher();
+
+    // dbs left open keep their bloom filters for the next open
+    if(oEnv->dbs.head.next != NULL) {
+        for_each(&oEnv->dbs.head, curr) {
+            internal_bloom_persist(CONTAINER_OF(curr, struct OpenDb, moveenv));
+        }
+    }
+
+    if(oEnv->meta.durability != TRASH_SYNC_NONE)
+        mdb_env_sync(oEnv->env, 1);
+
     mdb_env_close(oEnv->env);
     pthread_rwlock_destroy(&oEnv->envLock);
+    pthread_mutex_destroy(&oEnv->syncMutex);
+    pthread_cond_destroy(&oEnv->syncCond);
+    pthread_mutex_destroy(&oEnv->poolMutex);
+    pthread_cond_destroy(&oEnv->poolCond);
+    free(oEnv->dbtable);
     free(oEnv);
     oEnv = NULL;
 }
@@ -233,6 +1053,47 @@ void emergency_cleanup() {
         pthread_rwlock_unlock(&oEnv->envLock);
 }
 
+/**
+ * @return  id of the newest write txn that is known to be on disk
+ */
+size_t trash_durable_txnid() {
+    return __atomic_load_n(&oEnv->durableTxnid, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @return  number of times the map was grown since open_env
+ */
+size_t trash_map_resizes() {
+    return __atomic_load_n(&oEnv->resizes, __ATOMIC_RELAXED);
+}
+
+/**
+ * Sums the stats of every thread. The counters of each thread are read without stopping it,
+ * so the snapshot is not taken at a single point in time.
+ */
+void trash_stats_snapshot(struct TrashStats *st) {
+    struct IL *curr;
+    unsigned long *dst, *src;
+    size_t n;
+
+    memset(st, 0, sizeof(struct TrashStats));
+
+    n = sizeof(struct TrashStats) / sizeof(unsigned long);
+    pthread_mutex_lock(&statsMutex);
+    if(statsBlocks.head.next != NULL) {
+        for_each(&statsBlocks.head, curr) {
+            struct StatsLocal *sl;
+            sl = CONTAINER_OF(curr, struct StatsLocal, movestats);
+
+            dst = (unsigned long *)st;
+            src = (unsigned long *)&sl->st;
+            for (size_t i = 0; i < n; i++)
+                dst[i] += __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&statsMutex);
+}
+
 int trash_txn(TrashTxn **tt, const char *dbname, int rd) {
     struct OpenDb *db;
     int rc;
@@ -241,6 +1102,38 @@ int trash_txn(TrashTxn **tt, const char *dbname, int rd) {
     if(db == NULL)
         return TRASH_DB_DNE;
 
+    if(rd == TRASH_WR_TXN && (rc = internal_sched_acquire(true)) != TRASH_DB_SUCCESS)
+        return rc;
+
+    rc = internal_begin_txn(tt, rd);
+    if(rc != TRASH_DB_SUCCESS)
+        return rc;
+
+    internal_add_db_txn(*tt, db);
+
+    return rc;
+}
+
+int trash_db(TrashDb **db, const char *dbname) {
+    if(db == NULL)
+        return TRASH_DB_ERROR;
+
+    *db = internal_get_open_db_locked(dbname);
+    if(*db == NULL)
+        return TRASH_DB_DNE;
+
+    return TRASH_DB_SUCCESS;
+}
+
+int trash_txn_db(TrashTxn **tt, TrashDb *db, int rd) {
+    int rc;
+
+    if(db == NULL)
+        return TRASH_DB_DNE;
+
+    if(rd == TRASH_WR_TXN && (rc = internal_sched_acquire(true)) != TRASH_DB_SUCCESS)
+        return rc;
+
     rc = internal_begin_txn(tt, rd);
     if(rc != TRASH_DB_SUCCESS)
         return rc;
@@ -250,19 +1143,50 @@ int trash_txn(TrashTxn **tt, const char *dbname, int rd) {
     return rc;
 }
 
+int change_txn_handle(TrashTxn *tt, TrashDb *db) {
+    size_t i;
+
+    if(tt == NULL)
+        return TRASH_TXN_INVALID;
+
+    if(db == NULL)
+        return TRASH_DB_DNE;
+
+    if(tt->dbscount > 0 && tt->dbs[tt->curdb] == db)
+        return TRASH_DB_SUCCESS;
+
+    i = internal_txn_find_db(tt, db);
+    if(i < tt->dbscount) {
+        tt->curdb = i;
+        return TRASH_DB_SUCCESS;
+    }
+
+    internal_add_db_txn(tt, db);
+
+    return TRASH_DB_SUCCESS;
+}
+
 int change_txn_db(TrashTxn *tt, const char *dbname) {
     struct OpenDb *db;
+    size_t i;
     int rc;
 
     if(tt == NULL)
         return TRASH_TXN_INVALID;
 
     if(tt->dbscount > 0) {
-        db = tt->dbs[tt->dbscount - 1];
+        db = tt->dbs[tt->curdb];
         rc = db_match(db, dbname);
         if(rc != TRASH_DB_ERROR) {
             return rc;
         }
+
+        // dbs already attached are switched to without the registry or the refcount
+        i = internal_txn_find_name(tt, dbname);
+        if(i < tt->dbscount) {
+            tt->curdb = i;
+            return TRASH_DB_SUCCESS;
+        }
     }
 
     db = tt->open_db(dbname);
@@ -281,54 +1205,195 @@ int change_txn_db(TrashTxn *tt, const char *dbname) {
 }
 
 void return_txn(TrashTxn *tt) {
+    int rc;
+
+    if(tt == NULL)
+        return;
+
+    rc = internal_return_txn(tt);
+    // a commit that fails here has no caller to report it to
+    assert(rc == 0);
+    (void)rc;
+}
+
+/**
+ * return_txn without the commit, the writes of the txn are dropped
+ */
+void trash_abort(TrashTxn *tt) {
     if(tt == NULL)
         return;
 
-    internal_txn_handler(tt);
+    tt->actions &= ~TRASH_TXN_COMMIT;
+    return_txn(tt);
+}
+
+/**
+ * return_txn for the callers that handle a failed commit, the writes of the txn are lost when it fails
+ * 
+ * @return  the lmdb error of the commit
+ */
+static int internal_return_txn(TrashTxn *tt) {
+    bool pooled;
+    int rc = 0;
+
+    pooled = internal_txn_handler(tt, &rc);
 
     for (size_t i = 0; i < tt->dbscount; i++) {
         internal_db_txn_decrement(tt->dbs[i], tt->fin_db);
     }
 
     tt->dbscount = 0;
+    tt->curdb = 0;
+    memset(tt->dbtab, 0, tt->dbtabcap * sizeof(unsigned int));
 
     return_cursor(tt->cur);
 
     // we do not save write txns
-    if(tt->actions & TRASH_WR_TXN || rdrPool == NULL) {
-        free(tt->dbs);
-        free(tt);
-    }
-}
+    if(!pooled)
+        internal_free_trash_txn(tt);
 
-int trash_cursor(TrashCursor **tc, TrashTxn *tt) {
-    struct OpenDb *db;
+    return rc;
+}
+
+/**
+ * Starts a nested lmdb txn, the writes after this can be undone with trash_rollback without losing the ones before it.
+ * A put that fails with MDB_MAP_FULL or MDB_TXN_FULL only breaks the nested txn, so the txn can still commit after a rollback.
+ * 
+ * @note    write cursors opened after the savepoint have to be returned before it is rolled back or released
+ * @note    the map is not grown while a savepoint is held
+ */
+int trash_savepoint(TrashTxn *tt) {
+    struct Savepoint *sp;
+    MDB_txn *child;
+    int rc;
+
+    if(tt == NULL || !(tt->actions & TRASH_WR_TXN))
+        return TRASH_TXN_INVALID;
+
+    if(tt->actions & TRASH_TXN_FAILED)
+        return MDB_BAD_TXN;
+
+    rc = mdb_txn_begin(oEnv->env, tt->txn, 0, &child);
+    if(rc != 0)
+        return rc;
+
+    if(tt->numsaves == tt->savescap) {
+        tt->savescap = (tt->savescap == 0) ? 4 : tt->savescap * 2;
+        tt->saves = (struct Savepoint *)realloc(tt->saves, tt->savescap * sizeof(struct Savepoint));
+        assert(tt->saves != NULL);
+    }
+
+    sp = &tt->saves[tt->numsaves++];
+    sp->parent = tt->txn;
+    sp->loglen = (tt->log != NULL) ? tt->log->len : 0;
+    sp->wbytes = tt->wbytes;
+    sp->curdb = tt->curdb;
+    sp->actions = tt->actions;
+    sp->numblooms = tt->numblooms;
+
+    tt->txn = child;
+
+    return TRASH_DB_SUCCESS;
+}
+
+/**
+ * Undoes the writes since the newest savepoint and drops it.
+ * The dbs attached since then stay attached, the txn goes back to the db it was on.
+ */
+int trash_rollback(TrashTxn *tt) {
+    struct Savepoint *sp;
+
+    if(tt == NULL || !(tt->actions & TRASH_WR_TXN))
+        return TRASH_TXN_INVALID;
+
+    if(tt->numsaves == 0)
+        return TRASH_DB_ERROR;
+
+    sp = &tt->saves[--tt->numsaves];
+    mdb_txn_abort(tt->txn);
+    internal_savepoint_restore(tt, sp);
+
+    return TRASH_DB_SUCCESS;
+}
+
+/**
+ * Keeps the writes since the newest savepoint in the txn and drops the savepoint
+ */
+int trash_release(TrashTxn *tt) {
+    int rc;
+
+    if(tt == NULL || !(tt->actions & TRASH_WR_TXN))
+        return TRASH_TXN_INVALID;
+
+    if(tt->numsaves == 0)
+        return TRASH_DB_ERROR;
+
+    // a failed commit has already freed the nested txn, so it is the same as a rollback
+    rc = mdb_txn_commit(tt->txn);
+    tt->numsaves--;
+    if(rc != 0) {
+        internal_savepoint_restore(tt, &tt->saves[tt->numsaves]);
+        return rc;
+    }
+    tt->txn = tt->saves[tt->numsaves].parent;
+
+    return TRASH_DB_SUCCESS;
+}
+
+int trash_cursor(TrashCursor **tc, TrashTxn *tt) {
+    struct OpenDb *db;
 
     if(tc == NULL)
         return TRASH_CUR_INVALID;
 
-    if(tt == NULL) 
+    if(tt == NULL || internal_reader_expired(tt)) 
         return TRASH_TXN_INVALID;
 
+    if(tt->actions & TRASH_TXN_FAILED)
+        return MDB_BAD_TXN;
+
     if(tt->dbscount == 0)
         return TRASH_DB_ERROR;
 
-    db = tt->dbs[tt->dbscount - 1];
+    db = tt->dbs[tt->curdb];
 
     if(tt->actions & TRASH_WR_TXN) {
         internal_create_trash_cursor(tc, db, WRITE);
+        (*tc)->txn = tt;
+        // the cursor would be left on the old txn if the map is grown
+        tt->actions |= TRASH_TXN_NOREPLAY;
+        internal_log_free(tt);
         assert(mdb_cursor_open(tt->txn, db->dbi, &(*tc)->cur) == 0);
         return TRASH_DB_SUCCESS;
     } 
 
-    pthread_mutex_lock(&db->odbMutex);
-    while(db->curcount <= 0)
-        pthread_cond_wait(&db->odbCond, &db->odbMutex);
+    // the thread cache needs no locking, the shared pool is only touched on a miss
+    *tc = internal_cached_cursor(db);
+    if(*tc == NULL) {
+        unsigned long start;
+
+        STATS_ADD(curmisses, 1);
+        STATS_CLOCK(start);
+        pthread_mutex_lock(&db->odbMutex);
+        STATS_SINCE(curwaitns, start);
+        if(db->curcount > 0)
+            *tc = db->curs[--db->curcount];
+        pthread_mutex_unlock(&db->odbMutex);
+    } else {
+        STATS_ADD(curhits, 1);
+    }
+
+    if(*tc == NULL) {
+        // read cursors are not limited by lmdb, so never wait for one
+        internal_create_trash_cursor(tc, db, READ);
+        (*tc)->txn = tt;
+        assert(mdb_cursor_open(tt->txn, db->dbi, &(*tc)->cur) == 0);
+        return TRASH_DB_SUCCESS;
+    }
 
-    *tc = db->curs[--db->curcount];
     (*tc)->db = db; 
+    (*tc)->txn = tt;
     assert(mdb_cursor_renew(tt->txn, (*tc)->cur) == 0);
-    pthread_mutex_unlock(&db->odbMutex);
     
     return TRASH_DB_SUCCESS;
 }
@@ -341,15 +1406,26 @@ void return_cursor(TrashCursor *tc) {
 
     if(tc->rw == WRITE) {
         mdb_cursor_close(tc->cur);
-        free(tc);
+        internal_free_trash_cursor(tc);
         return;
     }
 
+    if(internal_cache_cursor(tc) == TRASH_DB_SUCCESS)
+        return;
+
     db = tc->db;
     pthread_mutex_lock(&db->odbMutex);
-    db->curs[db->curcount++] = tc;
-    pthread_cond_signal(&db->odbCond);
+    if(db->curcount < db->curscap) {
+        db->curs[db->curcount++] = tc;
+        tc = NULL;
+    }
     pthread_mutex_unlock(&db->odbMutex);
+
+    // both the thread cache and the shared pool are full
+    if(tc != NULL) {
+        mdb_cursor_close(tc->cur);
+        internal_free_trash_cursor(tc);
+    }
 }
 
 /**
@@ -412,7 +1488,7 @@ void return_cursor(TrashCursor *tc) {
 void close_db(const char *dbname) {
     struct OpenDb *db;
 
-    pthread_rwlock_wrlock(&oEnv->envLock);
+    internal_env_wrlock();
     db = internal_get_open_db(dbname);
     if(db == NULL) {
         pthread_rwlock_unlock(&oEnv->envLock);
@@ -424,12 +1500,20 @@ void close_db(const char *dbname) {
 
 int write_db_meta(struct DbMeta *dbmeta) {
     TrashTxn *temp;
-    MDB_dbi dbi;
+    MDB_dbi dbi, ttldbi = 0;
     struct OpenDb *db;
     MDB_val key, val;
     int rc;
 
-    pthread_rwlock_wrlock(&oEnv->envLock);
+    if((dbmeta->flags & TRASH_DB_KEY_MASK) > TRASH_DB_KEY_TUPLE)
+        return TRASH_DB_ERROR;
+    if((dbmeta->flags & TRASH_DB_KEY_MASK) == TRASH_DB_KEY_FIXED && dbmeta->keywidth == 0)
+        return TRASH_DB_ERROR;
+    // the expiry in front of the values would order dups, and cached values would outlive it
+    if((dbmeta->flags & TRASH_DB_TTL) && (dbmeta->flags & (MDB_DUPSORT | TRASH_DB_CACHE)))
+        return TRASH_DB_ERROR;
+
+    internal_env_wrlock();
     db = internal_get_open_db(dbmeta->name);
     if(db != NULL) {
         pthread_rwlock_unlock(&oEnv->envLock);
@@ -442,7 +1526,7 @@ int write_db_meta(struct DbMeta *dbmeta) {
 
     change_txn_db(temp, METADATA);
     
-    rc = mdb_dbi_open(temp->txn, dbmeta->name, dbmeta->flags, &dbi);
+    rc = internal_dbi_open(temp->txn, dbmeta, dbmeta->flags & ~TRASH_DB_OWN_FLAGS, &dbi, &ttldbi);
     assert(rc == 0);
 
     char key_buf[TRASH_DB_NAME_LEN] = {0};
@@ -457,6 +1541,7 @@ int write_db_meta(struct DbMeta *dbmeta) {
     assert(rc == 0);
     
     db = internal_add_db(dbmeta, dbi);
+    db->ttldbi = ttldbi;
 
     temp->actions |= TRASH_TXN_COMMIT;
     return_txn(temp);
@@ -468,6 +1553,7 @@ int write_db_meta(struct DbMeta *dbmeta) {
     change_txn_db(temp, db->name);
 
     internal_add_db_curs(db, temp);
+    internal_bloom_load(db, temp->txn);
     return_txn(temp);
 
     pthread_rwlock_unlock(&oEnv->envLock);
@@ -476,408 +1562,5888 @@ int write_db_meta(struct DbMeta *dbmeta) {
 }
 
 /**
+ * The keys of a TRASH_DB_TTL db expire after the ttlsecs of the db
+ * 
  * @todo    flags need to be checked with how the dbi was opened initially
  */
 int trash_put(TrashTxn *tt, MDB_val *key, MDB_val *val, unsigned int flags) {
+    if(tt->dbscount == 0 || tt->actions & TRASH_RD_TXN)
+        return TRASH_DB_ERROR;
+
+    return trash_put_expire(tt, key, val, flags, internal_ttl_expiry(tt->dbs[tt->curdb]));
+}
+
+/**
+ * Puts a key of a TRASH_DB_TTL db that expires at expiry, in ms since the epoch (never when 0).
+ * In other dbs expiry is ignored.
+ */
+int trash_put_expire(TrashTxn *tt, MDB_val *key, MDB_val *val, unsigned int flags, uint64_t expiry) {
     struct OpenDb *db;
+    MDB_val stored;
+    unsigned long start;
     int rc;
     
     if(tt->dbscount == 0 || tt->actions & TRASH_RD_TXN)
         return TRASH_DB_ERROR;
 
-    db = tt->dbs[tt->dbscount - 1];
-    rc = mdb_put(tt->txn, db->dbi, key, val, flags);
+    if(tt->actions & TRASH_TXN_FAILED)
+        return MDB_BAD_TXN;
+
+    db = tt->dbs[tt->curdb];
+    if(!internal_key_ok(db, key))
+        return TRASH_DB_ERROR;
+
+    if(internal_sched_due(tt) && (rc = internal_sched_chunk(tt)) != 0)
+        return rc;
+
+    STATS_CLOCK(start);
+    for(;;) {
+        if(db->flags & TRASH_DB_TTL) {
+            rc = internal_ttl_put(tt->txn, NULL, db, key, val, flags, expiry, &stored);
+        } else {
+            rc = mdb_put(tt->txn, db->dbi, key, val, flags);
+        }
+        if(rc != MDB_MAP_FULL || internal_txn_regrow(tt) != TRASH_DB_SUCCESS)
+            break;
+    }
+
+    if(rc == 0)
+        rc = internal_bloom_write(tt, db, key);
+
     if(rc == 0) {
         tt->actions |= TRASH_TXN_COMMIT;
+        tt->wbytes += key->mv_size + val->mv_size;
+        if(db->flags & TRASH_DB_TTL) {
+            internal_ttl_log(tt, db, key, &stored, flags);
+        } else {
+            internal_log_put(tt, db->dbi, key, val, flags);
+        }
+        internal_cache_note(tt, db, key);
+    } else if(rc == MDB_MAP_FULL || rc == MDB_TXN_FULL) {
+        // lmdb only allows the txn to be aborted now
+        tt->actions &= ~TRASH_TXN_COMMIT;
     }
+    STATS_HIST(TRASH_HIST_PUT, start);
     return rc;
 }
 
 int trash_get(TrashTxn *tt, MDB_val *key, MDB_val *data) {
     struct OpenDb *db;
+    unsigned long start;
     int rc;
     
+    if(internal_reader_expired(tt))
+        return TRASH_TXN_INVALID;
+
+    if(tt->actions & TRASH_TXN_FAILED)
+        return MDB_BAD_TXN;
+
     if(tt->dbscount == 0)
         return TRASH_DB_ERROR;
     
-    db = tt->dbs[tt->dbscount - 1];
-    rc = mdb_get(tt->txn, db->dbi, key, data);
+    STATS_CLOCK(start);
+    db = tt->dbs[tt->curdb];
+    if(db->bloom != NULL && !internal_bloom_test(db->bloom, key)) {
+        STATS_ADD(bloomnegs, 1);
+        rc = MDB_NOTFOUND;
+    } else {
+        rc = mdb_get(tt->txn, db->dbi, key, data);
+        if(rc == 0 && (db->flags & TRASH_DB_TTL) && !internal_ttl_live(data, internal_wall_ms()))
+            rc = MDB_NOTFOUND;
+    }
+    STATS_HIST(TRASH_HIST_GET, start);
     return rc;
 }
 
-int trash_cur_put(TrashCursor *tc, MDB_val *key, MDB_val *val, unsigned int flags) {
+/**
+ * Copies the value of key into buf, len is the size of buf and is set to the size of the value.
+ * A hit in the cache of a TRASH_DB_CACHE db takes no txn, a miss reads the latest snapshot and caches the value.
+ * 
+ * @return  0, MDB_NOTFOUND, or TRASH_DB_ERROR when buf is too small
+ */
+int trash_cache_get(TrashDb *db, MDB_val *key, void *buf, size_t *len) {
+    TrashTxn *tt;
+    MDB_val val;
     int rc;
 
-    if(tc == NULL)
+    if(db == NULL || key == NULL || len == NULL)
         return TRASH_DB_ERROR;
 
-    rc = mdb_cursor_put(tc->cur, key, val, flags);
-    return rc;
-}
+    if(db->cache != NULL) {
+        rc = internal_cache_lookup(db->cache, key, buf, len);
+        if(rc != MDB_NOTFOUND) {
+            STATS_ADD(cachehits, 1);
+            return rc;
+        }
+        STATS_ADD(cachemisses, 1);
+    }
 
-int trash_cur_get(TrashCursor *tc, MDB_val *key, MDB_val *val, MDB_cursor_op op) {
-    int rc;
+    rc = trash_txn_db(&tt, db, TRASH_RD_TXN);
+    if(rc != TRASH_DB_SUCCESS)
+        return rc;
 
-    if(tc == NULL)
-        return TRASH_DB_ERROR;
+    rc = trash_get(tt, key, &val);
+    if(rc == 0) {
+        if(db->cache != NULL)
+            internal_cache_insert(db->cache, key, &val, mdb_txn_id(tt->txn));
+
+        if(val.mv_size > *len) {
+            rc = TRASH_DB_ERROR;
+        } else {
+            memcpy(buf, val.mv_data, val.mv_size);
+        }
+        *len = val.mv_size;
+    }
+    return_txn(tt);
 
-    rc = mdb_cursor_get(tc->cur, key, val, op);
     return rc;
 }
 
-
 /**
- * @note    Should only be called on startup. no need for locks in this function only 1 thread should be running
+ * Looks up every key in the current db of the txn with a single cursor.
+ * The keys are probed in db order so neighbouring keys are found on the leaf page the cursor is already on.
+ * With TRASH_GET_PREFETCH the pages of values spilling over one lmdb page are prefetched for the caller.
+ * 
+ * @note    vals[i] and rcs[i] are filled in for keys[i], rcs[i] is 0 or the lmdb error of that key
  */
-static void init_metadata() {
-    TrashTxn *tt;
-    MDB_txn *txn;
-    MDB_dbi dbi;
+int trash_get_many(TrashTxn *tt, MDB_val *keys, MDB_val *vals, int *rcs, size_t numkeys, unsigned int flags) {
     struct OpenDb *db;
-    struct DbMeta dbmeta;
+    TrashCursor *tc = NULL;
+    MDB_cursor *cur;
+    size_t *order;
+    uint64_t now = 0;
     int rc;
 
-    rc = mdb_txn_begin(oEnv->env, NULL, 0, &txn);
-    assert(rc == 0);
+    if(tt == NULL || internal_reader_expired(tt))
+        return TRASH_TXN_INVALID;
 
-    dbmeta.name = METADATA;
-    dbmeta.flags = METADATA_FLAGS;
-    dbmeta.slots = 1;
+    if(tt->actions & TRASH_TXN_FAILED)
+        return MDB_BAD_TXN;
 
-    rc = mdb_dbi_open(txn, dbmeta.name, dbmeta.flags, &dbi);
-    assert(rc == 0);
-    mdb_txn_commit(txn);
+    if(tt->dbscount == 0 || keys == NULL || vals == NULL || rcs == NULL)
+        return TRASH_DB_ERROR;
 
-    db = internal_add_db(&dbmeta, dbi);
-    trash_txn(&tt, METADATA, TRASH_RD_TXN);
-    internal_add_db_curs(db, tt);
+    if(numkeys == 0)
+        return TRASH_DB_SUCCESS;
 
-    return_txn(tt);
-}
+    db = tt->dbs[tt->curdb];
+    if(db->flags & TRASH_DB_TTL)
+        now = internal_wall_ms();
 
-static void internal_close_db(struct OpenDb *db) {
-    pthread_mutex_lock(&db->odbMutex);
-    if(db->txncount == 0) {
-        internal_fin_db(db);
+    order = (size_t *)malloc(numkeys * sizeof(size_t));
+    assert(order != NULL);
+    internal_sort_keys(tt->txn, db->dbi, keys, order, numkeys);
+
+    // a trash write cursor would stop the txn from being replayed when the map grows
+    if(tt->actions & TRASH_WR_TXN) {
+        rc = mdb_cursor_open(tt->txn, db->dbi, &cur);
+        if(rc != 0) {
+            free(order);
+            return rc;
+        }
     } else {
-        db->state = DB_CLOSE;
-        pthread_mutex_unlock(&db->odbMutex);
+        rc = trash_cursor(&tc, tt);
+        if(rc != TRASH_DB_SUCCESS) {
+            free(order);
+            return rc;
+        }
+        cur = tc->cur;
     }
-}
 
-static void internal_open_all_db(TrashTxn *tt) {
-    MDB_cursor *curr;
-    MDB_dbi dbi;
-    MDB_val key, val;
-    struct OpenDb *db;
-    struct DbMeta dbmeta;
-    int rc;
+    for (size_t i = 0; i < numkeys; i++) {
+        size_t idx = order[i];
+        MDB_val key = keys[idx];
 
-    change_txn_db(tt, METADATA);
-    // open all dbs if the key exists 
-    // meaning the env has already been configured and we might have dbs created
-    db = tt->dbs[tt->dbscount - 1];
-    rc = mdb_cursor_open(tt->txn, db->dbi, &curr);
-    assert(rc == 0);
+        if(db->bloom != NULL && !internal_bloom_test(db->bloom, &key)) {
+            STATS_ADD(bloomnegs, 1);
+            rcs[idx] = MDB_NOTFOUND;
+            continue;
+        }
 
-    key.mv_size = DB_PREFIX_LEN;
-    key.mv_data = DB_PREFIX;
+        rcs[idx] = mdb_cursor_get(cur, &key, &vals[idx], MDB_SET_KEY);
+        if(rcs[idx] == 0 && (db->flags & TRASH_DB_TTL) && !internal_ttl_live(&vals[idx], now))
+            rcs[idx] = MDB_NOTFOUND;
+        if(rcs[idx] == 0 && (flags & TRASH_GET_PREFETCH))
+            internal_prefetch(&vals[idx]);
+    }
 
-    MDB_cursor_op op = MDB_SET_RANGE;
-    while((rc = mdb_cursor_get(curr, &key, &val, op)) == 0) {
-        struct OpenDb *db;
-        char *dbKeyName;
+    if(tc != NULL) {
+        return_cursor(tc);
+    } else {
+        mdb_cursor_close(cur);
+    }
+    free(order);
 
-        dbKeyName = (char *)key.mv_data;
-        rc = memcmp(dbKeyName, DB_PREFIX, DB_PREFIX_LEN);
-        if(rc != 0) {
-            break;
-        }
+    return TRASH_DB_SUCCESS;
+}
 
-        memcpy(&dbmeta, val.mv_data, val.mv_size);
+/**
+ * Points key at num, the native integer key of a TRASH_DB_KEY_U32, TRASH_DB_KEY_U64 or TRASH_DB_KEY_I64 db
+ */
+void trash_key_num(MDB_val *key, void *num, unsigned int keytype) {
+    key->mv_data = num;
+    key->mv_size = (keytype == TRASH_DB_KEY_U32) ? sizeof(uint32_t) : sizeof(uint64_t);
+}
 
-        rc = mdb_dbi_open(tt->txn, dbmeta.name, dbmeta.flags, &dbi);
-        assert(rc == 0);
-        db = internal_add_db(&dbmeta, dbi);
-        internal_add_db_curs(db, tt);
+/**
+ * @return  the integer of a key of an integer db, cast to int64_t for a TRASH_DB_KEY_I64 db, 0 for any other size
+ * @note    keys in lmdb pages are only 2 byte aligned, so they are copied out
+ */
+uint64_t trash_key_to_num(const MDB_val *key) {
+    uint32_t n32;
+    uint64_t n64;
 
-        op = MDB_NEXT;
+    if(key->mv_size == sizeof(uint32_t)) {
+        memcpy(&n32, key->mv_data, sizeof(n32));
+        return n32;
     }
 
-    mdb_cursor_close(curr);
-    // return_cursor(curr);
+    if(key->mv_size != sizeof(uint64_t))
+        return 0;
+
+    memcpy(&n64, key->mv_data, sizeof(n64));
+    return n64;
 }
 
+/**
+ * Builds the key of a TRASH_DB_KEY_FIXED db in buf, data is padded with zeros up to width
+ */
+int trash_key_fixed(MDB_val *key, void *buf, size_t width, const void *data, size_t len) {
+    if(len > width)
+        return TRASH_DB_ERROR;
 
-static void internal_txn_handler(TrashTxn *tt) {
-    bool committed = false;
+    memcpy(buf, data, len);
+    memset((char *)buf + len, 0, width - len);
 
-    if(tt->actions & TRASH_TXN_COMMIT) {
-        assert(mdb_txn_commit(tt->txn) == 0);
-        tt->actions &= ~TRASH_TXN_COMMIT;
-        committed = true;
-    }
+    key->mv_data = buf;
+    key->mv_size = width;
 
-    // abort write txns if not committed
-    if((tt->actions & TRASH_WR_TXN) && !committed) {
-        // abort if the txn was not commited
-        mdb_txn_abort(tt->txn);
-    }
-    
-    if(tt->actions & TRASH_RD_TXN) {
-        // reset read txn if it has not been committed
-        if(!committed) {
-            mdb_txn_reset(tt->txn);
-        }
+    return TRASH_DB_SUCCESS;
+}
 
-        if(rdrPool == NULL || rdrPool->numTxns >= rdrPool->cap) {
-            mdb_txn_abort(tt->txn);
-            return;
+/**
+ * Packs the parts into buf so the keys order part by part under lmdb's memcmp.
+ * Numbers are big endian, an int64_t with its sign bit flipped.
+ * Bytes have each 0x00 escaped as 0x00 0xff and end with 0x00 0x00, so a shorter part orders first.
+ * 
+ * @return  TRASH_DB_ERROR when buf is too small or a part is invalid
+ */
+int trash_key_pack(MDB_val *key, void *buf, size_t cap, const struct TrashKeyPart *parts, size_t numparts) {
+    unsigned char *out = (unsigned char *)buf;
+    size_t n = 0;
+
+    for (size_t i = 0; i < numparts; i++) {
+        const struct TrashKeyPart *part = &parts[i];
+        const unsigned char *in;
+        uint64_t num;
+        size_t width;
+
+        switch (part->type) {
+        case TRASH_PART_U32:
+            if(part->unum > UINT32_MAX)
+                return TRASH_DB_ERROR;
+            num = part->unum;
+            width = sizeof(uint32_t);
+            break;
+        case TRASH_PART_U64:
+            num = part->unum;
+            width = sizeof(uint64_t);
+            break;
+        case TRASH_PART_I64:
+            num = (uint64_t)part->snum ^ ((uint64_t)1 << 63);
+            width = sizeof(uint64_t);
+            break;
+        case TRASH_PART_BYTES:
+            in = (const unsigned char *)part->bytes.mv_data;
+            for (size_t j = 0; j < part->bytes.mv_size; j++) {
+                if(n + 2 > cap)
+                    return TRASH_DB_ERROR;
+                out[n++] = in[j];
+                if(in[j] == 0)
+                    out[n++] = 0xff;
+            }
+            if(n + 2 > cap)
+                return TRASH_DB_ERROR;
+            out[n++] = 0;
+            out[n++] = 0;
+            continue;
+        default:
+            return TRASH_DB_ERROR;
         }
 
-        rdrPool->txns[rdrPool->numTxns++] = tt;
+        if(n + width > cap)
+            return TRASH_DB_ERROR;
+        for (size_t j = 0; j < width; j++)
+            out[n++] = (unsigned char)(num >> ((width - 1 - j) * 8));
     }
-}
 
-static void internal_fin_db_locked(struct OpenDb *db) {
-    pthread_rwlock_wrlock(&oEnv->envLock);
-    internal_fin_db(db);
-    pthread_rwlock_unlock(&oEnv->envLock);
+    key->mv_data = buf;
+    key->mv_size = n;
+
+    return TRASH_DB_SUCCESS;
 }
 
-static void internal_fin_db(struct OpenDb *db) {
-    mdb_dbi_close(oEnv->env, db->dbi);
-    item_remove(&db->moveenv);
-    /**
-     *  @todo   locking issue with oEnv->dbs decrement  
-    */ 
-    oEnv->dbs.len--;
+/**
+ * Unpacks a key built by trash_key_pack, the type of each part must be set by the caller.
+ * Bytes are unescaped into buf, their mv_data points into it.
+ * 
+ * @return  TRASH_DB_ERROR when the key does not match the parts or buf is too small
+ */
+int trash_key_unpack(const MDB_val *key, struct TrashKeyPart *parts, size_t numparts, void *buf, size_t cap) {
+    const unsigned char *in = (const unsigned char *)key->mv_data;
+    unsigned char *out = (unsigned char *)buf;
+    size_t n = 0, used = 0;
+
+    for (size_t i = 0; i < numparts; i++) {
+        struct TrashKeyPart *part = &parts[i];
+        uint64_t num = 0;
+        size_t width, start;
+        unsigned char c;
+
+        switch (part->type) {
+        case TRASH_PART_U32:
+            width = sizeof(uint32_t);
+            break;
+        case TRASH_PART_U64:
+        case TRASH_PART_I64:
+            width = sizeof(uint64_t);
+            break;
+        case TRASH_PART_BYTES:
+            start = used;
+            for (;;) {
+                if(n >= key->mv_size)
+                    return TRASH_DB_ERROR;
+                c = in[n++];
+                if(c == 0) {
+                    if(n >= key->mv_size)
+                        return TRASH_DB_ERROR;
+                    if(in[n] == 0) {
+                        n++;
+                        break;
+                    }
+                    if(in[n++] != 0xff)
+                        return TRASH_DB_ERROR;
+                }
+                if(used >= cap)
+                    return TRASH_DB_ERROR;
+                out[used++] = c;
+            }
+            part->bytes.mv_data = out + start;
+            part->bytes.mv_size = used - start;
+            continue;
+        default:
+            return TRASH_DB_ERROR;
+        }
 
-    pthread_mutex_destroy(&db->odbMutex);
+        if(n + width > key->mv_size)
+            return TRASH_DB_ERROR;
+        for (size_t j = 0; j < width; j++)
+            num = (num << 8) | in[n++];
 
-    for (size_t i = 0; i < db->curcount; i++) {
-        TrashCursor *tc = db->curs[i];
-        mdb_cursor_close(tc->cur);
-        free(tc);
+        if(part->type == TRASH_PART_I64)
+            part->snum = (int64_t)(num ^ ((uint64_t)1 << 63));
+        else
+            part->unum = num;
     }
 
-    free(db->curs);
-    free(db);
-
-    if(oEnv->state == ENV_CLOSE && oEnv->dbs.len == 0)
-        close_env();
+    return (n == key->mv_size) ? TRASH_DB_SUCCESS : TRASH_DB_ERROR;
 }
 
-static void internal_db_txn_decrement(struct OpenDb *db, void (*fin_db)(struct OpenDb *)) {
-    pthread_mutex_lock(&db->odbMutex);
-    if(db->txncount > 0)
-        db->txncount--;
-
-    if(db->state == DB_CLOSE && db->txncount == 0) {
-        fin_db(db);
-    }
+/**
+ * Iterates over the current db of the txn.
+ * With TRASH_ITER_PREFIX every key starting with lo is visited and hi is ignored.
+ * Otherwise keys from lo (inclusive) up to hi (exclusive, inclusive with TRASH_ITER_HI_INCL) are visited,
+ * a NULL bound leaves that side open. A limit of 0 means no limit.
+ * 
+ * @note    the bounds are not copied, they must stay valid until the iterator is returned
+ * @note    prefixes assume the db uses the default lmdb key order
+ */
+int trash_iter(TrashIter **it, TrashTxn *tt, MDB_val *lo, MDB_val *hi, unsigned int flags, size_t limit) {
+    struct OpenDb *db;
+    TrashCursor *tc;
+    int rc;
+
+    if(it == NULL)
+        return TRASH_CUR_INVALID;
+
+    if(tt == NULL)
+        return TRASH_TXN_INVALID;
+
+    if(tt->dbscount == 0 || ((flags & TRASH_ITER_PREFIX) && lo == NULL))
+        return TRASH_DB_ERROR;
+
+    rc = trash_cursor(&tc, tt);
+    if(rc != TRASH_DB_SUCCESS)
+        return rc;
+
+    db = tt->dbs[tt->curdb];
+
+    *it = (TrashIter *)calloc(1, sizeof(TrashIter));
+    assert(*it != NULL);
+
+    (*it)->tc = tc;
+    (*it)->txn = tt->txn;
+    (*it)->dbi = db->dbi;
+    (*it)->flags = flags;
+    (*it)->ttl = (db->flags & TRASH_DB_TTL) != 0;
+    (*it)->limit = limit;
+    if(lo != NULL) {
+        (*it)->lo = *lo;
+        (*it)->haslo = true;
+    }
+    if(hi != NULL && !(flags & TRASH_ITER_PREFIX)) {
+        (*it)->hi = *hi;
+        (*it)->hashi = true;
+    }
+
+    return TRASH_DB_SUCCESS;
+}
+
+void return_iter(TrashIter *it) {
+    if(it == NULL)
+        return;
+
+    return_cursor(it->tc);
+    free(it);
+}
+
+/**
+ * @return  0 with the next pair, MDB_NOTFOUND once the bounds or limit are reached
+ */
+int trash_iter_next(TrashIter *it, MDB_val *key, MDB_val *val) {
+    int rc;
+
+    if(it == NULL)
+        return TRASH_CUR_INVALID;
+
+    if(it->done)
+        return MDB_NOTFOUND;
+
+    if(internal_reader_expired(it->tc->txn))
+        return TRASH_TXN_INVALID;
+
+    if(it->limit > 0 && it->count >= it->limit) {
+        it->done = true;
+        return MDB_NOTFOUND;
+    }
+
+    if(!it->started) {
+        it->started = true;
+        rc = internal_iter_seek(it, key, val);
+    } else {
+        rc = mdb_cursor_get(it->tc->cur, key, val, (it->flags & TRASH_ITER_REVERSE) ? MDB_PREV : MDB_NEXT);
+    }
+
+    if(it->ttl) {
+        uint64_t now = internal_wall_ms();
+
+        while(rc == 0 && !internal_ttl_live(val, now))
+            rc = mdb_cursor_get(it->tc->cur, key, val, (it->flags & TRASH_ITER_REVERSE) ? MDB_PREV : MDB_NEXT);
+    }
+
+    if(rc == 0 && !internal_iter_in_bounds(it, key))
+        rc = MDB_NOTFOUND;
+
+    if(rc != 0) {
+        it->done = true;
+        return rc;
+    }
+
+    it->count++;
+    return 0;
+}
+
+/**
+ * Fills up to max pairs. The pairs point into the map and stay valid until the txn is returned.
+ * 
+ * @return  number of pairs filled, 0 once the iterator is done
+ */
+size_t trash_iter_batch(TrashIter *it, MDB_val *keys, MDB_val *vals, size_t max) {
+    MDB_cursor_op op;
+    uint64_t now = 0;
+    size_t n = 0;
+
+    if(it == NULL || it->done || max == 0 || internal_reader_expired(it->tc->txn))
+        return 0;
+
+    if(it->ttl)
+        now = internal_wall_ms();
+
+    if(!it->started) {
+        if(trash_iter_next(it, &keys[0], &vals[0]) != 0)
+            return 0;
+        n++;
+    }
+
+    // same as trash_iter_next without the per call checks
+    op = (it->flags & TRASH_ITER_REVERSE) ? MDB_PREV : MDB_NEXT;
+    while(n < max) {
+        if(it->limit > 0 && it->count >= it->limit) {
+            it->done = true;
+            break;
+        }
+
+        if(mdb_cursor_get(it->tc->cur, &keys[n], &vals[n], op) != 0 || !internal_iter_in_bounds(it, &keys[n])) {
+            it->done = true;
+            break;
+        }
+
+        if(it->ttl && !internal_ttl_live(&vals[n], now))
+            continue;
+
+        it->count++;
+        n++;
+    }
+
+    return n;
+}
+
+int trash_cur_put(TrashCursor *tc, MDB_val *key, MDB_val *val, unsigned int flags) {
+    int rc;
+
+    if(tc == NULL)
+        return TRASH_DB_ERROR;
+
+    // MDB_CURRENT keeps the key the cursor is on
+    if(!(flags & MDB_CURRENT) && !internal_key_ok(tc->db, key))
+        return TRASH_DB_ERROR;
+
+    if(tc->db->flags & TRASH_DB_TTL) {
+        MDB_val stored;
+        rc = internal_ttl_put(mdb_cursor_txn(tc->cur), tc->cur, tc->db, key, val, flags, internal_ttl_expiry(tc->db), &stored);
+    } else {
+        rc = mdb_cursor_put(tc->cur, key, val, flags);
+    }
+    if(tc->txn != NULL) {
+        if(rc == 0 && (tc->db->cache != NULL || tc->db->bloom != NULL)) {
+            MDB_val cur, data;
+
+            // MDB_CURRENT writes the key the cursor is on
+            cur = *key;
+            if(flags & MDB_CURRENT)
+                mdb_cursor_get(tc->cur, &cur, &data, MDB_GET_CURRENT);
+            internal_cache_note(tc->txn, tc->db, &cur);
+            rc = internal_bloom_write(tc->txn, tc->db, &cur);
+        }
+
+        if(rc == 0) {
+            tc->txn->wbytes += key->mv_size + val->mv_size;
+        } else if(rc == MDB_MAP_FULL || rc == MDB_TXN_FULL) {
+            tc->txn->actions &= ~TRASH_TXN_COMMIT;
+        }
+    }
+    return rc;
+}
+
+int trash_cur_get(TrashCursor *tc, MDB_val *key, MDB_val *val, MDB_cursor_op op) {
+    int rc;
+
+    if(tc == NULL)
+        return TRASH_DB_ERROR;
+
+    if(tc->txn != NULL && internal_reader_expired(tc->txn))
+        return TRASH_TXN_INVALID;
+
+    rc = mdb_cursor_get(tc->cur, key, val, op);
+    if(tc->db->flags & TRASH_DB_TTL) {
+        uint64_t now = internal_wall_ms();
+
+        // moves carry on past expired pairs, lookups of one miss
+        while(rc == 0 && !internal_ttl_live(val, now)) {
+            switch (op) {
+            case MDB_FIRST:
+            case MDB_NEXT:
+            case MDB_NEXT_NODUP:
+            case MDB_SET_RANGE:
+                op = MDB_NEXT;
+                break;
+            case MDB_LAST:
+            case MDB_PREV:
+            case MDB_PREV_NODUP:
+                op = MDB_PREV;
+                break;
+            default:
+                return MDB_NOTFOUND;
+            }
+            rc = mdb_cursor_get(tc->cur, key, val, op);
+        }
+    }
+    return rc;
+}
+
+/**
+ * Loads unsorted pairs into an existing db. The pairs are sorted with the db comparator and written with
+ * MDB_APPEND (MDB_APPENDDUP for dupsort dbs) in bounded write txns so every leaf page is filled once.
+ * Pairs that sort before data already in the db fall back to a regular put.
+ * When a key is given more than once in a non dupsort db the last value wins.
+ */
+int trash_bulk_load(struct TrashBulk *bl) {
+    struct BulkLoad ld;
+    struct BulkRun *runs;
+    TrashTxn *tt;
+    MDB_val key, val;
+    size_t numruns, need;
+    unsigned int flags;
+    int rc;
+
+    if(bl == NULL || bl->db == NULL || bl->next == NULL)
+        return TRASH_DB_ERROR;
+
+    // appended values would have no expiry
+    if(bl->db->flags & TRASH_DB_TTL)
+        return TRASH_DB_ERROR;
+
+    memset(&ld, 0, sizeof(struct BulkLoad));
+    ld.bl = bl;
+    ld.dbi = bl->db->dbi;
+    bl->loaded = 0;
+    if(bl->membytes == 0)
+        bl->membytes = TRASH_BULK_MEM;
+    if(bl->txnops == 0)
+        bl->txnops = TRASH_BULK_TXN_OPS;
+    if(bl->threads == 0)
+        bl->threads = TRASH_BULK_THREADS;
+
+    rc = trash_txn_db(&tt, bl->db, TRASH_RD_TXN);
+    if(rc != TRASH_DB_SUCCESS)
+        return rc;
+    rc = mdb_dbi_flags(tt->txn, ld.dbi, &flags);
+    return_txn(tt);
+    if(rc != 0)
+        return rc;
+    ld.dups = (flags & MDB_DUPSORT) != 0;
+
+    ld.arenacap = bl->membytes;
+    ld.arena = (char *)malloc(ld.arenacap);
+    assert(ld.arena != NULL);
+
+    rc = TRASH_DB_SUCCESS;
+    while(rc == TRASH_DB_SUCCESS && bl->next(bl->ctx, &key, &val) == 0) {
+        need = key.mv_size + val.mv_size;
+        if(ld.arenalen + need > ld.arenacap && ld.numrecs > 0) {
+            rc = internal_bulk_spill(&ld);
+            // the arena is still full and its records still point into it
+            if(rc != TRASH_DB_SUCCESS)
+                break;
+        }
+
+        // a single pair bigger than the arena gets an arena of its own
+        if(need > ld.arenacap) {
+            free(ld.arena);
+            ld.arenacap = need;
+            ld.arena = (char *)malloc(ld.arenacap);
+            assert(ld.arena != NULL);
+        }
+
+        if(ld.numrecs == ld.reccap) {
+            ld.reccap = (ld.reccap == 0) ? 1024 : ld.reccap << 1;
+            ld.recs = (struct BulkRec *)realloc(ld.recs, ld.reccap * sizeof(struct BulkRec));
+            assert(ld.recs != NULL);
+        }
+
+        ld.recs[ld.numrecs].key.mv_data = ld.arena + ld.arenalen;
+        ld.recs[ld.numrecs].key.mv_size = key.mv_size;
+        memcpy(ld.arena + ld.arenalen, key.mv_data, key.mv_size);
+        ld.arenalen += key.mv_size;
+
+        ld.recs[ld.numrecs].val.mv_data = ld.arena + ld.arenalen;
+        ld.recs[ld.numrecs].val.mv_size = val.mv_size;
+        memcpy(ld.arena + ld.arenalen, val.mv_data, val.mv_size);
+        ld.arenalen += val.mv_size;
+
+        ld.numrecs++;
+    }
+
+    if(rc == TRASH_DB_SUCCESS && ld.numspills > 0 && ld.numrecs > 0)
+        rc = internal_bulk_spill(&ld);
+
+    if(rc == TRASH_DB_SUCCESS) {
+        if(ld.numspills > 0) {
+            runs = (struct BulkRun *)calloc(ld.numspills, sizeof(struct BulkRun));
+            assert(runs != NULL);
+            for (size_t i = 0; i < ld.numspills; i++)
+                runs[i].fp = ld.spills[i];
+            numruns = ld.numspills;
+        } else {
+            // everything fit in memory, the sorted slices are merged straight into the db
+            runs = (struct BulkRun *)calloc(bl->threads, sizeof(struct BulkRun));
+            assert(runs != NULL);
+            rc = trash_txn_db(&tt, bl->db, TRASH_RD_TXN);
+            numruns = 0;
+            if(rc == TRASH_DB_SUCCESS) {
+                numruns = internal_bulk_sort_slices(&ld, tt->txn, runs);
+                return_txn(tt);
+            }
+        }
+
+        if(rc == TRASH_DB_SUCCESS)
+            rc = internal_bulk_insert(&ld, runs, numruns);
+
+        for (size_t i = 0; i < numruns; i++)
+            free(runs[i].buf);
+        free(runs);
+    }
+
+    for (size_t i = 0; i < ld.numspills; i++)
+        fclose(ld.spills[i]);
+    free(ld.spills);
+    free(ld.recs);
+    free(ld.tmp);
+    free(ld.arena);
+
+    return rc;
+}
+
+/**
+ * Starts the committer thread. Batches handed to trash_submit are folded into one write txn
+ * until either maxops ops are queued or maxwaitus has passed since the first batch was queued.
+ * 
+ * @note    should be called once after open_env, before any thread submits
+ */
+int start_group_commit(size_t maxops, unsigned int maxwaitus) {
+    struct GroupCommit *gc;
+
+    if(gCommit != NULL)
+        return TRASH_DB_SUCCESS;
+
+    gc = (struct GroupCommit *)malloc(sizeof(struct GroupCommit));
+    assert(gc != NULL);
+
+    init_list(&gc->queue);
+    gc->queuedops = 0;
+    gc->maxops = (maxops == 0) ? TRASH_GC_MAX_OPS : maxops;
+    gc->maxwaitus = maxwaitus;
+    gc->running = 1;
+
+    pthread_mutex_init(&gc->gcMutex, NULL);
+    pthread_cond_init(&gc->gcCond, NULL);
+    pthread_cond_init(&gc->doneCond, NULL);
+
+    if(pthread_create(&gc->committer, NULL, internal_committer, gc) != 0) {
+        pthread_mutex_destroy(&gc->gcMutex);
+        pthread_cond_destroy(&gc->gcCond);
+        pthread_cond_destroy(&gc->doneCond);
+        free(gc);
+        return TRASH_DB_ERROR;
+    }
+
+    gCommit = gc;
+    return TRASH_DB_SUCCESS;
+}
+
+/**
+ * Stops the committer thread once everything already queued has been committed.
+ * 
+ * @note    no thread should be submitting while the pipeline is stopped
+ */
+void stop_group_commit() {
+    struct GroupCommit *gc = gCommit;
+
+    if(gc == NULL)
+        return;
+
+    pthread_mutex_lock(&gc->gcMutex);
+    gc->running = 0;
+    pthread_cond_signal(&gc->gcCond);
+    pthread_mutex_unlock(&gc->gcMutex);
+
+    pthread_join(gc->committer, NULL);
+    gCommit = NULL;
+
+    pthread_mutex_destroy(&gc->gcMutex);
+    pthread_cond_destroy(&gc->gcCond);
+    pthread_cond_destroy(&gc->doneCond);
+    free(gc);
+}
+
+/**
+ * Applies the ops atomically and blocks until they are committed.
+ * When the group commit pipeline is running the ops share a write txn with batches from other threads,
+ * otherwise they are committed in a write txn of their own.
+ * 
+ * @return  0 when committed, otherwise the lmdb error of the first failing op. a failing batch never affects other batches
+ */
+int trash_submit(struct TrashOp *ops, size_t numops) {
+    struct CommitReq req;
+
+    if(ops == NULL || numops == 0)
+        return TRASH_DB_ERROR;
+
+    init_il(&req.movequeue);
+    req.ops = ops;
+    req.numops = numops;
+    req.rc = 0;
+    req.done = 0;
+
+    return internal_submit_reqs(&req, 1);
+}
+
+/**
+ * Starts numworkers threads (TRASH_ASYNC_WORKERS when 0) that serve trash_async requests.
+ * Every worker sets up a reader pool of numrdrs readers, at least 1.
+ * Writes of the workers go through the group commit pipeline when it is running.
+ */
+int start_async(unsigned int numworkers, size_t numrdrs) {
+    struct AsyncPool *ap;
+
+    if(gAsync != NULL)
+        return TRASH_DB_SUCCESS;
+
+    ap = (struct AsyncPool *)calloc(1, sizeof(struct AsyncPool));
+    assert(ap != NULL);
+
+    ap->numworkers = (numworkers == 0) ? TRASH_ASYNC_WORKERS : numworkers;
+    ap->numrdrs = (numrdrs == 0) ? 1 : numrdrs;
+    ap->running = 1;
+    ap->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(ap->efd < 0) {
+        free(ap);
+        return TRASH_DB_ERROR;
+    }
+
+    pthread_mutex_init(&ap->asyncMutex, NULL);
+    pthread_cond_init(&ap->asyncCond, NULL);
+    pthread_mutex_init(&ap->doneMutex, NULL);
+
+    ap->workers = (pthread_t *)malloc(ap->numworkers * sizeof(pthread_t));
+    assert(ap->workers != NULL);
+
+    gAsync = ap;
+    for (unsigned int i = 0; i < ap->numworkers; i++) {
+        if(pthread_create(&ap->workers[i], NULL, internal_async_worker, ap) != 0) {
+            ap->numworkers = i;
+            stop_async();
+            return TRASH_DB_ERROR;
+        }
+    }
+
+    return TRASH_DB_SUCCESS;
+}
+
+/**
+ * Stops the workers once every queued request has completed.
+ * 
+ * @return  the completed requests that were never reaped, in the order they completed and chained through next
+ * @note    no thread should be calling trash_async while the workers are stopped
+ */
+struct TrashReq *stop_async() {
+    struct AsyncPool *ap = gAsync;
+    struct TrashReq *left;
+
+    if(ap == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&ap->asyncMutex);
+    ap->running = 0;
+    pthread_cond_broadcast(&ap->asyncCond);
+    pthread_mutex_unlock(&ap->asyncMutex);
+
+    for (unsigned int i = 0; i < ap->numworkers; i++)
+        pthread_join(ap->workers[i], NULL);
+
+    gAsync = NULL;
+    left = ap->donehead;
+
+    close(ap->efd);
+    pthread_mutex_destroy(&ap->asyncMutex);
+    pthread_cond_destroy(&ap->asyncCond);
+    pthread_mutex_destroy(&ap->doneMutex);
+    free(ap->workers);
+    free(ap);
+
+    return left;
+}
+
+/**
+ * Queues the request for the workers, it never blocks on lmdb
+ */
+int trash_async(struct TrashReq *req) {
+    struct AsyncPool *ap = gAsync;
+
+    if(req == NULL || req->op.db == NULL)
+        return TRASH_DB_ERROR;
+
+    if(ap == NULL)
+        return TRASH_TXN_INVALID;
+
+    req->rc = 0;
+    req->val.mv_size = 0;
+    req->val.mv_data = NULL;
+    req->keys = NULL;
+    req->vals = NULL;
+    req->count = 0;
+    req->res = NULL;
+    req->next = NULL;
+
+    pthread_mutex_lock(&ap->asyncMutex);
+    if(ap->tail == NULL) {
+        ap->head = req;
+    } else {
+        ap->tail->next = req;
+    }
+    ap->tail = req;
+    pthread_cond_signal(&ap->asyncCond);
+    pthread_mutex_unlock(&ap->asyncMutex);
+
+    return TRASH_DB_SUCCESS;
+}
+
+/**
+ * @return  eventfd that is readable while requests wait to be reaped, -1 when the workers are not running
+ */
+int trash_async_fd() {
+    return (gAsync == NULL) ? -1 : gAsync->efd;
+}
+
+/**
+ * Takes up to max completed requests that have no callback, in the order they completed.
+ * The eventfd is cleared once every completed request was reaped.
+ */
+size_t trash_async_reap(struct TrashReq **reqs, size_t max) {
+    struct AsyncPool *ap = gAsync;
+    uint64_t cnt;
+    size_t n = 0;
+
+    if(ap == NULL)
+        return 0;
+
+    pthread_mutex_lock(&ap->doneMutex);
+    while(n < max && ap->donehead != NULL) {
+        reqs[n++] = ap->donehead;
+        ap->donehead = ap->donehead->next;
+    }
+    if(n > 0 && ap->donehead == NULL) {
+        ap->donetail = NULL;
+        // the counter is only read here, under the lock the workers signal with, so it can not miss a completion
+        assert(read(ap->efd, &cnt, sizeof(cnt)) == sizeof(cnt));
+    }
+    pthread_mutex_unlock(&ap->doneMutex);
+
+    return n;
+}
+
+void trash_async_free(struct TrashReq *req) {
+    if(req == NULL)
+        return;
+
+    free(req->res);
+    req->res = NULL;
+    req->val.mv_data = NULL;
+    req->keys = NULL;
+    req->vals = NULL;
+}
+
+/**
+ * Starts copying the env in the background, the backup is owned by the copy until trash_backup_wait returns
+ */
+int trash_backup_start(struct TrashBackup *bk) {
+    struct BackupJob *job;
+    MDB_envinfo info;
+    MDB_stat st;
+
+    if(bk == NULL || (bk->fd < 0 && bk->path == NULL))
+        return TRASH_DB_ERROR;
+
+    job = (struct BackupJob *)calloc(1, sizeof(struct BackupJob));
+    assert(job != NULL);
+    job->bk = bk;
+
+    job->outfd = bk->fd;
+    if(job->outfd < 0) {
+        job->outfd = open(bk->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(job->outfd < 0) {
+            free(job);
+            return TRASH_DB_ERROR;
+        }
+    }
+
+    if(pipe(job->pipefd) != 0) {
+        if(bk->fd < 0)
+            close(job->outfd);
+        free(job);
+        return TRASH_DB_ERROR;
+    }
+
+    // every page up to the last one used, a compact copy is smaller
+    mdb_env_info(oEnv->env, &info);
+    mdb_env_stat(oEnv->env, &st);
+    bk->total = (info.me_last_pgno + 1) * st.ms_psize;
+    bk->copied = 0;
+    bk->etams = 0;
+    bk->rc = 0;
+    bk->done = 0;
+    bk->job = job;
+
+    if(pthread_create(&job->relay, NULL, internal_backup_relay, job) != 0) {
+        close(job->pipefd[0]);
+        close(job->pipefd[1]);
+        if(bk->fd < 0)
+            close(job->outfd);
+        bk->job = NULL;
+        free(job);
+        return TRASH_DB_ERROR;
+    }
+
+    return TRASH_DB_SUCCESS;
+}
+
+/**
+ * Waits for the backup to be done
+ * 
+ * @return  0 when the whole copy was written, the lmdb error of the copy or TRASH_DB_ERROR when writing it failed
+ */
+int trash_backup_wait(struct TrashBackup *bk) {
+    struct BackupJob *job;
+
+    if(bk == NULL || bk->job == NULL)
+        return TRASH_DB_ERROR;
+
+    job = (struct BackupJob *)bk->job;
+    pthread_join(job->relay, NULL);
+    bk->job = NULL;
+    free(job);
+
+    return bk->rc;
+}
+
+void trash_backup_progress(struct TrashBackup *bk, size_t *copied, size_t *total, unsigned long *etams) {
+    if(copied != NULL)
+        *copied = __atomic_load_n(&bk->copied, __ATOMIC_RELAXED);
+    if(total != NULL)
+        *total = __atomic_load_n(&bk->total, __ATOMIC_RELAXED);
+    if(etams != NULL)
+        *etams = __atomic_load_n(&bk->etams, __ATOMIC_RELAXED);
+}
+
+/**
+ * Opens or creates the shards of a sharded db
+ * 
+ * @return  TRASH_DB_ERROR for a bad layout or one that does not match the shards on disk
+ */
+int trash_shards_open(TrashShards **ss, struct TrashShardMeta *meta) {
+    struct ShardSet *set;
+    size_t splitlen = 0;
+    char *p;
+    unsigned int i;
+
+    if(ss == NULL || meta == NULL || meta->name == NULL)
+        return TRASH_DB_ERROR;
+    if(meta->name[0] == '\0' || strchr(meta->name, '/') != NULL || strlen(meta->name) >= TRASH_DB_NAME_LEN)
+        return TRASH_DB_ERROR;
+    if(meta->numshards == 0 || meta->numshards > TRASH_SHARD_MAX)
+        return TRASH_DB_ERROR;
+    if(meta->mode != TRASH_SHARD_HASH && meta->mode != TRASH_SHARD_RANGE)
+        return TRASH_DB_ERROR;
+
+    if(meta->mode == TRASH_SHARD_RANGE && meta->numshards > 1) {
+        if(meta->splits == NULL)
+            return TRASH_DB_ERROR;
+        for (i = 0; i + 1 < meta->numshards; i++) {
+            if(i > 0 && internal_shard_cmp(&meta->splits[i - 1], &meta->splits[i]) >= 0)
+                return TRASH_DB_ERROR;
+            splitlen += meta->splits[i].mv_size;
+        }
+    }
+
+    set = (struct ShardSet *)calloc(1, sizeof(struct ShardSet));
+    assert(set != NULL);
+    set->mode = meta->mode;
+    set->numshards = meta->numshards;
+    set->shards = (struct Shard *)calloc(meta->numshards, sizeof(struct Shard));
+    assert(set->shards != NULL);
+
+    if(meta->mode == TRASH_SHARD_RANGE && meta->numshards > 1) {
+        set->splits = (MDB_val *)malloc((meta->numshards - 1) * sizeof(MDB_val));
+        set->splitbuf = (char *)malloc(splitlen + 1);
+        assert(set->splits != NULL && set->splitbuf != NULL);
+
+        p = set->splitbuf;
+        for (i = 0; i + 1 < meta->numshards; i++) {
+            memcpy(p, meta->splits[i].mv_data, meta->splits[i].mv_size);
+            set->splits[i].mv_data = p;
+            set->splits[i].mv_size = meta->splits[i].mv_size;
+            p += meta->splits[i].mv_size;
+            set->splithash = (set->splithash ^ internal_hash64(set->splits[i].mv_data, set->splits[i].mv_size)) * 1099511628211ull;
+        }
+    }
+
+    for (i = 0; i < set->numshards; i++) {
+        if(internal_shard_open(set, i, meta) != TRASH_DB_SUCCESS) {
+            trash_shards_close(set);
+            return TRASH_DB_ERROR;
+        }
+    }
+
+    *ss = set;
+    return TRASH_DB_SUCCESS;
+}
+
+/**
+ * @note    every txn of the shards has to be returned first
+ */
+void trash_shards_close(TrashShards *ss) {
+    if(ss == NULL)
+        return;
+
+    for (unsigned int i = 0; i < ss->numshards; i++) {
+        if(ss->shards[i].env == NULL)
+            continue;
+
+        mdb_env_sync(ss->shards[i].env, 1);
+        mdb_env_close(ss->shards[i].env);
+    }
+
+    free(ss->shards);
+    free(ss->splits);
+    free(ss->splitbuf);
+    free(ss);
+}
+
+unsigned int trash_shard_of(TrashShards *ss, MDB_val *key) {
+    unsigned int lo = 0, hi;
+
+    if(ss->mode == TRASH_SHARD_HASH)
+        return (unsigned int)(internal_hash64(key->mv_data, key->mv_size) % ss->numshards);
+
+    // first split above the key
+    hi = ss->numshards - 1;
+    while(lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+
+        if(internal_shard_cmp(key, &ss->splits[mid]) < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    return lo;
+}
+
+/**
+ * Starts a txn on the shards, the lmdb txn of a shard is only begun when a key routes to it.
+ * The shards read by a txn are not one snapshot, each is as of the first time the txn used it.
+ * A TRASH_WR_TXN writes to the shard of its first write only, a write routed to another shard fails with TRASH_DB_ERROR.
+ */
+int trash_shard_txn(TrashShardTxn **st, TrashShards *ss, int rd) {
+    struct ShardTxn *t;
+
+    if(st == NULL || ss == NULL)
+        return TRASH_TXN_INVALID;
+    if(rd != TRASH_RD_TXN && rd != TRASH_WR_TXN)
+        return TRASH_TXN_INVALID;
+
+    t = (struct ShardTxn *)malloc(sizeof(struct ShardTxn));
+    assert(t != NULL);
+    t->txns = (MDB_txn **)calloc(ss->numshards, sizeof(MDB_txn *));
+    assert(t->txns != NULL);
+
+    t->ss = ss;
+    t->rd = rd;
+    t->wrshard = -1;
+
+    *st = t;
+    return TRASH_DB_SUCCESS;
+}
+
+/**
+ * Commits the write of the txn and ends its readers
+ * 
+ * @return  the lmdb error of the commit
+ */
+int return_shard_txn(TrashShardTxn *st) {
+    int rc = 0;
+
+    if(st == NULL)
+        return TRASH_TXN_INVALID;
+
+    if(st->wrshard >= 0) {
+        rc = mdb_txn_commit(st->txns[st->wrshard]);
+        st->txns[st->wrshard] = NULL;
+    }
+    trash_shard_abort(st);
+
+    return rc;
+}
+
+void trash_shard_abort(TrashShardTxn *st) {
+    if(st == NULL)
+        return;
+
+    for (unsigned int i = 0; i < st->ss->numshards; i++) {
+        if(st->txns[i] != NULL)
+            mdb_txn_abort(st->txns[i]);
+    }
+
+    free(st->txns);
+    free(st);
+}
+
+int trash_shard_put(TrashShardTxn *st, MDB_val *key, MDB_val *val, unsigned int flags) {
+    MDB_txn *txn;
+    MDB_dbi dbi;
+    int rc;
+
+    if(st == NULL)
+        return TRASH_TXN_INVALID;
+
+    rc = internal_shard_wrtxn(st, key, &txn, &dbi);
+    if(rc != 0)
+        return rc;
+
+    return mdb_put(txn, dbi, key, val, flags);
+}
+
+int trash_shard_get(TrashShardTxn *st, MDB_val *key, MDB_val *val) {
+    unsigned int i;
+    MDB_txn *txn;
+    int rc;
+
+    if(st == NULL)
+        return TRASH_TXN_INVALID;
+
+    i = trash_shard_of(st->ss, key);
+    rc = internal_shard_txn(st, i, &txn);
+    if(rc != 0)
+        return rc;
+
+    return mdb_get(txn, st->ss->shards[i].dbi, key, val);
+}
+
+/**
+ * A NULL val deletes the key
+ */
+int trash_shard_del(TrashShardTxn *st, MDB_val *key, MDB_val *val) {
+    MDB_txn *txn;
+    MDB_dbi dbi;
+    int rc;
+
+    if(st == NULL)
+        return TRASH_TXN_INVALID;
+
+    rc = internal_shard_wrtxn(st, key, &txn, &dbi);
+    if(rc != 0)
+        return rc;
+
+    return mdb_del(txn, dbi, key, val);
+}
+
+/**
+ * Writes the puts and deletes of ops (their db is not used) with one write txn per shard they route to.
+ * The shards are committed one after the other in shard order, the ops of a shard are all or nothing
+ * but a failure leaves the shards committed before it.
+ * 
+ * @return  0 or the first lmdb error, a delete of a missing key is not an error
+ */
+int trash_shard_write(TrashShards *ss, struct TrashOp *ops, size_t numops) {
+    unsigned int *routes;
+    MDB_txn *txn;
+    int rc = 0;
+
+    if(ss == NULL || (ops == NULL && numops > 0))
+        return TRASH_DB_ERROR;
+
+    routes = (unsigned int *)malloc((numops + 1) * sizeof(unsigned int));
+    assert(routes != NULL);
+    for (size_t i = 0; i < numops; i++)
+        routes[i] = trash_shard_of(ss, &ops[i].key);
+
+    for (unsigned int s = 0; s < ss->numshards && rc == 0; s++) {
+        txn = NULL;
+        for (size_t i = 0; i < numops && rc == 0; i++) {
+            if(routes[i] != s)
+                continue;
+
+            if(txn == NULL) {
+                rc = mdb_txn_begin(ss->shards[s].env, NULL, 0, &txn);
+                if(rc != 0) {
+                    txn = NULL;
+                    break;
+                }
+            }
+
+            if(ops[i].op == TRASH_OP_PUT) {
+                rc = mdb_put(txn, ss->shards[s].dbi, &ops[i].key, &ops[i].val, ops[i].flags);
+            } else if(ops[i].op == TRASH_OP_DEL) {
+                rc = mdb_del(txn, ss->shards[s].dbi, &ops[i].key, (ops[i].val.mv_data == NULL) ? NULL : &ops[i].val);
+                if(rc == MDB_NOTFOUND)
+                    rc = 0;
+            } else {
+                rc = TRASH_DB_ERROR;
+            }
+        }
+
+        if(txn == NULL)
+            continue;
+
+        if(rc == 0)
+            rc = mdb_txn_commit(txn);
+        else
+            mdb_txn_abort(txn);
+    }
+
+    free(routes);
+    return rc;
+}
+
+/**
+ * Scans the keys from lo up to hi over every shard in key order, a NULL lo or hi leaves that end open.
+ * hi is excluded unless TRASH_ITER_HI_INCL is set. A TRASH_SHARD_RANGE scan only opens the shards that overlap it.
+ * 
+ * @note    the keys and values returned are valid until the txn ends or writes
+ */
+int trash_shard_iter(TrashShardIter **it, TrashShardTxn *st, MDB_val *lo, MDB_val *hi, unsigned int flags) {
+    struct ShardIter *si;
+    struct ShardSet *ss;
+    unsigned int first = 0, last;
+    MDB_txn *txn;
+    int rc;
+
+    if(it == NULL)
+        return TRASH_CUR_INVALID;
+    if(st == NULL)
+        return TRASH_TXN_INVALID;
+
+    ss = st->ss;
+    last = ss->numshards - 1;
+    if(ss->mode == TRASH_SHARD_RANGE) {
+        if(lo != NULL)
+            first = trash_shard_of(ss, lo);
+        if(hi != NULL)
+            last = trash_shard_of(ss, hi);
+    }
+
+    si = (struct ShardIter *)calloc(1, sizeof(struct ShardIter));
+    assert(si != NULL);
+    si->curs = (MDB_cursor **)calloc(ss->numshards, sizeof(MDB_cursor *));
+    si->keys = (MDB_val *)calloc(ss->numshards, sizeof(MDB_val));
+    si->vals = (MDB_val *)calloc(ss->numshards, sizeof(MDB_val));
+    si->heap = (unsigned int *)calloc(ss->numshards, sizeof(unsigned int));
+    assert(si->curs != NULL && si->keys != NULL && si->vals != NULL && si->heap != NULL);
+
+    si->st = st;
+    si->flags = flags;
+    if(hi != NULL)
+        si->hi = *hi;
+
+    for (unsigned int i = first; i <= last; i++) {
+        rc = internal_shard_txn(st, i, &txn);
+        if(rc == 0)
+            rc = mdb_cursor_open(txn, ss->shards[i].dbi, &si->curs[i]);
+        if(rc != 0) {
+            return_shard_iter(si);
+            return rc;
+        }
+
+        if(lo != NULL) {
+            si->keys[i] = *lo;
+            rc = mdb_cursor_get(si->curs[i], &si->keys[i], &si->vals[i], MDB_SET_RANGE);
+        } else {
+            rc = mdb_cursor_get(si->curs[i], &si->keys[i], &si->vals[i], MDB_FIRST);
+        }
+
+        if(rc == 0 && internal_shard_in_range(si, &si->keys[i]))
+            si->heap[si->heaplen++] = i;
+    }
+
+    for (unsigned int i = si->heaplen / 2; i-- > 0;)
+        internal_shard_sift(si, i);
+
+    *it = si;
+    return TRASH_DB_SUCCESS;
+}
+
+/**
+ * @return  MDB_NOTFOUND once every shard is done
+ */
+int trash_shard_iter_next(TrashShardIter *it, MDB_val *key, MDB_val *val) {
+    unsigned int i;
+    int rc;
+
+    if(it == NULL)
+        return TRASH_CUR_INVALID;
+
+    if(it->heaplen == 0)
+        return MDB_NOTFOUND;
+
+    i = it->heap[0];
+    *key = it->keys[i];
+    *val = it->vals[i];
+
+    rc = mdb_cursor_get(it->curs[i], &it->keys[i], &it->vals[i], MDB_NEXT);
+    if(rc != 0 || !internal_shard_in_range(it, &it->keys[i]))
+        it->heap[0] = it->heap[--it->heaplen];
+    internal_shard_sift(it, 0);
+
+    return 0;
+}
+
+void return_shard_iter(TrashShardIter *it) {
+    if(it == NULL)
+        return;
+
+    for (unsigned int i = 0; i < it->st->ss->numshards; i++) {
+        if(it->curs[i] != NULL)
+            mdb_cursor_close(it->curs[i]);
+    }
+
+    free(it->curs);
+    free(it->keys);
+    free(it->vals);
+    free(it->heap);
+    free(it);
+}
+
+/**
+ * Puts write txns in front of the lmdb writer lock in priority order. A waiting writer goes before every
+ * writer of a lower class that waits, the writer holding the lock is never preempted.
+ * trash_txn and trash_txn_db fail with TRASH_WRITE_BUSY once maxqueue writers (TRASH_SCHED_QUEUE when 0) wait.
+ * 
+ * A TRASH_PRIO_BULK txn is committed and begun again inside trash_put and trash_reap every chunkops writes (TRASH_SCHED_CHUNK_OPS when 0),
+ * or as soon as a writer waits once it held the lock for maxholdms (TRASH_SCHED_HOLD_MS when 0), so it only ever holds
+ * the lock for a bounded time. Each chunk commits on its own, a bulk txn is not atomic.
+ * Bulk txns with savepoints or write cursors are not chunked.
+ * 
+ * @note    no write txn can be open or waiting when the scheduler is started or stopped
+ */
+int start_write_sched(unsigned int maxqueue, unsigned int maxholdms, size_t chunkops) {
+    struct WriteSched *ws;
+
+    if(gSched != NULL)
+        return TRASH_DB_SUCCESS;
+
+    ws = (struct WriteSched *)calloc(1, sizeof(struct WriteSched));
+    assert(ws != NULL);
+
+    ws->maxqueue = (maxqueue == 0) ? TRASH_SCHED_QUEUE : maxqueue;
+    ws->maxholdns = (unsigned long)((maxholdms == 0) ? TRASH_SCHED_HOLD_MS : maxholdms) * 1000000ul;
+    ws->chunkops = (chunkops == 0) ? TRASH_SCHED_CHUNK_OPS : chunkops;
+    pthread_mutex_init(&ws->mutex, NULL);
+    pthread_cond_init(&ws->cond, NULL);
+
+    gSched = ws;
+    return TRASH_DB_SUCCESS;
+}
+
+void stop_write_sched() {
+    struct WriteSched *ws = gSched;
+
+    if(ws == NULL)
+        return;
+
+    gSched = NULL;
+    pthread_mutex_destroy(&ws->mutex);
+    pthread_cond_destroy(&ws->cond);
+    free(ws);
+}
+
+/**
+ * Sets the class of the write txns begun by this thread from now on, TRASH_PRIO_NORMAL until set
+ */
+void trash_write_priority(unsigned int prio) {
+    wrPrio = (prio < TRASH_PRIO_NUM) ? prio : TRASH_PRIO_BULK;
+}
+
+/**
+ * Reaps every open TRASH_DB_TTL db every intervalms (TRASH_REAP_MS when 0) on a thread of its own
+ */
+int start_reaper(unsigned int intervalms) {
+    struct Reaper *rp;
+
+    if(gReaper != NULL)
+        return TRASH_DB_SUCCESS;
+
+    rp = (struct Reaper *)malloc(sizeof(struct Reaper));
+    assert(rp != NULL);
+
+    rp->intervalms = (intervalms == 0) ? TRASH_REAP_MS : intervalms;
+    rp->running = 1;
+    pthread_mutex_init(&rp->mutex, NULL);
+    pthread_cond_init(&rp->cond, NULL);
+
+    if(pthread_create(&rp->thread, NULL, internal_reaper, rp) != 0) {
+        pthread_mutex_destroy(&rp->mutex);
+        pthread_cond_destroy(&rp->cond);
+        free(rp);
+        return TRASH_DB_ERROR;
+    }
+
+    gReaper = rp;
+    return TRASH_DB_SUCCESS;
+}
+
+void stop_reaper() {
+    struct Reaper *rp = gReaper;
+
+    if(rp == NULL)
+        return;
+
+    pthread_mutex_lock(&rp->mutex);
+    rp->running = 0;
+    pthread_cond_signal(&rp->cond);
+    pthread_mutex_unlock(&rp->mutex);
+
+    pthread_join(rp->thread, NULL);
+    gReaper = NULL;
+
+    pthread_mutex_destroy(&rp->mutex);
+    pthread_cond_destroy(&rp->cond);
+    free(rp);
+}
+
+/**
+ * Runs trash_check_readers every intervalms (TRASH_WATCH_MS when 0) on a thread of its own and hands each result to report.
+ * expirems is passed on as is, readers never expire when it is 0.
+ */
+int start_watchdog(unsigned int intervalms, unsigned long expirems, void (*report)(const struct TrashReaders *rdrs)) {
+    struct Watchdog *wd;
+
+    if(gWatchdog != NULL)
+        return TRASH_DB_SUCCESS;
+
+    wd = (struct Watchdog *)malloc(sizeof(struct Watchdog));
+    assert(wd != NULL);
+
+    wd->intervalms = (intervalms == 0) ? TRASH_WATCH_MS : intervalms;
+    wd->expirems = expirems;
+    wd->report = report;
+    wd->running = 1;
+    pthread_mutex_init(&wd->mutex, NULL);
+    pthread_cond_init(&wd->cond, NULL);
+
+    if(pthread_create(&wd->thread, NULL, internal_watchdog, wd) != 0) {
+        pthread_mutex_destroy(&wd->mutex);
+        pthread_cond_destroy(&wd->cond);
+        free(wd);
+        return TRASH_DB_ERROR;
+    }
+
+    gWatchdog = wd;
+    return TRASH_DB_SUCCESS;
+}
+
+void stop_watchdog() {
+    struct Watchdog *wd = gWatchdog;
+
+    if(wd == NULL)
+        return;
+
+    pthread_mutex_lock(&wd->mutex);
+    wd->running = 0;
+    pthread_cond_signal(&wd->cond);
+    pthread_mutex_unlock(&wd->mutex);
+
+    pthread_join(wd->thread, NULL);
+    gWatchdog = NULL;
+
+    pthread_mutex_destroy(&wd->mutex);
+    pthread_cond_destroy(&wd->cond);
+    free(wd);
+}
+
+/**
+ * Clears the reader slots left by dead processes and finds the oldest snapshot held by a pooled reader.
+ * Readers active for longer than expirems are marked expired when expirems is not 0. The txn is never touched here,
+ * the owner resets it on its next call with it, which fails with TRASH_TXN_INVALID, or when it returns it.
+ * 
+ * @note    an expired reader pins its snapshot until the owner gets to it, readers of threads that exited
+ *          without returning them are only reported
+ */
+int trash_check_readers(struct TrashReaders *rdrs, unsigned long expirems) {
+    struct IL *curr, *link;
+    unsigned long now, age, oldest = 0;
+    size_t last, lag = 0;
+    int rc;
+
+    if(rdrs == NULL)
+        return TRASH_DB_ERROR;
+
+    memset(rdrs, 0, sizeof(struct TrashReaders));
+
+    rc = mdb_reader_check(oEnv->env, &rdrs->stale);
+    if(rc != 0)
+        return rc;
+
+    now = internal_now_ns();
+    last = __atomic_load_n(&oEnv->lastTxnid, __ATOMIC_ACQUIRE);
+
+    pthread_mutex_lock(&oEnv->poolMutex);
+    for_each(&oEnv->pools.head, curr) {
+        struct Readers *pool = CONTAINER_OF(curr, struct Readers, movepool);
+
+        pthread_mutex_lock(&pool->rdrMutex);
+        for_each(&pool->active.head, link) {
+            TrashTxn *tt = CONTAINER_OF(link, TrashTxn, rdrlink);
+            int state = RDR_LIVE;
+
+            age = now - tt->beganns;
+            if(expirems > 0 && age / 1000000 >= expirems) {
+                if(__atomic_compare_exchange_n(&tt->expired, &state, RDR_EXPIRED, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                    rdrs->expired++;
+            } else {
+                state = __atomic_load_n(&tt->expired, __ATOMIC_ACQUIRE);
+            }
+
+            // a reset reader holds no snapshot anymore
+            if(state == RDR_RESET)
+                continue;
+
+            rdrs->active++;
+            if(age > oldest) {
+                oldest = age;
+                // set before the reader was put on the list
+                lag = (last > tt->snapid) ? last - tt->snapid : 0;
+            }
+        }
+        pthread_mutex_unlock(&pool->rdrMutex);
+    }
+    pthread_mutex_unlock(&oEnv->poolMutex);
+
+    rdrs->oldestms = oldest / 1000000;
+    rdrs->oldestlag = lag;
+
+    return TRASH_DB_SUCCESS;
+}
+
+/**
+ * Deletes the keys of a TRASH_DB_TTL db that have expired, reaped is set to how many.
+ * Each write txn deletes at most TRASH_REAP_BATCH keys, so other writers get the writer lock in between.
+ * 
+ * @note    the thread can not be in a write txn
+ */
+int trash_reap(const char *dbname, size_t *reaped) {
+    TrashTxn *tt;
+    struct OpenDb *db;
+    uint64_t now;
+    size_t n, dels, total = 0;
+    int rc;
+
+    now = internal_wall_ms();
+    do {
+        rc = trash_txn(&tt, dbname, TRASH_WR_TXN);
+        if(rc != TRASH_DB_SUCCESS)
+            break;
+
+        db = tt->dbs[tt->curdb];
+        if(!(db->flags & TRASH_DB_TTL)) {
+            return_txn(tt);
+            rc = TRASH_DB_ERROR;
+            break;
+        }
+
+        rc = internal_ttl_reap(tt, db, now, TRASH_REAP_BATCH, &n, &dels);
+        return_txn(tt);
+        total += dels;
+    } while(rc == 0 && n == TRASH_REAP_BATCH);
+
+    if(reaped != NULL)
+        *reaped = total;
+
+    return rc;
+}
+
+/**
+ * Flushes the counters every flushms (TRASH_COUNTER_FLUSH_MS when 0) on a thread of its own
+ */
+int start_counters(unsigned int flushms) {
+    struct CounterFlusher *cf;
+
+    if(gFlusher != NULL)
+        return TRASH_DB_SUCCESS;
+
+    cf = (struct CounterFlusher *)malloc(sizeof(struct CounterFlusher));
+    assert(cf != NULL);
+
+    cf->flushms = (flushms == 0) ? TRASH_COUNTER_FLUSH_MS : flushms;
+    cf->running = 1;
+    pthread_mutex_init(&cf->mutex, NULL);
+    pthread_cond_init(&cf->cond, NULL);
+
+    if(pthread_create(&cf->thread, NULL, internal_counter_flusher, cf) != 0) {
+        pthread_mutex_destroy(&cf->mutex);
+        pthread_cond_destroy(&cf->cond);
+        free(cf);
+        return TRASH_DB_ERROR;
+    }
+
+    gFlusher = cf;
+    return TRASH_DB_SUCCESS;
+}
+
+/**
+ * Stops the periodic flushes after one last flush
+ */
+void stop_counters() {
+    struct CounterFlusher *cf = gFlusher;
+
+    if(cf == NULL)
+        return;
+
+    pthread_mutex_lock(&cf->mutex);
+    cf->running = 0;
+    pthread_cond_signal(&cf->cond);
+    pthread_mutex_unlock(&cf->mutex);
+
+    pthread_join(cf->thread, NULL);
+    gFlusher = NULL;
+
+    pthread_mutex_destroy(&cf->mutex);
+    pthread_cond_destroy(&cf->cond);
+    free(cf);
+}
+
+/**
+ * Adds delta to the counter at key without a txn, the delta is buffered by this thread until the next flush.
+ * Counters are native uint64_t values, a negative delta wraps around like unsigned arithmetic.
+ * 
+ * @note    the deltas of a db closed before they are flushed are dropped
+ */
+int trash_counter_add(TrashDb *db, MDB_val *key, int64_t delta) {
+    struct CounterBuf *cb;
+    unsigned int hash;
+
+    if(db == NULL)
+        return TRASH_DB_DNE;
+
+    if(!internal_key_ok(db, key))
+        return TRASH_DB_ERROR;
+
+    hash = internal_hash_key(key->mv_data, key->mv_size) ^ (unsigned int)db->dbid;
+    cb = internal_counters();
+
+    pthread_mutex_lock(&cb->mutex);
+    internal_counter_merge(&cb->tab, db, key, hash, delta);
+    pthread_mutex_unlock(&cb->mutex);
+
+    return TRASH_DB_SUCCESS;
+}
+
+/**
+ * Reads the counter at key in the current db of the txn.
+ * With TRASH_COUNTER_PENDING the deltas of every thread not yet flushed are added,
+ * as are the ones of the last flush when the snapshot of the txn is older than it.
+ * Only the last flush is kept, a snapshot older than the one before it misses that one's deltas.
+ * 
+ * @return  MDB_NOTFOUND when the key is neither stored nor pending, TRASH_DB_ERROR when the value is not a counter
+ */
+int trash_counter_get(TrashTxn *tt, MDB_val *key, uint64_t *value, unsigned int flags) {
+    struct CounterEntry *e;
+    struct OpenDb *db;
+    struct IL *curr;
+    MDB_val val;
+    unsigned int hash;
+    uint64_t num = 0;
+    int rc;
+
+    if(tt == NULL || tt->dbscount == 0)
+        return TRASH_TXN_INVALID;
+
+    db = tt->dbs[tt->curdb];
+    rc = trash_get(tt, key, &val);
+    if(rc == 0) {
+        if(val.mv_size != sizeof(uint64_t))
+            return TRASH_DB_ERROR;
+        memcpy(&num, val.mv_data, sizeof(num));
+    } else if(rc != MDB_NOTFOUND) {
+        return rc;
+    }
+
+    if(flags & TRASH_COUNTER_PENDING) {
+        hash = internal_hash_key(key->mv_data, key->mv_size) ^ (unsigned int)db->dbid;
+
+        pthread_mutex_lock(&counterMutex);
+        if(inflightTxn == 0 || mdb_txn_id(tt->txn) < inflightTxn) {
+            e = internal_counter_find(&inflight, db->dbid, key, hash);
+            if(e != NULL) {
+                num += (uint64_t)e->delta;
+                rc = 0;
+            }
+        }
+
+        if(counterBlocks.head.next != NULL) {
+            for_each(&counterBlocks.head, curr) {
+                struct CounterBuf *cb;
+                cb = CONTAINER_OF(curr, struct CounterBuf, movecounters);
+
+                pthread_mutex_lock(&cb->mutex);
+                e = internal_counter_find(&cb->tab, db->dbid, key, hash);
+                if(e != NULL) {
+                    num += (uint64_t)e->delta;
+                    rc = 0;
+                }
+                pthread_mutex_unlock(&cb->mutex);
+            }
+        }
+        pthread_mutex_unlock(&counterMutex);
+    }
+
+    if(rc == 0)
+        *value = num;
+
+    return rc;
+}
+
+/**
+ * Folds the deltas of every thread into the db in one write txn.
+ * The deltas stay visible to pending reads until the txn is committed, and stay pending if it is not.
+ * 
+ * @return  TRASH_DB_ERROR when a stored value is not a counter, its delta is dropped.
+ *          the lmdb error when the txn could not be committed
+ * @note    the thread can not be in a write txn
+ */
+int trash_counter_flush() {
+    struct CounterEntry *e;
+    struct IL *curr;
+    TrashTxn *tt;
+    MDB_val key, val;
+    uint64_t num;
+    size_t txnid;
+    int rc, crc, ret = TRASH_DB_SUCCESS;
+
+    pthread_mutex_lock(&flushMutex);
+
+    pthread_mutex_lock(&counterMutex);
+    // deltas of a flush that was not committed are taken again
+    if(inflightTxn != 0)
+        internal_counter_clear(&inflight);
+    inflightTxn = 0;
+
+    if(counterBlocks.head.next != NULL) {
+        for_each(&counterBlocks.head, curr) {
+            struct CounterBuf *cb;
+            struct CounterTable tab;
+            cb = CONTAINER_OF(curr, struct CounterBuf, movecounters);
+
+            pthread_mutex_lock(&cb->mutex);
+            tab = cb->tab;
+            memset(&cb->tab, 0, sizeof(cb->tab));
+            pthread_mutex_unlock(&cb->mutex);
+
+            internal_counter_drain(&inflight, &tab);
+        }
+    }
+    pthread_mutex_unlock(&counterMutex);
+
+    if(inflight.count == 0) {
+        pthread_mutex_unlock(&flushMutex);
+        return TRASH_DB_SUCCESS;
+    }
+
+    rc = internal_begin_txn(&tt, TRASH_WR_TXN);
+    if(rc != TRASH_DB_SUCCESS) {
+        pthread_mutex_unlock(&flushMutex);
+        return rc;
+    }
+
+    // only flushes change inflight, so it is read without the lock
+    for (size_t i = 0; i < inflight.cap && rc == 0; i++) {
+        for (e = inflight.buckets[i]; e != NULL; e = e->next) {
+            if(internal_counter_attach(tt, e) != TRASH_DB_SUCCESS)
+                continue;
+
+            key.mv_data = e->key;
+            key.mv_size = e->size;
+            num = 0;
+            rc = trash_get(tt, &key, &val);
+            if(rc == 0 && val.mv_size != sizeof(uint64_t)) {
+                ret = TRASH_DB_ERROR;
+                rc = 0;
+                continue;
+            }
+            if(rc == 0)
+                memcpy(&num, val.mv_data, sizeof(num));
+            else if(rc != MDB_NOTFOUND)
+                break;
+
+            num += (uint64_t)e->delta;
+            val.mv_data = &num;
+            val.mv_size = sizeof(num);
+            rc = trash_put(tt, &key, &val, 0);
+            if(rc != 0)
+                break;
+        }
+    }
+
+    if(rc != 0) {
+        tt->actions &= ~TRASH_TXN_COMMIT;
+        ret = rc;
+    }
+
+    // pending reads wait out the commit, a snapshot with the deltas folded in never sees them pending too
+    txnid = mdb_txn_id(tt->txn);
+    pthread_mutex_lock(&counterMutex);
+    crc = internal_return_txn(tt);
+    if(rc == 0 && crc == 0)
+        inflightTxn = txnid;
+    pthread_mutex_unlock(&counterMutex);
+
+    if(crc != 0)
+        ret = crc;
+
+    pthread_mutex_unlock(&flushMutex);
+
+    return ret;
+}
+
+/**
+ * @note    Should only be called on startup. no need for locks in this function only 1 thread should be running
+ */
+static void init_metadata() {
+    TrashTxn *tt;
+    MDB_txn *txn;
+    MDB_dbi dbi;
+    struct OpenDb *db;
+    struct DbMeta dbmeta;
+    int rc;
+
+    rc = mdb_txn_begin(oEnv->env, NULL, 0, &txn);
+    assert(rc == 0);
+
+    dbmeta.name = METADATA;
+    dbmeta.flags = METADATA_FLAGS;
+    dbmeta.slots = 1;
+
+    rc = mdb_dbi_open(txn, dbmeta.name, dbmeta.flags, &dbi);
+    assert(rc == 0);
+    mdb_txn_commit(txn);
+    oEnv->metadbi = dbi;
+
+    db = internal_add_db(&dbmeta, dbi);
+    trash_txn(&tt, METADATA, TRASH_RD_TXN);
+    internal_add_db_curs(db, tt);
+
+    return_txn(tt);
+}
+
+static void internal_close_db(struct OpenDb *db) {
+    pthread_mutex_lock(&db->odbMutex);
+    if(db->txncount == 0) {
+        internal_fin_db(db);
+    } else {
+        db->state = DB_CLOSE;
+        pthread_mutex_unlock(&db->odbMutex);
+    }
+}
+
+/**
+ * Registers every db in the metadata db in one read txn, which is committed so the dbis stay open.
+ * The cursor pools are then built, and the TRASH_DB_WARM dbs walked, by the warm threads and this one.
+ * 
+ * @note    Should only be called on startup by open_env
+ */
+static void internal_open_all_db() {
+    TrashTxn *tt;
+    TrashIter *it;
+    MDB_dbi dbi, ttldbi = 0;
+    MDB_val prefix, key, val;
+    struct OpenDb *db;
+    struct DbMeta dbmeta;
+    struct WarmStart ws;
+    pthread_t *threads;
+    size_t cap = 0, numthreads;
+    char *name;
+    int rc;
+
+    memset(&ws, 0, sizeof(ws));
+
+    rc = trash_txn(&tt, METADATA, TRASH_RD_TXN);
+    assert(rc == TRASH_DB_SUCCESS);
+
+    prefix.mv_size = DB_PREFIX_LEN;
+    prefix.mv_data = DB_PREFIX;
+
+    rc = trash_iter(&it, tt, &prefix, NULL, TRASH_ITER_PREFIX, 0);
+    assert(rc == TRASH_DB_SUCCESS);
+
+    while(trash_iter_next(it, &key, &val) == 0) {
+        // entries written before DbMeta grew are shorter, the new fields are left zero
+        if(val.mv_size > sizeof(struct DbMeta))
+            continue;
+        memset(&dbmeta, 0, sizeof(struct DbMeta));
+        memcpy(&dbmeta, val.mv_data, val.mv_size);
+
+        // the stored name pointer is from the process that wrote it, the key has the name
+        name = strndup((char *)key.mv_data + DB_PREFIX_LEN, key.mv_size - DB_PREFIX_LEN);
+        assert(name != NULL);
+        dbmeta.name = name;
+
+        rc = internal_dbi_open(tt->txn, &dbmeta, dbmeta.flags & ~(MDB_CREATE | TRASH_DB_OWN_FLAGS), &dbi, &ttldbi);
+        if(rc != 0) {
+            fprintf(stderr, "Error opening db %s: %s\n", name, mdb_strerror(rc));
+            free(name);
+            if(rc == MDB_DBS_FULL)
+                break;
+            continue;
+        }
+
+        db = internal_add_db(&dbmeta, dbi);
+        db->ownname = name;
+        db->ttldbi = ttldbi;
+
+        if(ws.numdbs == cap) {
+            cap = (cap == 0) ? 16 : cap * 2;
+            ws.dbs = (struct OpenDb **)realloc(ws.dbs, cap * sizeof(struct OpenDb *));
+            assert(ws.dbs != NULL);
+        }
+        ws.dbs[ws.numdbs++] = db;
+    }
+
+    return_iter(it);
+
+    // dbis opened in a read txn are only kept when it commits
+    tt->actions |= TRASH_TXN_COMMIT;
+    return_txn(tt);
+
+    if(ws.numdbs == 0)
+        return;
+
+    numthreads = (oEnv->meta.warmthreads > 0) ? oEnv->meta.warmthreads : TRASH_WARM_THREADS;
+    if(numthreads > ws.numdbs)
+        numthreads = ws.numdbs;
+
+    // this thread is one of the warm threads
+    threads = (pthread_t *)malloc(numthreads * sizeof(pthread_t));
+    assert(threads != NULL);
+    size_t started = 0;
+    for (size_t i = 1; i < numthreads; i++) {
+        if(pthread_create(&threads[started], NULL, internal_warm_thread, &ws) != 0)
+            break;
+        started++;
+    }
+
+    internal_warm_dbs(&ws);
+
+    for (size_t i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    // only a thread holding a reader takes dbs and it keeps going until none are left
+    assert(ws.next >= ws.numdbs);
+
+    free(threads);
+    free(ws.dbs);
+}
+
+/**
+ * Builds the cursor pools of the dbs left in ws in a read txn of this thread.
+ * Does nothing when no reader is available, the threads holding one take the rest of the dbs.
+ */
+static void internal_warm_dbs(struct WarmStart *ws) {
+    TrashTxn *tt;
+    struct OpenDb *db;
+    size_t i;
+
+    if(internal_begin_txn(&tt, TRASH_RD_TXN) != TRASH_DB_SUCCESS)
+        return;
+
+    while((i = __atomic_fetch_add(&ws->next, 1, __ATOMIC_RELAXED)) < ws->numdbs) {
+        db = ws->dbs[i];
+        internal_add_db_curs(db, tt);
+        internal_bloom_load(db, tt->txn);
+
+        if(db->flags & TRASH_DB_WARM)
+            internal_warm_pages(ws, db, tt->txn);
+    }
+
+    return_txn(tt);
+}
+
+static void *internal_warm_thread(void *arg) {
+    internal_warm_dbs((struct WarmStart *)arg);
+    internal_stats_release();
+    return NULL;
+}
+
+/**
+ * Walks the db in key order, which faults in its branch and leaf pages.
+ * Values on overflow pages are only advised to the kernel, they are read ahead without waiting on them.
+ */
+static void internal_warm_pages(struct WarmStart *ws, struct OpenDb *db, MDB_txn *txn) {
+    MDB_cursor *cur;
+    MDB_val key, val;
+    size_t limit;
+
+    limit = oEnv->meta.warmbytes;
+    if(mdb_cursor_open(txn, db->dbi, &cur) != 0)
+        return;
+
+    while(mdb_cursor_get(cur, &key, &val, MDB_NEXT) == 0) {
+        internal_prefetch(&val);
+
+        if(limit > 0 && __atomic_add_fetch(&ws->warmed, key.mv_size + val.mv_size, __ATOMIC_RELAXED) >= limit)
+            break;
+    }
+
+    mdb_cursor_close(cur);
+}
+
+/**
+ * Leaves the txn with only its outermost lmdb txn.
+ * Savepoints are merged up when the txn commits, otherwise the outermost txn aborts them with itself.
+ */
+static void internal_end_savepoints(TrashTxn *tt) {
+    if(tt->numsaves == 0)
+        return;
+
+    if(tt->actions & TRASH_TXN_COMMIT) {
+        while(tt->numsaves > 0) {
+            assert(mdb_txn_commit(tt->txn) == 0);
+            tt->txn = tt->saves[--tt->numsaves].parent;
+        }
+        return;
+    }
+
+    tt->txn = tt->saves[0].parent;
+    tt->numsaves = 0;
+}
+
+static void internal_savepoint_restore(TrashTxn *tt, struct Savepoint *sp) {
+    tt->txn = sp->parent;
+    internal_bloom_undo(tt, sp->numblooms);
+
+    // a log dropped since the savepoint stays dropped, the txn can still not be replayed
+    if(tt->log != NULL)
+        tt->log->len = sp->loglen;
+    tt->wbytes = sp->wbytes;
+    tt->curdb = sp->curdb;
+    tt->actions = sp->actions | (tt->actions & (TRASH_TXN_NOREPLAY | TRASH_TXN_FAILED));
+}
+
+/**
+ * rc is set to the lmdb error when the commit fails, lmdb has freed the txn by then
+ * 
+ * @return  true when the txn was put back into the reader pool of this thread
+ */
+static bool internal_txn_handler(TrashTxn *tt, int *rc) {
+    bool committed = false;
+    bool ended = false;
+    bool pooled = false;
+    size_t txnid;
+
+    // an expired reader has nothing left to commit
+    if((tt->actions & TRASH_RD_TXN) && internal_untrack_reader(tt))
+        tt->actions &= ~TRASH_TXN_COMMIT;
+
+    internal_end_savepoints(tt);
+
+    txnid = mdb_txn_id(tt->txn);
+    // cached values of the keys written are dropped before the commit and kept out until it is done
+    internal_cache_inval_begin(tt);
+
+    if(tt->actions & TRASH_TXN_COMMIT) {
+        unsigned long start;
+
+        STATS_CLOCK(start);
+        *rc = mdb_txn_commit(tt->txn);
+        tt->actions &= ~TRASH_TXN_COMMIT;
+        ended = true;
+        committed = (*rc == 0);
+        STATS_HIST(TRASH_HIST_COMMIT, start);
+
+        if(committed && (tt->actions & TRASH_WR_TXN))
+            internal_txn_committed(txnid, tt->wbytes);
+    }
+
+    // abort write txns if not committed
+    if((tt->actions & TRASH_WR_TXN) && !ended) {
+        // abort if the txn was not commited
+        mdb_txn_abort(tt->txn);
+    }
+
+    if(tt->actions & TRASH_WR_TXN)
+        internal_sched_release();
+
+    internal_cache_inval_end(tt, committed ? txnid : 0);
+    internal_bloom_txn_end(tt, committed);
+    
+    internal_txn_exit();
+
+    if(tt->actions & TRASH_RD_TXN) {
+        // a committed read txn is freed by lmdb and can not be pooled
+        if(ended) {
+            if(tt->actions & TRASH_TXN_POOLED)
+                internal_release_reader();
+            return false;
+        }
+
+        mdb_txn_reset(tt->txn);
+
+        if(rdrPool != NULL && (tt->actions & TRASH_TXN_POOLED)) {
+            pthread_mutex_lock(&rdrPool->rdrMutex);
+            if(rdrPool->numTxns < rdrPool->cap) {
+                rdrPool->txns[rdrPool->numTxns++] = tt;
+                pooled = true;
+            }
+            pthread_mutex_unlock(&rdrPool->rdrMutex);
+        }
+
+        if(!pooled) {
+            mdb_txn_abort(tt->txn);
+            if(tt->actions & TRASH_TXN_POOLED)
+                internal_release_reader();
+        }
+
+        // the reader kept here or the slot given back can be used by a waiting thread
+        if(__atomic_load_n(&oEnv->poolWaiters, __ATOMIC_SEQ_CST) > 0) {
+            pthread_mutex_lock(&oEnv->poolMutex);
+            pthread_cond_broadcast(&oEnv->poolCond);
+            pthread_mutex_unlock(&oEnv->poolMutex);
+        }
+    }
+
+    return pooled;
+}
+
+static void internal_fin_db_locked(struct OpenDb *db) {
+    internal_env_wrlock();
+    internal_fin_db(db);
+    pthread_rwlock_unlock(&oEnv->envLock);
+}
+
+static void internal_fin_db(struct OpenDb *db) {
+    internal_bloom_persist(db);
+    mdb_dbi_close(oEnv->env, db->dbi);
+    if(db->flags & TRASH_DB_TTL)
+        mdb_dbi_close(oEnv->env, db->ttldbi);
+    internal_registry_remove(db);
+    __atomic_add_fetch(&oEnv->closedDbs, 1, __ATOMIC_RELEASE);
+    item_remove(&db->moveenv);
+    /**
+     *  @todo   locking issue with oEnv->dbs decrement  
+    */ 
+    oEnv->dbs.len--;
+
+    pthread_mutex_destroy(&db->odbMutex);
+
+    for (size_t i = 0; i < db->curcount; i++) {
+        TrashCursor *tc = db->curs[i];
+        mdb_cursor_close(tc->cur);
+        free(tc);
+    }
+
+    free(db->curs);
+    internal_cache_free(db->cache);
+    internal_bloom_free(db->bloom);
+    free(db->ownname);
+    free(db);
+
+    if(oEnv->state == ENV_CLOSE && oEnv->dbs.len == 0)
+        close_env();
+}
+
+static void internal_db_txn_decrement(struct OpenDb *db, void (*fin_db)(struct OpenDb *)) {
+    pthread_mutex_lock(&db->odbMutex);
+    if(db->txncount > 0)
+        db->txncount--;
+
+    if(db->state == DB_CLOSE && db->txncount == 0) {
+        fin_db(db);
+    }
+    pthread_mutex_unlock(&db->odbMutex);
+}
+
+static struct OpenDb *internal_get_open_db_locked(const char *dbname) {
+    struct OpenDb *db;
+
+    internal_env_rdlock();
+    db = internal_get_open_db(dbname);
+    pthread_rwlock_unlock(&oEnv->envLock);
+
+    return db;
+}
+
+/**
+ * @note    the calling function needs to hold the envLock
+ */
+static struct OpenDb *internal_get_open_db(const char *dbname) {
+    struct OpenDb *db;
+    unsigned int hash;
+
+    hash = internal_hash_name(dbname);
+    db = oEnv->dbtable[hash & (oEnv->dbtablecap - 1)];
+    while(db != NULL) {
+        if(db->hash == hash && db_match(db, dbname) == TRASH_DB_SUCCESS)
+            break;
+        db = db->hnext;
+    }
+
+    return db;
+}
+
+static void internal_create_open_env(struct OpenEnv **oEnv, MDB_env *env, unsigned int numdbs, unsigned int numrdrs, struct EnvMeta *meta) {
+    MDB_stat st;
+    size_t cap;
+
+    *oEnv = (struct OpenEnv *)malloc(sizeof(struct OpenEnv));
+    assert((*oEnv) != NULL);
+
+    (*oEnv)->env = env;
+    init_list(&(*oEnv)->dbs);
+
+    // keep the load factor of the registry at or below 0.5
+    cap = 16;
+    while(cap < (size_t)numdbs * 2)
+        cap <<= 1;
+    (*oEnv)->dbtable = (struct OpenDb **)calloc(cap, sizeof(struct OpenDb *));
+    assert((*oEnv)->dbtable != NULL);
+    (*oEnv)->dbtablecap = cap;
+    (*oEnv)->nextDbid = 0;
+    (*oEnv)->closedDbs = 0;
+
+    pthread_rwlock_init(&(*oEnv)->envLock, NULL);
+
+    if(meta != NULL) {
+        (*oEnv)->meta = *meta;
+    } else {
+        memset(&(*oEnv)->meta, 0, sizeof(struct EnvMeta));
+    }
+    if((*oEnv)->meta.durability == TRASH_SYNC_PERIODIC && (*oEnv)->meta.syncms == 0)
+        (*oEnv)->meta.syncms = TRASH_SYNC_MS;
+
+    (*oEnv)->lastTxnid = 0;
+    (*oEnv)->durableTxnid = 0;
+    (*oEnv)->unsyncedBytes = 0;
+    mdb_env_stat(env, &st);
+    (*oEnv)->psize = st.ms_psize;
+    (*oEnv)->ospsize = (size_t)sysconf(_SC_PAGESIZE);
+
+    init_list(&(*oEnv)->pools);
+    pthread_mutex_init(&(*oEnv)->poolMutex, NULL);
+    pthread_cond_init(&(*oEnv)->poolCond, NULL);
+    (*oEnv)->poolWaiters = 0;
+    (*oEnv)->rdrsLive = 0;
+    (*oEnv)->rdrBudget = (numrdrs > RDR_RESERVE) ? numrdrs - RDR_RESERVE : numrdrs;
+
+    (*oEnv)->activeTxns = 0;
+    (*oEnv)->resizing = 0;
+    (*oEnv)->resizes = 0;
+    (*oEnv)->backups = 0;
+    (*oEnv)->flushing = 0;
+    pthread_mutex_init(&(*oEnv)->syncMutex, NULL);
+    pthread_cond_init(&(*oEnv)->syncCond, NULL);
+
+    (*oEnv)->envFlags = mdb_env_get_flags(env, &(*oEnv)->envFlags);
+    (*oEnv)->state = ENV_OPEN;
+}
+
+static unsigned int internal_env_flags(struct EnvMeta *meta) {
+    unsigned int durability;
+
+    durability = (meta == NULL) ? TRASH_SYNC_NONE : meta->durability;
+    switch (durability) {
+    case TRASH_SYNC_FULL:
+        return MDB_NOTLS;
+    case TRASH_SYNC_META:
+        return MDB_NOTLS | MDB_NOMETASYNC;
+    default:
+        return MDB_NOTLS | MDB_NOSYNC | MDB_NOMETASYNC;
+    }
+}
+
+/**
+ * The flusher runs for the modes that sync later, TRASH_SYNC_PERIODIC and TRASH_SYNC_META,
+ * when given a sync interval or byte threshold
+ */
+static void internal_start_flusher() {
+    struct EnvMeta *meta = &oEnv->meta;
+
+    if(meta->durability != TRASH_SYNC_PERIODIC && meta->durability != TRASH_SYNC_META)
+        return;
+    if(meta->syncms == 0 && meta->syncbytes == 0)
+        return;
+
+    oEnv->flushing = 1;
+    if(pthread_create(&oEnv->flusher, NULL, internal_flusher, NULL) != 0)
+        oEnv->flushing = 0;
+}
+
+static void internal_stop_flusher() {
+    pthread_mutex_lock(&oEnv->syncMutex);
+    if(!oEnv->flushing) {
+        pthread_mutex_unlock(&oEnv->syncMutex);
+        return;
+    }
+    oEnv->flushing = 0;
+    pthread_cond_signal(&oEnv->syncCond);
+    pthread_mutex_unlock(&oEnv->syncMutex);
+
+    pthread_join(oEnv->flusher, NULL);
+}
+
+static void *internal_flusher(void *arg) {
+    struct timespec deadline;
+    size_t txnid, bytes;
+    unsigned int syncms;
+    (void)arg;
+
+    syncms = oEnv->meta.syncms;
+
+    pthread_mutex_lock(&oEnv->syncMutex);
+    while(oEnv->flushing) {
+        if(syncms == 0) {
+            pthread_cond_wait(&oEnv->syncCond, &oEnv->syncMutex);
+        } else {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += syncms / 1000;
+            deadline.tv_nsec += (long)(syncms % 1000) * 1000000;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000;
+            deadline.tv_nsec %= 1000000000;
+            pthread_cond_timedwait(&oEnv->syncCond, &oEnv->syncMutex, &deadline);
+        }
+
+        if(!oEnv->flushing)
+            break;
+        pthread_mutex_unlock(&oEnv->syncMutex);
+
+        // only what was committed before the sync started is known to be durable
+        txnid = __atomic_load_n(&oEnv->lastTxnid, __ATOMIC_ACQUIRE);
+        bytes = __atomic_load_n(&oEnv->unsyncedBytes, __ATOMIC_RELAXED);
+        if(txnid != __atomic_load_n(&oEnv->durableTxnid, __ATOMIC_RELAXED)) {
+            if(mdb_env_sync(oEnv->env, 1) == 0) {
+                __atomic_sub_fetch(&oEnv->unsyncedBytes, bytes, __ATOMIC_RELAXED);
+                internal_store_max(&oEnv->durableTxnid, txnid);
+            }
+        }
+
+        pthread_mutex_lock(&oEnv->syncMutex);
+    }
+    pthread_mutex_unlock(&oEnv->syncMutex);
+
+    return NULL;
+}
+
+/**
+ * Raises *dst to val unless it already is past it, the ids are published after the writer lock
+ * is released so a later commit can get there first
+ * 
+ * @return  the value before
+ */
+static size_t internal_store_max(size_t *dst, size_t val) {
+    size_t cur;
+
+    cur = __atomic_load_n(dst, __ATOMIC_ACQUIRE);
+    while(cur < val && !__atomic_compare_exchange_n(dst, &cur, val, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        ;
+
+    return cur;
+}
+
+/**
+ * Tracks the committed txn ids and wakes the flusher once enough bytes are unsynced
+ */
+static void internal_txn_committed(size_t txnid, size_t wbytes) {
+    size_t prev, bytes, threshold;
+
+    prev = internal_store_max(&oEnv->lastTxnid, txnid);
+
+    switch (oEnv->meta.durability) {
+    case TRASH_SYNC_FULL:
+        internal_store_max(&oEnv->durableTxnid, txnid);
+        return;
+    case TRASH_SYNC_META:
+        // the meta page of this commit is not synced, so only the previous commit is safe
+        internal_store_max(&oEnv->durableTxnid, prev < txnid ? prev : txnid - 1);
+        break;
+    default:
+        break;
+    }
+
+    threshold = oEnv->meta.syncbytes;
+    bytes = __atomic_add_fetch(&oEnv->unsyncedBytes, wbytes, __ATOMIC_RELAXED);
+    if(threshold > 0 && bytes >= threshold && bytes - wbytes < threshold) {
+        pthread_mutex_lock(&oEnv->syncMutex);
+        pthread_cond_signal(&oEnv->syncCond);
+        pthread_mutex_unlock(&oEnv->syncMutex);
+    }
+}
+
+/**
+ * Marks a txn as begun. Waits on the envLock while the map is being resized.
+ */
+static void internal_txn_enter() {
+    for(;;) {
+        __atomic_add_fetch(&oEnv->activeTxns, 1, __ATOMIC_SEQ_CST);
+        if(!__atomic_load_n(&oEnv->resizing, __ATOMIC_SEQ_CST))
+            break;
+
+        __atomic_sub_fetch(&oEnv->activeTxns, 1, __ATOMIC_SEQ_CST);
+        // the resizing thread holds the envLock until the map is grown
+        pthread_rwlock_rdlock(&oEnv->envLock);
+        pthread_rwlock_unlock(&oEnv->envLock);
+    }
+    activeLocal++;
+}
+
+static void internal_txn_exit() {
+    activeLocal--;
+    __atomic_sub_fetch(&oEnv->activeTxns, 1, __ATOMIC_SEQ_CST);
+}
+
+static size_t internal_mapsize() {
+    MDB_envinfo info;
+
+    mdb_env_info(oEnv->env, &info);
+    return info.me_mapsize;
+}
+
+/**
+ * Grows the map when it is still the size the caller saw when the write failed.
+ * New txns are held back on the envLock while the txns already begun get TRASH_GROW_WAIT_MS to finish.
+ * 
+ * @note    the calling thread must not have any txns begun
+ * @return  MDB_MAP_FULL when the map can not be grown
+ */
+static int internal_grow_map(size_t seen) {
+    struct timespec deadline, pause;
+    size_t mapsize, growth;
+    unsigned int growpct;
+    int rc;
+
+    if(oEnv->meta.mapmax == 0 || activeLocal > 0)
+        return MDB_MAP_FULL;
+    // the copy holds its txn for as long as the throttled copy takes, new txns would wait on it for nothing
+    if(__atomic_load_n(&oEnv->backups, __ATOMIC_SEQ_CST) > 0)
+        return MDB_MAP_FULL;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += TRASH_GROW_WAIT_MS / 1000;
+    deadline.tv_nsec += (long)(TRASH_GROW_WAIT_MS % 1000) * 1000000;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000;
+    deadline.tv_nsec %= 1000000000;
+
+    // fails as well when this thread already holds the envLock
+    if(pthread_rwlock_timedwrlock(&oEnv->envLock, &deadline) != 0)
+        return MDB_MAP_FULL;
+
+    __atomic_store_n(&oEnv->resizing, 1, __ATOMIC_SEQ_CST);
+
+    pause.tv_sec = 0;
+    pause.tv_nsec = 100000;
+    rc = TRASH_DB_SUCCESS;
+    while(__atomic_load_n(&oEnv->activeTxns, __ATOMIC_SEQ_CST) > 0) {
+        struct timespec now;
+
+        clock_gettime(CLOCK_REALTIME, &now);
+        if(now.tv_sec > deadline.tv_sec || (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec)) {
+            rc = MDB_MAP_FULL;
+            break;
+        }
+        nanosleep(&pause, NULL);
+    }
+
+    mapsize = internal_mapsize();
+    if(rc == TRASH_DB_SUCCESS && mapsize <= seen) {
+        growpct = (oEnv->meta.growpct == 0) ? TRASH_GROW_PCT : oEnv->meta.growpct;
+        growth = mapsize / 100 * growpct;
+
+        if(mapsize >= oEnv->meta.mapmax) {
+            rc = MDB_MAP_FULL;
+        } else {
+            if(growth > oEnv->meta.mapmax - mapsize)
+                growth = oEnv->meta.mapmax - mapsize;
+            if(mdb_env_set_mapsize(oEnv->env, mapsize + growth) == 0) {
+                __atomic_add_fetch(&oEnv->resizes, 1, __ATOMIC_RELAXED);
+            } else {
+                rc = MDB_MAP_FULL;
+            }
+        }
+    }
+
+    __atomic_store_n(&oEnv->resizing, 0, __ATOMIC_SEQ_CST);
+    pthread_rwlock_unlock(&oEnv->envLock);
+
+    return rc;
+}
+
+/**
+ * Aborts the txn, grows the map and replays every logged write into a new txn.
+ * 
+ * @note    when the map can not be grown the txn is marked failed, every later call with it
+ *          fails with MDB_BAD_TXN and return_txn aborts it
+ */
+static int internal_txn_regrow(TrashTxn *tt) {
+    struct LogEntry *entry;
+    struct OpenDb **blooms = NULL;
+    MDB_val key, val;
+    size_t seen, off, numblooms;
+    int rc;
+
+    // the savepoints would be lost with the txn, rolling back the newest one is up to the caller
+    if(oEnv->meta.mapmax == 0 || (tt->actions & TRASH_TXN_NOREPLAY) || tt->numsaves > 0)
+        return MDB_MAP_FULL;
+
+    // the new txn gets the same id, the deletes of the stored filters go with the old one and are done again
+    numblooms = tt->numblooms;
+    if(numblooms > 0) {
+        blooms = (struct OpenDb **)malloc(numblooms * sizeof(struct OpenDb *));
+        assert(blooms != NULL);
+        memcpy(blooms, tt->blooms, numblooms * sizeof(struct OpenDb *));
+    }
+
+    do {
+        seen = internal_mapsize();
+        internal_bloom_undo(tt, 0);
+        mdb_txn_abort(tt->txn);
+        internal_txn_exit();
+
+        rc = internal_grow_map(seen);
+
+        internal_txn_enter();
+        assert(mdb_txn_begin(oEnv->env, NULL, 0, &tt->txn) == 0);
+
+        if(rc != TRASH_DB_SUCCESS) {
+            internal_log_free(tt);
+            tt->actions |= TRASH_TXN_NOREPLAY | TRASH_TXN_FAILED;
+            tt->actions &= ~TRASH_TXN_COMMIT;
+            free(blooms);
+            return rc;
+        }
+
+        for (off = 0; tt->log != NULL && off < tt->log->len; ) {
+            entry = (struct LogEntry *)(tt->log->buf + off);
+            key.mv_size = entry->klen;
+            key.mv_data = (char *)(entry + 1);
+            val.mv_size = entry->vlen;
+            val.mv_data = (char *)(entry + 1) + entry->klen;
+
+            rc = mdb_put(tt->txn, entry->dbi, &key, &val, entry->flags);
+            if(rc != 0)
+                break;
+
+            off += (sizeof(struct LogEntry) + entry->klen + entry->vlen + 7) & ~(size_t)7;
+        }
+
+        for (size_t i = 0; rc == 0 && i < numblooms; i++)
+            rc = internal_bloom_drop(tt, blooms[i]);
+        // the replay can fill the grown map again
+    } while(rc == MDB_MAP_FULL);
+
+    free(blooms);
+    return rc;
+}
+
+/**
+ * Copies the write into the txn log when the map is allowed to grow
+ */
+static void internal_log_put(TrashTxn *tt, MDB_dbi dbi, MDB_val *key, MDB_val *val, unsigned int flags) {
+    struct TxnLog *log;
+    struct LogEntry *entry;
+    size_t need;
+
+    if(oEnv->meta.mapmax == 0 || (tt->actions & TRASH_TXN_NOREPLAY))
+        return;
+
+    // reserved space is filled in by the caller after the put, so it can not be replayed
+    if(flags & MDB_RESERVE) {
+        tt->actions |= TRASH_TXN_NOREPLAY;
+        internal_log_free(tt);
+        return;
+    }
+
+    if(tt->log == NULL) {
+        tt->log = (struct TxnLog *)calloc(1, sizeof(struct TxnLog));
+        assert(tt->log != NULL);
+    }
+    log = tt->log;
+
+    need = (sizeof(struct LogEntry) + key->mv_size + val->mv_size + 7) & ~(size_t)7;
+    if(log->len + need > log->cap) {
+        size_t cap = (log->cap == 0) ? 4096 : log->cap;
+        while(cap < log->len + need)
+            cap <<= 1;
+        log->buf = (char *)realloc(log->buf, cap);
+        assert(log->buf != NULL);
+        log->cap = cap;
+    }
+
+    entry = (struct LogEntry *)(log->buf + log->len);
+    entry->dbi = dbi;
+    entry->flags = flags;
+    entry->klen = key->mv_size;
+    entry->vlen = val->mv_size;
+    memcpy(entry + 1, key->mv_data, key->mv_size);
+    memcpy((char *)(entry + 1) + key->mv_size, val->mv_data, val->mv_size);
+    log->len += need;
+}
+
+static void internal_log_free(TrashTxn *tt) {
+    if(tt->log == NULL)
+        return;
+
+    free(tt->log->buf);
+    free(tt->log);
+    tt->log = NULL;
+}
+
+/**
+ * @note    this function will need to check if their is room for the desired db size
+ * @todo    make this function better    
+*/
+static int internal_set_env_fields(MDB_env *env, size_t dbsize, unsigned int numdbs, unsigned int numrdrs) {
+    if(mdb_env_set_maxdbs(env, numdbs) != 0) {
+        return TRASH_DB_ERROR;
+    }
+    if(mdb_env_set_maxreaders(env, numrdrs) != 0) {
+        return TRASH_DB_ERROR;
+    }
+    if(mdb_env_set_mapsize(env, dbsize) != 0) {
+        return TRASH_DB_ERROR;
+    }
+    return TRASH_DB_SUCCESS;
+}
+
+static int db_match(struct OpenDb *db, const char *dbname) {
+    if(db == NULL) {
+        return TRASH_DB_ERROR;
+    }
+
+    int rc;
+    rc = (strcmp(db->name, dbname) == 0) ? TRASH_DB_SUCCESS : TRASH_DB_ERROR;
+
+    return rc;
+}
+
+/**
+ * Stable bottom up merge sort of n elements of size bytes, tmp has room for n of them
+ * 
+ * @return  the buffer the sorted elements ended up in, base or tmp
+ */
+static void *internal_merge_sort(void *base, void *tmp, size_t n, size_t size, int (*cmp)(const void *, const void *, void *), void *ctx) {
+    char *src, *dst, *swap;
+
+    src = (char *)base;
+    dst = (char *)tmp;
+    for (size_t width = 1; width < n; width <<= 1) {
+        for (size_t lo = 0; lo < n; lo += width << 1) {
+            size_t mid = (lo + width < n) ? lo + width : n;
+            size_t hi = (lo + (width << 1) < n) ? lo + (width << 1) : n;
+            size_t l = lo, r = mid, k = lo;
+
+            while(l < mid && r < hi) {
+                if(cmp(src + r * size, src + l * size, ctx) < 0) {
+                    memcpy(dst + k++ * size, src + r++ * size, size);
+                } else {
+                    memcpy(dst + k++ * size, src + l++ * size, size);
+                }
+            }
+            memcpy(dst + k * size, src + l * size, (mid - l) * size);
+            k += mid - l;
+            memcpy(dst + k * size, src + r * size, (hi - r) * size);
+        }
+        swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    return src;
+}
+
+static int internal_key_sort_cmp(const void *a, const void *b, void *ctx) {
+    struct KeySort *ks = (struct KeySort *)ctx;
+
+    return mdb_cmp(ks->txn, ks->dbi, &ks->keys[*(const size_t *)a], &ks->keys[*(const size_t *)b]);
+}
+
+/**
+ * Sorts the key indexes using the comparator of the db
+ */
+static void internal_sort_keys(MDB_txn *txn, MDB_dbi dbi, MDB_val *keys, size_t *order, size_t numkeys) {
+    struct KeySort ks;
+    size_t *tmp;
+
+    for (size_t i = 0; i < numkeys; i++)
+        order[i] = i;
+
+    if(numkeys < 2)
+        return;
+
+    tmp = (size_t *)malloc(numkeys * sizeof(size_t));
+    assert(tmp != NULL);
+
+    ks.txn = txn;
+    ks.dbi = dbi;
+    ks.keys = keys;
+    if(internal_merge_sort(order, tmp, numkeys, sizeof(size_t), internal_key_sort_cmp, &ks) != order)
+        memcpy(order, tmp, numkeys * sizeof(size_t));
+
+    free(tmp);
+}
+
+/**
+ * Positions the cursor on the first pair of the iteration
+ */
+static int internal_iter_seek(TrashIter *it, MDB_val *key, MDB_val *val) {
+    MDB_cursor *cur = it->tc->cur;
+    unsigned char *succ;
+    size_t len;
+    int rc;
+
+    if(!(it->flags & TRASH_ITER_REVERSE)) {
+        if(!it->haslo)
+            return mdb_cursor_get(cur, key, val, MDB_FIRST);
+
+        *key = it->lo;
+        return mdb_cursor_get(cur, key, val, MDB_SET_RANGE);
+    }
+
+    if(it->flags & TRASH_ITER_PREFIX) {
+        // the first key past the prefix is the prefix with its last byte below 0xff incremented
+        len = it->lo.mv_size;
+        succ = (unsigned char *)malloc(len > 0 ? len : 1);
+        assert(succ != NULL);
+        memcpy(succ, it->lo.mv_data, len);
+        while(len > 0 && succ[len - 1] == 0xff)
+            len--;
+
+        if(len == 0) {
+            free(succ);
+            return mdb_cursor_get(cur, key, val, MDB_LAST);
+        }
+
+        succ[len - 1]++;
+        key->mv_data = succ;
+        key->mv_size = len;
+        rc = mdb_cursor_get(cur, key, val, MDB_SET_RANGE);
+        free(succ);
+    } else {
+        if(!it->hashi)
+            return mdb_cursor_get(cur, key, val, MDB_LAST);
+
+        *key = it->hi;
+        rc = mdb_cursor_get(cur, key, val, MDB_SET_RANGE);
+        if(rc == 0 && (it->flags & TRASH_ITER_HI_INCL) && mdb_cmp(it->txn, it->dbi, key, &it->hi) == 0)
+            return rc;
+    }
+
+    // the cursor is on the first key past the upper bound
+    if(rc == MDB_NOTFOUND)
+        return mdb_cursor_get(cur, key, val, MDB_LAST);
+    if(rc != 0)
+        return rc;
+
+    return mdb_cursor_get(cur, key, val, MDB_PREV);
+}
+
+static bool internal_iter_in_bounds(TrashIter *it, MDB_val *key) {
+    int cmp;
+
+    if(it->flags & TRASH_ITER_PREFIX) {
+        return key->mv_size >= it->lo.mv_size && memcmp(key->mv_data, it->lo.mv_data, it->lo.mv_size) == 0;
+    }
+
+    if(it->flags & TRASH_ITER_REVERSE) {
+        return !it->haslo || mdb_cmp(it->txn, it->dbi, key, &it->lo) >= 0;
+    }
+
+    if(!it->hashi)
+        return true;
+
+    cmp = mdb_cmp(it->txn, it->dbi, key, &it->hi);
+    return cmp < 0 || (cmp == 0 && (it->flags & TRASH_ITER_HI_INCL));
+}
+
+/**
+ * Only lmdb overflow values span more than the page the cursor already touched
+ */
+static void internal_prefetch(MDB_val *val) {
+    uintptr_t start, end;
+
+    if(val->mv_size <= oEnv->psize)
+        return;
+
+    start = (uintptr_t)val->mv_data & ~(uintptr_t)(oEnv->ospsize - 1);
+    end = (uintptr_t)val->mv_data + val->mv_size;
+    madvise((void *)start, end - start, MADV_WILLNEED);
+}
+
+static struct KeyCache *internal_cache_create(size_t bytes) {
+    struct KeyCache *cache;
+
+    cache = (struct KeyCache *)calloc(1, sizeof(struct KeyCache));
+    assert(cache != NULL);
+
+    for (size_t i = 0; i < TRASH_CACHE_SHARDS; i++) {
+        struct CacheShard *sh = &cache->shards[i];
+
+        sh->tablecap = 64;
+        sh->table = (struct CacheEntry **)calloc(sh->tablecap, sizeof(struct CacheEntry *));
+        assert(sh->table != NULL);
+        sh->cap = bytes / TRASH_CACHE_SHARDS;
+        pthread_mutex_init(&sh->shardMutex, NULL);
+    }
+
+    return cache;
+}
+
+static void internal_cache_free(struct KeyCache *cache) {
+    if(cache == NULL)
+        return;
+
+    for (size_t i = 0; i < TRASH_CACHE_SHARDS; i++) {
+        struct CacheShard *sh = &cache->shards[i];
+
+        for (size_t j = 0; j < sh->numring; j++)
+            free(sh->ring[j]);
+        free(sh->ring);
+        free(sh->table);
+        pthread_mutex_destroy(&sh->shardMutex);
+    }
+
+    free(cache);
+}
+
+/**
+ * @return  link to the entry of the key in its bucket, the link holds NULL when the key is not cached
+ * @note    the shard has to be locked
+ */
+static struct CacheEntry **internal_cache_find(struct CacheShard *sh, MDB_val *key, unsigned int hash) {
+    struct CacheEntry **link;
+
+    link = &sh->table[(hash / TRASH_CACHE_SHARDS) & (sh->tablecap - 1)];
+    while(*link != NULL) {
+        struct CacheEntry *e = *link;
+        if(e->hash == hash && e->klen == key->mv_size && memcmp(e->data, key->mv_data, key->mv_size) == 0)
+            break;
+        link = &e->hnext;
+    }
+
+    return link;
+}
+
+/**
+ * @note    the shard has to be locked
+ */
+static void internal_cache_drop(struct CacheShard *sh, struct CacheEntry **link) {
+    struct CacheEntry *e = *link;
+
+    *link = e->hnext;
+
+    // the last entry of the ring takes the slot
+    sh->ring[e->slot] = sh->ring[--sh->numring];
+    sh->ring[e->slot]->slot = e->slot;
+    if(sh->hand >= sh->numring)
+        sh->hand = 0;
+
+    sh->bytes -= sizeof(struct CacheEntry) + e->klen + e->vlen;
+    free(e);
+}
+
+/**
+ * @return  MDB_NOTFOUND on a miss
+ */
+static int internal_cache_lookup(struct KeyCache *cache, MDB_val *key, void *buf, size_t *len) {
+    struct CacheShard *sh;
+    struct CacheEntry *e;
+    unsigned int hash;
+    int rc = 0;
+
+    hash = internal_hash_key(key->mv_data, key->mv_size);
+    sh = &cache->shards[hash % TRASH_CACHE_SHARDS];
+
+    pthread_mutex_lock(&sh->shardMutex);
+    e = *internal_cache_find(sh, key, hash);
+    if(e == NULL) {
+        rc = MDB_NOTFOUND;
+    } else {
+        e->ref = 1;
+        if(e->vlen > *len) {
+            rc = TRASH_DB_ERROR;
+        } else {
+            memcpy(buf, e->data + e->klen, e->vlen);
+        }
+        *len = e->vlen;
+    }
+    pthread_mutex_unlock(&sh->shardMutex);
+
+    return rc;
+}
+
+/**
+ * Adds the value read in the snapshot txnid, evicting with the clock hand until it fits
+ */
+static void internal_cache_insert(struct KeyCache *cache, MDB_val *key, MDB_val *val, size_t txnid) {
+    struct CacheShard *sh;
+    struct CacheEntry *e, **link;
+    unsigned int hash;
+    size_t need;
+
+    need = sizeof(struct CacheEntry) + key->mv_size + val->mv_size;
+    hash = internal_hash_key(key->mv_data, key->mv_size);
+    sh = &cache->shards[hash % TRASH_CACHE_SHARDS];
+
+    // one value should not push out most of the shard
+    if(need > sh->cap / 8)
+        return;
+
+    pthread_mutex_lock(&sh->shardMutex);
+    if(sh->pending > 0 || txnid < sh->invtxn || *internal_cache_find(sh, key, hash) != NULL) {
+        pthread_mutex_unlock(&sh->shardMutex);
+        return;
+    }
+
+    while(sh->bytes + need > sh->cap && sh->numring > 0) {
+        MDB_val ekey;
+
+        e = sh->ring[sh->hand];
+        if(e->ref) {
+            e->ref = 0;
+            sh->hand = (sh->hand + 1) % sh->numring;
+            continue;
+        }
+        ekey.mv_size = e->klen;
+        ekey.mv_data = e->data;
+        internal_cache_drop(sh, internal_cache_find(sh, &ekey, e->hash));
+    }
+
+    if(sh->numring == sh->ringcap) {
+        sh->ringcap = (sh->ringcap == 0) ? 64 : sh->ringcap * 2;
+        sh->ring = (struct CacheEntry **)realloc(sh->ring, sh->ringcap * sizeof(struct CacheEntry *));
+        assert(sh->ring != NULL);
+    }
+
+    // keep the chains short, the table is rehashed when it has as many entries as buckets
+    if(sh->numring == sh->tablecap) {
+        struct CacheEntry **table;
+        size_t cap = sh->tablecap * 2;
+
+        table = (struct CacheEntry **)calloc(cap, sizeof(struct CacheEntry *));
+        assert(table != NULL);
+        for (size_t i = 0; i < sh->numring; i++) {
+            struct CacheEntry **b = &table[(sh->ring[i]->hash / TRASH_CACHE_SHARDS) & (cap - 1)];
+            sh->ring[i]->hnext = *b;
+            *b = sh->ring[i];
+        }
+        free(sh->table);
+        sh->table = table;
+        sh->tablecap = cap;
+    }
+
+    e = (struct CacheEntry *)malloc(need);
+    assert(e != NULL);
+    e->hash = hash;
+    e->ref = 0;
+    e->klen = key->mv_size;
+    e->vlen = val->mv_size;
+    memcpy(e->data, key->mv_data, key->mv_size);
+    memcpy(e->data + key->mv_size, val->mv_data, val->mv_size);
+
+    link = internal_cache_find(sh, key, hash);
+    e->hnext = NULL;
+    *link = e;
+    e->slot = sh->numring;
+    sh->ring[sh->numring++] = e;
+    sh->bytes += need;
+    pthread_mutex_unlock(&sh->shardMutex);
+}
+
+/**
+ * Records a key written by the txn to a cached db
+ */
+static void internal_cache_note(TrashTxn *tt, struct OpenDb *db, MDB_val *key) {
+    struct TxnLog *log;
+    struct InvalEntry *entry;
+    size_t need;
+
+    if(db == NULL || db->cache == NULL)
+        return;
+
+    if(tt->inval == NULL) {
+        tt->inval = (struct TxnLog *)calloc(1, sizeof(struct TxnLog));
+        assert(tt->inval != NULL);
+    }
+    log = tt->inval;
+
+    need = (sizeof(struct InvalEntry) + key->mv_size + 7) & ~(size_t)7;
+    if(log->len + need > log->cap) {
+        size_t cap = (log->cap == 0) ? 1024 : log->cap;
+        while(cap < log->len + need)
+            cap <<= 1;
+        log->buf = (char *)realloc(log->buf, cap);
+        assert(log->buf != NULL);
+        log->cap = cap;
+    }
+
+    entry = (struct InvalEntry *)(log->buf + log->len);
+    entry->cache = db->cache;
+    entry->klen = key->mv_size;
+    memcpy(entry + 1, key->mv_data, key->mv_size);
+    log->len += need;
+}
+
+/**
+ * Drops the cached values of the keys written by the txn and keeps readers from adding them back
+ */
+static void internal_cache_inval_begin(TrashTxn *tt) {
+    struct InvalEntry *entry;
+    struct CacheShard *sh;
+    struct CacheEntry **link;
+    MDB_val key;
+    unsigned int hash;
+
+    if(tt->inval == NULL)
+        return;
+
+    for (size_t off = 0; off < tt->inval->len; ) {
+        entry = (struct InvalEntry *)(tt->inval->buf + off);
+        key.mv_size = entry->klen;
+        key.mv_data = entry + 1;
+
+        hash = internal_hash_key(key.mv_data, key.mv_size);
+        sh = &entry->cache->shards[hash % TRASH_CACHE_SHARDS];
+
+        pthread_mutex_lock(&sh->shardMutex);
+        link = internal_cache_find(sh, &key, hash);
+        if(*link != NULL)
+            internal_cache_drop(sh, link);
+        sh->pending++;
+        pthread_mutex_unlock(&sh->shardMutex);
+
+        off += (sizeof(struct InvalEntry) + entry->klen + 7) & ~(size_t)7;
+    }
+}
+
+/**
+ * @param   txnid   id of the committed txn, 0 when it was aborted
+ */
+static void internal_cache_inval_end(TrashTxn *tt, size_t txnid) {
+    struct InvalEntry *entry;
+    struct CacheShard *sh;
+
+    if(tt->inval == NULL)
+        return;
+
+    for (size_t off = 0; off < tt->inval->len; ) {
+        entry = (struct InvalEntry *)(tt->inval->buf + off);
+        sh = &entry->cache->shards[internal_hash_key(entry + 1, entry->klen) % TRASH_CACHE_SHARDS];
+
+        pthread_mutex_lock(&sh->shardMutex);
+        if(txnid > sh->invtxn)
+            sh->invtxn = txnid;
+        sh->pending--;
+        pthread_mutex_unlock(&sh->shardMutex);
+
+        off += (sizeof(struct InvalEntry) + entry->klen + 7) & ~(size_t)7;
+    }
+
+    tt->inval->len = 0;
+}
+
+static uint64_t internal_hash64(const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *)data;
+    uint64_t hash = 14695981039346656037ull;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ull;
+    }
+
+    // spread short keys over every bit, the block and the bits in it are taken from different ends
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+static struct BloomFilter *internal_bloom_create(size_t keys) {
+    struct BloomFilter *bf;
+    size_t nblocks = 1;
+
+    while(nblocks * BLOOM_BLOCK_BITS < keys * TRASH_BLOOM_BITS_PER_KEY)
+        nblocks <<= 1;
+
+    bf = (struct BloomFilter *)calloc(1, sizeof(struct BloomFilter));
+    assert(bf != NULL);
+    bf->bits = (uint64_t *)calloc(nblocks * BLOOM_BLOCK_WORDS, sizeof(uint64_t));
+    assert(bf->bits != NULL);
+    bf->nblocks = nblocks;
+
+    return bf;
+}
+
+static void internal_bloom_free(struct BloomFilter *bf) {
+    if(bf == NULL)
+        return;
+
+    free(bf->bits);
+    free(bf);
+}
+
+/**
+ * @note    bits are set with atomics, readers never take a lock
+ */
+static void internal_bloom_add(struct BloomFilter *bf, MDB_val *key) {
+    uint64_t hash, *block;
+    uint32_t a, b;
+
+    hash = internal_hash64(key->mv_data, key->mv_size);
+    block = bf->bits + ((hash >> 32) & (bf->nblocks - 1)) * BLOOM_BLOCK_WORDS;
+    a = (uint32_t)hash;
+    b = (uint32_t)((hash * 0x9e3779b97f4a7c15ull) >> 32) | 1;
+
+    for (uint32_t i = 0; i < TRASH_BLOOM_HASHES; i++) {
+        uint32_t bit = (a + i * b) % BLOOM_BLOCK_BITS;
+        __atomic_fetch_or(&block[bit / 64], (uint64_t)1 << (bit % 64), __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @return  false when the key was never written, true when it might have been or the filter is not ready
+ */
+static bool internal_bloom_test(struct BloomFilter *bf, MDB_val *key) {
+    uint64_t hash, *block;
+    uint32_t a, b;
+
+    if(!__atomic_load_n(&bf->ready, __ATOMIC_ACQUIRE))
+        return true;
+
+    hash = internal_hash64(key->mv_data, key->mv_size);
+    block = bf->bits + ((hash >> 32) & (bf->nblocks - 1)) * BLOOM_BLOCK_WORDS;
+    a = (uint32_t)hash;
+    b = (uint32_t)((hash * 0x9e3779b97f4a7c15ull) >> 32) | 1;
+
+    for (uint32_t i = 0; i < TRASH_BLOOM_HASHES; i++) {
+        uint32_t bit = (a + i * b) % BLOOM_BLOCK_BITS;
+        if(!(__atomic_load_n(&block[bit / 64], __ATOMIC_ACQUIRE) & ((uint64_t)1 << (bit % 64))))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * Adds a key written by the txn, deleting the stored filter in the same txn the first time
+ */
+static int internal_bloom_write(TrashTxn *tt, struct OpenDb *db, MDB_val *key) {
+    if(db == NULL || db->bloom == NULL)
+        return 0;
+
+    internal_bloom_add(db->bloom, key);
+
+    return internal_bloom_drop(tt, db);
+}
+
+/**
+ * Deletes the stored filter of the db in the txn, unless the txn already did
+ * 
+ * @note    write txns are serialized by lmdb, so deltxn is only touched by one writer at a time
+ */
+static int internal_bloom_drop(TrashTxn *tt, struct OpenDb *db) {
+    struct BloomFilter *bf;
+    MDB_val bkey;
+    char keybuf[TRASH_DB_NAME_LEN];
+    size_t txnid;
+    int rc;
+
+    bf = db->bloom;
+    if(!__atomic_load_n(&bf->persisted, __ATOMIC_ACQUIRE))
+        return 0;
+
+    txnid = mdb_txn_id(tt->txn);
+    if(bf->deltxn == txnid)
+        return 0;
+
+    snprintf(keybuf, sizeof(keybuf), BLOOM_KEY_FORMAT, db->name);
+    bkey.mv_data = keybuf;
+    bkey.mv_size = strlen(keybuf);
+    rc = mdb_del(tt->txn, oEnv->metadbi, &bkey, NULL);
+    if(rc != 0 && rc != MDB_NOTFOUND)
+        return rc;
+
+    if(tt->numblooms == tt->bloomscap) {
+        tt->bloomscap = (tt->bloomscap == 0) ? 4 : tt->bloomscap * 2;
+        tt->blooms = (struct OpenDb **)realloc(tt->blooms, tt->bloomscap * sizeof(struct OpenDb *));
+        assert(tt->blooms != NULL);
+    }
+    tt->blooms[tt->numblooms++] = db;
+    bf->deltxn = txnid;
+
+    return 0;
+}
+
+/**
+ * Forgets the deletes of the stored filters since mark, the nested txn that did them was aborted
+ */
+static void internal_bloom_undo(TrashTxn *tt, size_t mark) {
+    while(tt->numblooms > mark)
+        tt->blooms[--tt->numblooms]->bloom->deltxn = 0;
+}
+
+static void internal_bloom_txn_end(TrashTxn *tt, bool committed) {
+    for (size_t i = 0; i < tt->numblooms; i++) {
+        struct BloomFilter *bf = tt->blooms[i]->bloom;
+
+        if(committed)
+            __atomic_store_n(&bf->persisted, 0, __ATOMIC_RELEASE);
+        bf->deltxn = 0;
+    }
+    tt->numblooms = 0;
+}
+
+/**
+ * Loads the stored filter of the db, or rebuilds it from the keys when it was deleted or sized differently
+ */
+static void internal_bloom_load(struct OpenDb *db, MDB_txn *txn) {
+    struct BloomFilter *bf = db->bloom;
+    struct BloomHeader hdr;
+    MDB_cursor *cur;
+    MDB_val bkey, key, val;
+    char keybuf[TRASH_DB_NAME_LEN];
+    size_t size;
+
+    if(bf == NULL || bf->ready)
+        return;
+
+    size = bf->nblocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t);
+    snprintf(keybuf, sizeof(keybuf), BLOOM_KEY_FORMAT, db->name);
+    bkey.mv_data = keybuf;
+    bkey.mv_size = strlen(keybuf);
+
+    if(mdb_get(txn, oEnv->metadbi, &bkey, &val) == 0 && val.mv_size == sizeof(hdr) + size) {
+        memcpy(&hdr, val.mv_data, sizeof(hdr));
+        if(hdr.nblocks == bf->nblocks && hdr.hashes == TRASH_BLOOM_HASHES) {
+            memcpy(bf->bits, (char *)val.mv_data + sizeof(hdr), size);
+            bf->persisted = 1;
+            __atomic_store_n(&bf->ready, 1, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+
+    assert(mdb_cursor_open(txn, db->dbi, &cur) == 0);
+    while(mdb_cursor_get(cur, &key, &val, MDB_NEXT_NODUP) == 0)
+        internal_bloom_add(bf, &key);
+    mdb_cursor_close(cur);
+
+    __atomic_store_n(&bf->ready, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Stores the filter in the metadata db so the next open does not have to rebuild it
+ * 
+ * @note    called with the env lock held, like write_db_meta the thread can not be in a write txn
+ */
+static void internal_bloom_persist(struct OpenDb *db) {
+    struct BloomFilter *bf = db->bloom;
+    struct BloomHeader hdr;
+    TrashTxn *tt;
+    MDB_val bkey, val;
+    char keybuf[TRASH_DB_NAME_LEN];
+    size_t size;
+    int rc;
+
+    if(bf == NULL || !bf->ready || bf->persisted)
+        return;
+
+    internal_begin_txn(&tt, TRASH_WR_TXN);
+
+    // no writer can add bits while this txn holds the writer lock, the first one after it deletes the copy again
+    __atomic_store_n(&bf->persisted, 1, __ATOMIC_RELEASE);
+
+    size = bf->nblocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t);
+    snprintf(keybuf, sizeof(keybuf), BLOOM_KEY_FORMAT, db->name);
+    bkey.mv_data = keybuf;
+    bkey.mv_size = strlen(keybuf);
+    val.mv_size = sizeof(hdr) + size;
+
+    rc = mdb_put(tt->txn, oEnv->metadbi, &bkey, &val, MDB_RESERVE);
+    if(rc == 0) {
+        hdr.nblocks = bf->nblocks;
+        hdr.hashes = TRASH_BLOOM_HASHES;
+        memcpy(val.mv_data, &hdr, sizeof(hdr));
+        memcpy((char *)val.mv_data + sizeof(hdr), bf->bits, size);
+    } else {
+        // left to be rebuilt on the next open
+        __atomic_store_n(&bf->persisted, 0, __ATOMIC_RELEASE);
+        tt->actions &= ~TRASH_TXN_COMMIT;
+    }
+
+    return_txn(tt);
+}
+
+static unsigned long internal_now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000ul + (unsigned long)ts.tv_nsec;
+}
+
+static void internal_stats_release() {
+    if(tStats == NULL)
+        return;
+
+    pthread_mutex_lock(&statsMutex);
+    tStats->inuse = false;
+    pthread_mutex_unlock(&statsMutex);
+    tStats = NULL;
+}
+
+#ifndef TRASH_NO_STATS
+/**
+ * @return  stats block of this thread, taken on first use
+ */
+static struct StatsLocal *internal_stats() {
+    struct IL *curr;
+    struct StatsLocal *sl = NULL;
+
+    if(tStats != NULL)
+        return tStats;
+
+    pthread_mutex_lock(&statsMutex);
+    if(statsBlocks.head.next == NULL)
+        init_list(&statsBlocks);
+
+    // reuse a block left by a thread that cleaned up, its counts stay in the totals
+    for_each(&statsBlocks.head, curr) {
+        struct StatsLocal *left;
+        left = CONTAINER_OF(curr, struct StatsLocal, movestats);
+        if(!left->inuse) {
+            sl = left;
+            break;
+        }
+    }
+
+    if(sl == NULL) {
+        sl = (struct StatsLocal *)calloc(1, sizeof(struct StatsLocal));
+        assert(sl != NULL);
+        init_il(&sl->movestats);
+        list_append(&statsBlocks, &sl->movestats);
+    }
+    sl->inuse = true;
+    pthread_mutex_unlock(&statsMutex);
+
+    tStats = sl;
+    return sl;
+}
+
+/**
+ * Only the owning thread writes the field, the atomics keep the snapshot from reading a torn value
+ */
+static void internal_stats_add(unsigned long *field, unsigned long n) {
+    __atomic_store_n(field, __atomic_load_n(field, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static void internal_stats_hist(int h, unsigned long ns) {
+    unsigned int bucket;
+
+    bucket = (ns == 0) ? 0 : 63 - __builtin_clzl(ns);
+    if(bucket >= TRASH_HIST_BUCKETS)
+        bucket = TRASH_HIST_BUCKETS - 1;
+
+    internal_stats_add(&internal_stats()->st.hist[h][bucket], 1);
+}
+#endif
+
+static void internal_env_rdlock() {
+    unsigned long start;
+
+    STATS_CLOCK(start);
+    pthread_rwlock_rdlock(&oEnv->envLock);
+    STATS_SINCE(envlockns, start);
+}
+
+static void internal_env_wrlock() {
+    unsigned long start;
+
+    STATS_CLOCK(start);
+    pthread_rwlock_wrlock(&oEnv->envLock);
+    STATS_SINCE(envlockns, start);
+}
+
+/**
+ * 32 bit FNV-1a of the db name
+ */
+static unsigned int internal_hash_name(const char *dbname) {
+    return internal_hash_key(dbname, strlen(dbname));
+}
+
+static unsigned int internal_hash_key(const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *)data;
+    unsigned int hash = 2166136261u;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * @note    the calling function needs to handle locking for the oenv struct
+ */
+static void internal_registry_add(struct OpenDb *db) {
+    struct OpenDb **bucket;
+
+    bucket = &oEnv->dbtable[db->hash & (oEnv->dbtablecap - 1)];
+    db->hnext = *bucket;
+    *bucket = db;
+}
+
+/**
+ * @note    the calling function needs to handle locking for the oenv struct
+ */
+static void internal_registry_remove(struct OpenDb *db) {
+    struct OpenDb **curr;
+
+    curr = &oEnv->dbtable[db->hash & (oEnv->dbtablecap - 1)];
+    while(*curr != NULL) {
+        if(*curr == db) {
+            *curr = db->hnext;
+            break;
+        }
+        curr = &(*curr)->hnext;
+    }
+    db->hnext = NULL;
+}
+
+/**
+ * Opens the dbi with the key order of the key type of the db.
+ * Fixed and tuple keys are ordered by lmdb's memcmp, integers are compared as integers.
+ * 
+ * @note    the comparator is kept per dbi by lmdb, it is set again every time the env is opened
+ */
+static int internal_dbi_open(MDB_txn *txn, struct DbMeta *dbmeta, unsigned int flags, MDB_dbi *dbi, MDB_dbi *ttldbi) {
+    MDB_cmp_func *cmp = NULL;
+    char ttlname[TRASH_DB_NAME_LEN];
+    int rc;
+
+    switch (dbmeta->flags & TRASH_DB_KEY_MASK) {
+    case TRASH_DB_KEY_U32:
+        flags |= MDB_INTEGERKEY;
+        break;
+    case TRASH_DB_KEY_U64:
+#if SIZE_MAX == UINT64_MAX
+        // lmdb only takes unsigned int or size_t integer keys
+        flags |= MDB_INTEGERKEY;
+#else
+        cmp = internal_cmp_u64;
+#endif
+        break;
+    case TRASH_DB_KEY_I64:
+        cmp = internal_cmp_i64;
+        break;
+    }
+
+    rc = mdb_dbi_open(txn, dbmeta->name, flags, dbi);
+    if(rc == 0 && cmp != NULL)
+        rc = mdb_set_compare(txn, *dbi, cmp);
+
+    // the expiry index is not listed in the metadata, it is opened with its db
+    if(rc == 0 && (dbmeta->flags & TRASH_DB_TTL)) {
+        snprintf(ttlname, sizeof(ttlname), TTL_DB_FORMAT, dbmeta->name);
+        rc = mdb_dbi_open(txn, ttlname, flags & MDB_CREATE, ttldbi);
+    }
+
+    return rc;
+}
+
+static bool internal_key_ok(struct OpenDb *db, MDB_val *key) {
+    switch (db->flags & TRASH_DB_KEY_MASK) {
+    case TRASH_DB_KEY_U32:
+        return key->mv_size == sizeof(uint32_t);
+    case TRASH_DB_KEY_U64:
+    case TRASH_DB_KEY_I64:
+        return key->mv_size == sizeof(uint64_t);
+    case TRASH_DB_KEY_FIXED:
+        return key->mv_size == db->keywidth;
+    default:
+        return true;
+    }
+}
+
+static int internal_cmp_i64(const MDB_val *a, const MDB_val *b) {
+    int64_t x, y;
+
+    memcpy(&x, a->mv_data, sizeof(x));
+    memcpy(&y, b->mv_data, sizeof(y));
+
+    return (x > y) - (x < y);
+}
+
+#if SIZE_MAX != UINT64_MAX
+static int internal_cmp_u64(const MDB_val *a, const MDB_val *b) {
+    uint64_t x, y;
+
+    memcpy(&x, a->mv_data, sizeof(x));
+    memcpy(&y, b->mv_data, sizeof(y));
+
+    return (x > y) - (x < y);
+}
+#endif
+
+/**
+ * @note    the calling function needs to handle locking for the oenv struct
+ */
+static struct OpenDb *internal_add_db(struct DbMeta *dbmeta, MDB_dbi dbi) {
+    struct OpenDb *db;
+
+    db = (struct OpenDb *)malloc(sizeof(struct OpenDb));
+    assert(db != NULL);
+
+    db->curs = (TrashCursor **)calloc(dbmeta->slots, sizeof(TrashCursor *));
+    db->curcount = dbmeta->slots;
+    db->curscap = dbmeta->slots;
+
+    db->name = dbmeta->name;
+    db->ownname = NULL;
+    db->flags = dbmeta->flags;
+    db->keywidth = 0;
+    if((dbmeta->flags & TRASH_DB_KEY_MASK) == TRASH_DB_KEY_FIXED)
+        db->keywidth = dbmeta->keywidth;
+    db->ttlsecs = 0;
+    if(dbmeta->flags & TRASH_DB_TTL)
+        db->ttlsecs = dbmeta->ttlsecs;
+    db->ttldbi = 0;
+    db->hash = internal_hash_name(db->name);
+    db->dbid = oEnv->nextDbid++;
+    db->dbi = dbi;
+    db->state = DB_OPEN;
+    db->txncount = 0;
+    pthread_mutex_init(&db->odbMutex, NULL);
+
+    db->cache = NULL;
+    if(dbmeta->flags & TRASH_DB_CACHE)
+        db->cache = internal_cache_create((oEnv->meta.cachebytes > 0) ? oEnv->meta.cachebytes : TRASH_CACHE_BYTES);
+
+    // filled in by internal_bloom_load
+    db->bloom = NULL;
+    if(dbmeta->flags & TRASH_DB_BLOOM)
+        db->bloom = internal_bloom_create((dbmeta->bloomkeys > 0) ? dbmeta->bloomkeys : TRASH_BLOOM_KEYS);
+
+    init_il(&db->moveenv);
+    list_append(&oEnv->dbs, &db->moveenv);
+    internal_registry_add(db);
+
+    return db;
+}
+
+static int internal_add_db_curs(struct OpenDb *db, TrashTxn *tt) {
+    int rc;
+
+    if(tt == NULL || (tt->actions & TRASH_WR_TXN)) {
+        return TRASH_TXN_INVALID;
+    }
+
+    for (size_t i = 0; i < db->curcount; i++) {
+        internal_create_trash_cursor(&db->curs[i], db, READ);
+        rc = mdb_cursor_open(tt->txn, db->dbi, &(db->curs[i])->cur);
+        assert(rc == 0);
+    }
+
+    return TRASH_DB_SUCCESS;
+}
+
+static void internal_add_db_txn(TrashTxn *tt, struct OpenDb *db) {
+    pthread_mutex_lock(&db->odbMutex);
+    db->txncount++;
     pthread_mutex_unlock(&db->odbMutex);
+
+    if(tt->dbscount == tt->dbscap) {
+        tt->dbscap *= 2;
+        tt->dbs = (struct OpenDb **)realloc(tt->dbs, tt->dbscap * sizeof(struct OpenDb *));
+        assert(tt->dbs != NULL);
+
+        free(tt->dbtab);
+        tt->dbtabcap = tt->dbscap * 2;
+        tt->dbtab = (unsigned int *)calloc(tt->dbtabcap, sizeof(unsigned int));
+        assert(tt->dbtab != NULL);
+        for (size_t i = 0; i < tt->dbscount; i++)
+            internal_txn_index_db(tt, i);
+    }
+
+    tt->dbs[tt->dbscount] = db;
+    tt->curdb = tt->dbscount;
+    internal_txn_index_db(tt, tt->dbscount);
+    tt->dbscount++;
+}
+
+/**
+ * @return  index of the db in tt->dbs, dbscount when it is not attached
+ */
+static size_t internal_txn_find_db(TrashTxn *tt, struct OpenDb *db) {
+    size_t mask = tt->dbtabcap - 1;
+    unsigned int idx;
+
+    for (size_t i = db->hash & mask; (idx = tt->dbtab[i]) != 0; i = (i + 1) & mask) {
+        if(tt->dbs[idx - 1] == db)
+            return idx - 1;
+    }
+
+    return tt->dbscount;
+}
+
+static size_t internal_txn_find_name(TrashTxn *tt, const char *dbname) {
+    unsigned int hash = internal_hash_name(dbname);
+    size_t mask = tt->dbtabcap - 1;
+    unsigned int idx;
+
+    for (size_t i = hash & mask; (idx = tt->dbtab[i]) != 0; i = (i + 1) & mask) {
+        struct OpenDb *db = tt->dbs[idx - 1];
+        if(db->hash == hash && strcmp(db->name, dbname) == 0)
+            return idx - 1;
+    }
+
+    return tt->dbscount;
+}
+
+/**
+ * @note    the table is at most half full, so there is always an empty slot
+ */
+static void internal_txn_index_db(TrashTxn *tt, size_t i) {
+    size_t mask = tt->dbtabcap - 1;
+    size_t slot = tt->dbs[i]->hash & mask;
+
+    while(tt->dbtab[slot] != 0)
+        slot = (slot + 1) & mask;
+    tt->dbtab[slot] = (unsigned int)i + 1;
+}
+
+static int internal_begin_txn(TrashTxn **tt, int rdwr) {
+    MDB_txn *txn;
+    unsigned long start, wait;
+    int rc, flags = 0;
+    
+    STATS_CLOCK(start);
+    if(rdwr == TRASH_RD_TXN) {
+        *tt = internal_get_read_txn();
+        if(*tt == NULL) {
+            STATS_ADD(outofrdrs, 1);
+            return TRASH_OUT_OF_READER_SLOTS;
+        }
+        STATS_ADD(rdtxns, 1);
+    } else {
+        // trash_txn already went through the scheduler with a bound on the queue, internal writers just wait
+        internal_sched_acquire(false);
+        internal_txn_enter();
+        // lmdb blocks here on its writer lock
+        STATS_CLOCK(wait);
+        rc = mdb_txn_begin(oEnv->env, NULL, flags, &txn);
+        assert(rc == 0);
+        STATS_SINCE(writerns, wait);
+
+        internal_create_trash_txn(tt, txn, TRASH_WR_TXN);
+        STATS_ADD(wrtxns, 1);
+    }
+    STATS_HIST(TRASH_HIST_BEGIN, start);
+
+    return TRASH_DB_SUCCESS;
+}
+
+/**
+ * Takes a reader from this thread's pool, then from the env budget, then from the idle readers of other threads.
+ * When all of them are empty the thread waits up to EnvMeta.rdrwaitms for a reader to be returned.
+ * 
+ * @return  NULL when no reader is available
+ */
+static TrashTxn *internal_get_read_txn() {
+    struct timespec deadline;
+    TrashTxn *tt = NULL;
+    unsigned int waitms;
+    bool begun = false;
+
+    if(rdrPool == NULL) {
+        // threads without a pool, like the one setting up the env, are counted against the budget and its reserve
+        if(internal_reserve_reader(true) != TRASH_DB_SUCCESS)
+            return NULL;
+        return internal_new_reader();
+    }
+
+    pthread_mutex_lock(&rdrPool->rdrMutex);
+    if(rdrPool->numTxns > 0)
+        tt = rdrPool->txns[--rdrPool->numTxns];
+    pthread_mutex_unlock(&rdrPool->rdrMutex);
+
+    if(tt == NULL && internal_reserve_reader(false) == TRASH_DB_SUCCESS) {
+        tt = internal_new_reader();
+        return (tt != NULL) ? internal_track_reader(tt) : NULL;
+    }
+
+    if(tt == NULL) {
+        tt = internal_steal_reader();
+        if(tt != NULL)
+            STATS_ADD(rdrsteals, 1);
+    }
+
+    waitms = oEnv->meta.rdrwaitms;
+    if(tt == NULL && waitms > 0) {
+        unsigned long start;
+
+        STATS_CLOCK(start);
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += waitms / 1000;
+        deadline.tv_nsec += (long)(waitms % 1000) * 1000000;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+
+        tt = internal_wait_reader(&deadline, &begun);
+        STATS_SINCE(rdrwaitns, start);
+        if(begun)
+            return internal_track_reader(tt);
+    }
+
+    if(tt == NULL)
+        return NULL;
+
+    internal_txn_enter();
+    assert(mdb_txn_renew(tt->txn) == 0);
+
+    return internal_track_reader(tt);
+}
+
+/**
+ * Puts a reader just begun on the active list of this thread's pool
+ */
+static TrashTxn *internal_track_reader(TrashTxn *tt) {
+    tt->beganns = internal_now_ns();
+    tt->snapid = mdb_txn_id(tt->txn);
+    tt->expired = RDR_LIVE;
+    tt->owner = rdrPool;
+
+    pthread_mutex_lock(&rdrPool->rdrMutex);
+    list_append(&rdrPool->active, &tt->rdrlink);
+    pthread_mutex_unlock(&rdrPool->rdrMutex);
+
+    return tt;
+}
+
+/**
+ * Takes a reader off the active list before it is returned, the watchdog can not reach it after that
+ * 
+ * @return  true when the watchdog expired it
+ */
+static bool internal_untrack_reader(TrashTxn *tt) {
+    struct Readers *pool = tt->owner;
+
+    if(pool != NULL) {
+        pthread_mutex_lock(&pool->rdrMutex);
+        item_remove(&tt->rdrlink);
+        pool->active.len--;
+        pthread_mutex_unlock(&pool->rdrMutex);
+        tt->owner = NULL;
+    }
+
+    return __atomic_load_n(&tt->expired, __ATOMIC_ACQUIRE) != RDR_LIVE;
+}
+
+/**
+ * Resets a reader the watchdog expired, on the thread using it
+ * 
+ * @return  true when the txn can not be used anymore
+ */
+static bool internal_reader_expired(TrashTxn *tt) {
+    int state;
+
+    state = __atomic_load_n(&tt->expired, __ATOMIC_ACQUIRE);
+    if(state == RDR_LIVE)
+        return false;
+
+    if(state == RDR_EXPIRED) {
+        mdb_txn_reset(tt->txn);
+        __atomic_store_n(&tt->expired, RDR_RESET, __ATOMIC_RELEASE);
+    }
+
+    return true;
+}
+
+/**
+ * Takes a slot of the budget, a reader begun without a thread pool can take one of the RDR_RESERVE slots as well
+ */
+static int internal_reserve_reader(bool nopool) {
+    unsigned int live, limit;
+
+    limit = oEnv->rdrBudget + (nopool ? RDR_RESERVE : 0);
+    live = __atomic_load_n(&oEnv->rdrsLive, __ATOMIC_RELAXED);
+    do {
+        if(live >= limit)
+            return TRASH_OUT_OF_READER_SLOTS;
+    } while(!__atomic_compare_exchange_n(&oEnv->rdrsLive, &live, live + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    return TRASH_DB_SUCCESS;
+}
+
+static void internal_release_reader() {
+    __atomic_sub_fetch(&oEnv->rdrsLive, 1, __ATOMIC_ACQ_REL);
+}
+
+/**
+ * Begins a new reader against a slot already reserved from the budget
+ * 
+ * @return  NULL when lmdb has no reader left, the slot is given back
+ */
+static TrashTxn *internal_new_reader() {
+    TrashTxn *tt;
+    MDB_txn *txn;
+
+    internal_txn_enter();
+    if(mdb_txn_begin(oEnv->env, NULL, MDB_RDONLY, &txn) != 0) {
+        internal_txn_exit();
+        internal_release_reader();
+        return NULL;
+    }
+    internal_create_trash_txn(&tt, txn, TRASH_RD_TXN);
+    tt->actions |= TRASH_TXN_POOLED;
+
+    return tt;
+}
+
+/**
+ * @note    the calling function needs to hold the poolMutex
+ */
+static TrashTxn *internal_steal_reader_locked() {
+    struct IL *curr;
+    TrashTxn *tt = NULL;
+
+    for_each(&oEnv->pools.head, curr) {
+        struct Readers *pool;
+        pool = CONTAINER_OF(curr, struct Readers, movepool);
+        if(pool == rdrPool)
+            continue;
+
+        pthread_mutex_lock(&pool->rdrMutex);
+        if(pool->numTxns > 0)
+            tt = pool->txns[--pool->numTxns];
+        pthread_mutex_unlock(&pool->rdrMutex);
+
+        if(tt != NULL)
+            break;
+    }
+
+    return tt;
+}
+
+static TrashTxn *internal_steal_reader() {
+    TrashTxn *tt;
+
+    pthread_mutex_lock(&oEnv->poolMutex);
+    tt = internal_steal_reader_locked();
+    pthread_mutex_unlock(&oEnv->poolMutex);
+
+    return tt;
+}
+
+/**
+ * Waits for any thread to return a reader. A slot given back to the budget is begun here,
+ * a reader kept idle by another thread is returned reset.
+ * 
+ * @return  NULL once the deadline passes
+ */
+static TrashTxn *internal_wait_reader(struct timespec *deadline, bool *begun) {
+    TrashTxn *tt = NULL;
+    int rc = 0;
+
+    *begun = false;
+
+    pthread_mutex_lock(&oEnv->poolMutex);
+    __atomic_add_fetch(&oEnv->poolWaiters, 1, __ATOMIC_SEQ_CST);
+    while(rc != ETIMEDOUT) {
+        if(internal_reserve_reader(false) == TRASH_DB_SUCCESS)
+            break;
+
+        tt = internal_steal_reader_locked();
+        if(tt != NULL)
+            break;
+
+        rc = pthread_cond_timedwait(&oEnv->poolCond, &oEnv->poolMutex, deadline);
+    }
+    __atomic_sub_fetch(&oEnv->poolWaiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&oEnv->poolMutex);
+
+    if(tt == NULL && rc != ETIMEDOUT) {
+        tt = internal_new_reader();
+        *begun = (tt != NULL);
+    }
+
+    return tt;
+}
+
+static void internal_create_trash_txn(TrashTxn **tt, MDB_txn *txn, int rdwr) {
+    unsigned int actions = 0;
+
+    if(slab != NULL && slab->numTxns > 0) {
+        // dbs, the db table and the log buffer are kept from the last use
+        *tt = slab->txns[--slab->numTxns];
+    } else {
+        *tt = (TrashTxn *)malloc(sizeof(TrashTxn));
+        assert(*tt);
+
+        // grown by internal_add_db_txn when a txn attaches more dbs
+        (*tt)->dbs = (struct OpenDb **)calloc(TXN_DBS, sizeof(struct OpenDb *));
+        assert((*tt)->dbs);
+        (*tt)->dbscap = TXN_DBS;
+        (*tt)->dbtab = (unsigned int *)calloc(TXN_DBS * 2, sizeof(unsigned int));
+        assert((*tt)->dbtab);
+        (*tt)->dbtabcap = TXN_DBS * 2;
+        (*tt)->log = NULL;
+        (*tt)->saves = NULL;
+        (*tt)->savescap = 0;
+        (*tt)->inval = NULL;
+        (*tt)->blooms = NULL;
+        (*tt)->bloomscap = 0;
+    }
+    (*tt)->numblooms = 0;
+    (*tt)->numsaves = 0;
+    (*tt)->dbscount = 0;
+    (*tt)->curdb = 0;
+
+    (*tt)->txn = txn;
+    (*tt)->cur = NULL;
+    (*tt)->wbytes = 0;
+    (*tt)->owner = NULL;
+    (*tt)->expired = RDR_LIVE;
+    (*tt)->fin_db = internal_fin_db_locked;
+    (*tt)->open_db = internal_get_open_db_locked;
+
+    // assume the tt will always be returned with fin
+    // negate fin if wanting to keep the txn
+    actions = rdwr;
+    if(actions == TRASH_WR_TXN) {
+        actions |= TRASH_TXN_COMMIT;
+    }
+    (*tt)->actions = actions;
+}
+
+/**
+ * Takes the read cursor cached by this thread for the db
+ * 
+ * @return  NULL on a miss
+ */
+static TrashCursor *internal_cached_cursor(struct OpenDb *db) {
+    struct CurCache *slot;
+    TrashCursor *tc;
+
+    if(curCache == NULL)
+        return NULL;
+
+    slot = &curCache[db->dbid & (CUR_CACHE_SLOTS - 1)];
+    if(slot->tc == NULL || slot->db != db || slot->dbid != db->dbid)
+        return NULL;
+
+    tc = slot->tc;
+    slot->tc = NULL;
+    return tc;
+}
+
+/**
+ * Keeps the read cursor in this thread's cache.
+ * A cursor left in the slot by a db that has since been closed is dropped.
+ * 
+ * @return  TRASH_DB_ERROR when the slot is taken by a db that is still open
+ */
+static int internal_cache_cursor(TrashCursor *tc) {
+    struct CurCache *slot;
+    struct OpenDb *db = tc->db;
+    unsigned long closed;
+    int alive;
+
+    if(curCache == NULL)
+        return TRASH_DB_ERROR;
+
+    slot = &curCache[db->dbid & (CUR_CACHE_SLOTS - 1)];
+    if(slot->tc != NULL) {
+        if(slot->db == db && slot->dbid == db->dbid)
+            return TRASH_DB_ERROR;
+
+        // the owner of the slot may be freed, so it can only be looked up by its hash and dbid
+        closed = __atomic_load_n(&oEnv->closedDbs, __ATOMIC_ACQUIRE);
+        if(slot->closed == closed)
+            return TRASH_DB_ERROR;
+
+        alive = internal_db_alive(slot->hash, slot->dbid);
+        if(alive == TRASH_DB_SUCCESS)
+            slot->closed = closed;
+        // the slot is looked at again on a later return when the envLock was busy
+        if(alive != TRASH_DB_DNE)
+            return TRASH_DB_ERROR;
+
+        mdb_cursor_close(slot->tc->cur);
+        free(slot->tc);
+    }
+
+    slot->db = db;
+    slot->dbid = db->dbid;
+    slot->hash = db->hash;
+    slot->closed = __atomic_load_n(&oEnv->closedDbs, __ATOMIC_ACQUIRE);
+    slot->tc = tc;
+
+    return TRASH_DB_SUCCESS;
+}
+
+/**
+ * Looks the db up without waiting on the envLock, a cursor may be returned inside a txn
+ * that a map resize holding the envLock is waiting on.
+ * 
+ * @return  TRASH_DB_DNE when the db was closed, TRASH_WRITE_BUSY when a writer holds the envLock
+ */
+static int internal_db_alive(unsigned int hash, unsigned long dbid) {
+    struct OpenDb *db;
+
+    if(pthread_rwlock_tryrdlock(&oEnv->envLock) != 0)
+        return TRASH_WRITE_BUSY;
+    db = oEnv->dbtable[hash & (oEnv->dbtablecap - 1)];
+    while(db != NULL && db->dbid != dbid)
+        db = db->hnext;
+    pthread_rwlock_unlock(&oEnv->envLock);
+
+    return (db == NULL) ? TRASH_DB_DNE : TRASH_DB_SUCCESS;
+}
+
+/**
+ * Keeps the txn in the slab of this thread, or frees it when the slab is full or the thread has none
+ */
+static void internal_free_trash_txn(TrashTxn *tt) {
+    if(slab == NULL || slab->numTxns == SLAB_OBJS) {
+        internal_destroy_trash_txn(tt);
+        return;
+    }
+
+    if(tt->log != NULL && tt->log->cap > SLAB_LOG_KEEP)
+        internal_log_free(tt);
+    if(tt->log != NULL)
+        tt->log->len = 0;
+
+    slab->txns[slab->numTxns++] = tt;
+}
+
+static void internal_destroy_trash_txn(TrashTxn *tt) {
+    internal_log_free(tt);
+    if(tt->inval != NULL) {
+        free(tt->inval->buf);
+        free(tt->inval);
+    }
+    free(tt->dbs);
+    free(tt->dbtab);
+    free(tt->saves);
+    free(tt->blooms);
+    free(tt);
+}
+
+static void internal_create_trash_cursor(TrashCursor **tc, struct OpenDb *db, enum RWTxn rw) {
+    if(slab != NULL && slab->numCurs > 0) {
+        *tc = slab->curs[--slab->numCurs];
+    } else {
+        *tc = (TrashCursor *)malloc(sizeof(TrashCursor));
+        assert(*tc != NULL);
+    }
+    (*tc)->db = db;
+    (*tc)->rw = rw;
+    (*tc)->txn = NULL;
+}
+
+/**
+ * @note    the lmdb cursor has to be closed already
+ */
+static void internal_free_trash_cursor(TrashCursor *tc) {
+    if(slab == NULL || slab->numCurs == SLAB_OBJS) {
+        free(tc);
+        return;
+    }
+
+    slab->curs[slab->numCurs++] = tc;
+}
+
+/**
+ * Commits the requests through the group commit pipeline, or in this thread when it is not running
+ * 
+ * @return  rc of the first request that failed
+ */
+static int internal_submit_reqs(struct CommitReq *reqs, size_t numreqs) {
+    struct GroupCommit *gc = gCommit;
+    struct LL list;
+    size_t waiting;
+    int rc = 0;
+
+    if(gc == NULL) {
+        init_list(&list);
+        for (size_t i = 0; i < numreqs; i++)
+            list_append(&list, &reqs[i].movequeue);
+        internal_commit_reqs(&list);
+    } else {
+        pthread_mutex_lock(&gc->gcMutex);
+        for (size_t i = 0; i < numreqs; i++) {
+            list_append(&gc->queue, &reqs[i].movequeue);
+            gc->queuedops += reqs[i].numops;
+        }
+        pthread_cond_signal(&gc->gcCond);
+
+        do {
+            waiting = 0;
+            for (size_t i = 0; i < numreqs; i++)
+                waiting += !reqs[i].done;
+            if(waiting > 0)
+                pthread_cond_wait(&gc->doneCond, &gc->gcMutex);
+        } while(waiting > 0);
+        pthread_mutex_unlock(&gc->gcMutex);
+    }
+
+    for (size_t i = 0; i < numreqs && rc == 0; i++)
+        rc = reqs[i].rc;
+
+    return rc;
+}
+
+/**
+ * Takes up to TRASH_ASYNC_BATCH requests at a time, the reads of a batch share one read txn
+ * and the writes of a batch are committed together.
+ */
+static void *internal_async_worker(void *arg) {
+    struct AsyncPool *ap = (struct AsyncPool *)arg;
+    struct TrashReq *batch[TRASH_ASYNC_BATCH];
+    struct TrashReq *reads[TRASH_ASYNC_BATCH];
+    struct TrashReq *writes[TRASH_ASYNC_BATCH];
+    size_t n, numreads, numwrites;
+
+    init_thread_local_readers(ap->numrdrs);
+
+    pthread_mutex_lock(&ap->asyncMutex);
+    for(;;) {
+        while(ap->running && ap->head == NULL)
+            pthread_cond_wait(&ap->asyncCond, &ap->asyncMutex);
+
+        if(ap->head == NULL)
+            break;
+
+        n = 0;
+        while(n < TRASH_ASYNC_BATCH && ap->head != NULL) {
+            batch[n++] = ap->head;
+            ap->head = ap->head->next;
+        }
+        if(ap->head == NULL)
+            ap->tail = NULL;
+        pthread_mutex_unlock(&ap->asyncMutex);
+
+        numreads = 0;
+        numwrites = 0;
+        for (size_t i = 0; i < n; i++) {
+            batch[i]->next = NULL;
+            if(batch[i]->op.op & (TRASH_OP_GET | TRASH_OP_SCAN)) {
+                reads[numreads++] = batch[i];
+            } else {
+                writes[numwrites++] = batch[i];
+            }
+        }
+
+        if(numreads > 0)
+            internal_async_reads(reads, numreads);
+        if(numwrites > 0)
+            internal_async_writes(writes, numwrites);
+
+        internal_async_complete(ap, reads, numreads);
+        internal_async_complete(ap, writes, numwrites);
+
+        pthread_mutex_lock(&ap->asyncMutex);
+    }
+    pthread_mutex_unlock(&ap->asyncMutex);
+
+    clean_thread_local_readers();
+    return NULL;
+}
+
+/**
+ * A txn that can not be begun or has expired only fails the request it was taken for, the next one begins another
+ */
+static void internal_async_reads(struct TrashReq **reqs, size_t numreqs) {
+    TrashTxn *tt = NULL;
+
+    for (size_t i = 0; i < numreqs; i++) {
+        struct TrashReq *req = reqs[i];
+
+        if(tt == NULL && (req->rc = internal_begin_txn(&tt, TRASH_RD_TXN)) != TRASH_DB_SUCCESS) {
+            tt = NULL;
+            continue;
+        }
+
+        // switching back to a db already in the txn is a table lookup
+        req->rc = change_txn_handle(tt, req->op.db);
+        if(req->rc != TRASH_DB_SUCCESS)
+            continue;
+
+        if(req->op.op == TRASH_OP_GET) {
+            req->rc = internal_async_get(tt, req);
+        } else {
+            req->rc = internal_async_scan(tt, req);
+        }
+
+        if(req->rc == TRASH_TXN_INVALID) {
+            return_txn(tt);
+            tt = NULL;
+        }
+    }
+
+    if(tt != NULL)
+        return_txn(tt);
+}
+
+static void internal_async_writes(struct TrashReq **reqs, size_t numreqs) {
+    struct CommitReq creqs[TRASH_ASYNC_BATCH];
+
+    for (size_t i = 0; i < numreqs; i++) {
+        init_il(&creqs[i].movequeue);
+        creqs[i].ops = &reqs[i]->op;
+        creqs[i].numops = 1;
+        creqs[i].rc = 0;
+        creqs[i].done = 0;
+    }
+
+    internal_submit_reqs(creqs, numreqs);
+
+    for (size_t i = 0; i < numreqs; i++)
+        reqs[i]->rc = creqs[i].rc;
+}
+
+static int internal_async_get(TrashTxn *tt, struct TrashReq *req) {
+    MDB_val val;
+    int rc;
+
+    rc = trash_get(tt, &req->op.key, &val);
+    if(rc != 0)
+        return rc;
+
+    // the value is only valid until the txn is returned
+    req->res = malloc(val.mv_size > 0 ? val.mv_size : 1);
+    assert(req->res != NULL);
+    memcpy(req->res, val.mv_data, val.mv_size);
+    req->val.mv_data = req->res;
+    req->val.mv_size = val.mv_size;
+
+    return 0;
+}
+
+/**
+ * Copies the keys and values of the scan into one block, the arrays first and the data after them
+ */
+static int internal_async_scan(TrashTxn *tt, struct TrashReq *req) {
+    TrashIter *it;
+    MDB_val *pairs = NULL;
+    MDB_val key, val;
+    size_t count = 0, cap = 0, bytes = 0;
+    char *data;
+    int rc;
+
+    rc = trash_iter(&it, tt, (req->op.key.mv_data != NULL) ? &req->op.key : NULL,
+        (req->hi.mv_data != NULL) ? &req->hi : NULL, req->op.flags, req->limit);
+    if(rc != TRASH_DB_SUCCESS)
+        return rc;
+
+    while(trash_iter_next(it, &key, &val) == 0) {
+        if(count == cap) {
+            cap = (cap == 0) ? 16 : cap * 2;
+            pairs = (MDB_val *)realloc(pairs, cap * 2 * sizeof(MDB_val));
+            assert(pairs != NULL);
+        }
+        pairs[count * 2] = key;
+        pairs[count * 2 + 1] = val;
+        bytes += key.mv_size + val.mv_size;
+        count++;
+    }
+
+    req->res = malloc(count * 2 * sizeof(MDB_val) + bytes + 1);
+    assert(req->res != NULL);
+    req->keys = (MDB_val *)req->res;
+    req->vals = req->keys + count;
+    req->count = count;
+
+    data = (char *)(req->vals + count);
+    for (size_t i = 0; i < count; i++) {
+        for (size_t j = 0; j < 2; j++) {
+            MDB_val *dst = (j == 0) ? &req->keys[i] : &req->vals[i];
+            MDB_val *src = &pairs[i * 2 + j];
+
+            memcpy(data, src->mv_data, src->mv_size);
+            dst->mv_data = data;
+            dst->mv_size = src->mv_size;
+            data += src->mv_size;
+        }
+    }
+
+    return_iter(it);
+    free(pairs);
+
+    return 0;
+}
+
+static void internal_async_complete(struct AsyncPool *ap, struct TrashReq **reqs, size_t numreqs) {
+    struct TrashReq *head = NULL, *tail = NULL;
+    uint64_t one = 1;
+
+    for (size_t i = 0; i < numreqs; i++) {
+        struct TrashReq *req = reqs[i];
+
+        if(req->done != NULL) {
+            req->done(req);
+            continue;
+        }
+
+        if(tail == NULL) {
+            head = req;
+        } else {
+            tail->next = req;
+        }
+        tail = req;
+    }
+
+    if(head == NULL)
+        return;
+
+    pthread_mutex_lock(&ap->doneMutex);
+    if(ap->donetail == NULL) {
+        ap->donehead = head;
+    } else {
+        ap->donetail->next = head;
+    }
+    ap->donetail = tail;
+    // only fails when the counter would overflow, it is reset by every reap that empties the list
+    assert(write(ap->efd, &one, sizeof(one)) == sizeof(one));
+    pthread_mutex_unlock(&ap->doneMutex);
+}
+
+/**
+ * @return  counter block of this thread, taken on first use
+ */
+static struct CounterBuf *internal_counters() {
+    struct IL *curr;
+    struct CounterBuf *cb = NULL;
+
+    if(tCounters != NULL)
+        return tCounters;
+
+    pthread_mutex_lock(&counterMutex);
+    if(counterBlocks.head.next == NULL)
+        init_list(&counterBlocks);
+
+    // reuse a block left by a thread that cleaned up, its deltas are flushed with this thread's
+    for_each(&counterBlocks.head, curr) {
+        struct CounterBuf *left;
+        left = CONTAINER_OF(curr, struct CounterBuf, movecounters);
+        if(!left->inuse) {
+            cb = left;
+            break;
+        }
+    }
+
+    if(cb == NULL) {
+        cb = (struct CounterBuf *)calloc(1, sizeof(struct CounterBuf));
+        assert(cb != NULL);
+        pthread_mutex_init(&cb->mutex, NULL);
+        init_il(&cb->movecounters);
+        list_append(&counterBlocks, &cb->movecounters);
+    }
+    cb->inuse = true;
+    pthread_mutex_unlock(&counterMutex);
+
+    tCounters = cb;
+    return cb;
+}
+
+static void internal_counters_release() {
+    if(tCounters == NULL)
+        return;
+
+    pthread_mutex_lock(&counterMutex);
+    tCounters->inuse = false;
+    pthread_mutex_unlock(&counterMutex);
+    tCounters = NULL;
+}
+
+static struct CounterEntry *internal_counter_find(struct CounterTable *tab, unsigned long dbid, MDB_val *key, unsigned int hash) {
+    struct CounterEntry *e;
+
+    if(tab->cap == 0)
+        return NULL;
+
+    for (e = tab->buckets[hash & (tab->cap - 1)]; e != NULL; e = e->next) {
+        if(e->hash == hash && e->dbid == dbid && e->size == key->mv_size && memcmp(e->key, key->mv_data, e->size) == 0)
+            return e;
+    }
+
+    return NULL;
+}
+
+static void internal_counter_insert(struct CounterTable *tab, struct CounterEntry *e) {
+    if(tab->count >= tab->cap) {
+        struct CounterEntry **old = tab->buckets;
+        size_t oldcap = tab->cap;
+
+        tab->cap = (oldcap == 0) ? COUNTER_TABLE_MIN : oldcap * 2;
+        tab->buckets = (struct CounterEntry **)calloc(tab->cap, sizeof(struct CounterEntry *));
+        assert(tab->buckets != NULL);
+
+        for (size_t i = 0; i < oldcap; i++) {
+            while(old[i] != NULL) {
+                struct CounterEntry *moved = old[i];
+                old[i] = moved->next;
+                moved->next = tab->buckets[moved->hash & (tab->cap - 1)];
+                tab->buckets[moved->hash & (tab->cap - 1)] = moved;
+            }
+        }
+        free(old);
+    }
+
+    e->next = tab->buckets[e->hash & (tab->cap - 1)];
+    tab->buckets[e->hash & (tab->cap - 1)] = e;
+    tab->count++;
+}
+
+static void internal_counter_merge(struct CounterTable *tab, struct OpenDb *db, MDB_val *key, unsigned int hash, int64_t delta) {
+    struct CounterEntry *e;
+
+    e = internal_counter_find(tab, db->dbid, key, hash);
+    if(e != NULL) {
+        e->delta = (int64_t)((uint64_t)e->delta + (uint64_t)delta);
+        return;
+    }
+
+    e = (struct CounterEntry *)malloc(sizeof(struct CounterEntry) + key->mv_size);
+    assert(e != NULL);
+    e->dbid = db->dbid;
+    e->dbhash = db->hash;
+    e->hash = hash;
+    e->delta = delta;
+    e->size = key->mv_size;
+    memcpy(e->key, key->mv_data, key->mv_size);
+
+    internal_counter_insert(tab, e);
+}
+
+/**
+ * Moves the entries of src into dst, adding up the deltas of keys in both
+ */
+static void internal_counter_drain(struct CounterTable *dst, struct CounterTable *src) {
+    for (size_t i = 0; i < src->cap; i++) {
+        while(src->buckets[i] != NULL) {
+            struct CounterEntry *e = src->buckets[i], *same;
+            MDB_val key;
+
+            src->buckets[i] = e->next;
+            key.mv_data = e->key;
+            key.mv_size = e->size;
+
+            same = internal_counter_find(dst, e->dbid, &key, e->hash);
+            if(same != NULL) {
+                same->delta = (int64_t)((uint64_t)same->delta + (uint64_t)e->delta);
+                free(e);
+            } else {
+                internal_counter_insert(dst, e);
+            }
+        }
+    }
+
+    free(src->buckets);
+    memset(src, 0, sizeof(struct CounterTable));
+}
+
+static void internal_counter_clear(struct CounterTable *tab) {
+    for (size_t i = 0; i < tab->cap; i++) {
+        while(tab->buckets[i] != NULL) {
+            struct CounterEntry *e = tab->buckets[i];
+            tab->buckets[i] = e->next;
+            free(e);
+        }
+    }
+
+    free(tab->buckets);
+    memset(tab, 0, sizeof(struct CounterTable));
+}
+
+/**
+ * Switches the txn to the db of the entry, it is attached under the envLock so it can not be freed in between
+ * 
+ * @return  TRASH_DB_DNE when the db was closed
+ */
+static int internal_counter_attach(TrashTxn *tt, struct CounterEntry *e) {
+    struct OpenDb *db;
+
+    if(tt->dbscount > 0 && tt->dbs[tt->curdb]->dbid == e->dbid)
+        return TRASH_DB_SUCCESS;
+
+    internal_env_rdlock();
+    db = oEnv->dbtable[e->dbhash & (oEnv->dbtablecap - 1)];
+    while(db != NULL && db->dbid != e->dbid)
+        db = db->hnext;
+    if(db != NULL && db->state == DB_CLOSE)
+        db = NULL;
+    if(db != NULL)
+        change_txn_handle(tt, db);
+    pthread_rwlock_unlock(&oEnv->envLock);
+
+    return (db == NULL) ? TRASH_DB_DNE : TRASH_DB_SUCCESS;
+}
+
+static void *internal_counter_flusher(void *arg) {
+    struct CounterFlusher *cf = (struct CounterFlusher *)arg;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&cf->mutex);
+    while(cf->running) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long)(cf->flushms % 1000) * 1000000;
+        deadline.tv_sec += cf->flushms / 1000 + deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+        while(cf->running) {
+            if(pthread_cond_timedwait(&cf->cond, &cf->mutex, &deadline) == ETIMEDOUT)
+                break;
+        }
+        pthread_mutex_unlock(&cf->mutex);
+
+        trash_counter_flush();
+
+        pthread_mutex_lock(&cf->mutex);
+    }
+    pthread_mutex_unlock(&cf->mutex);
+
+    internal_stats_release();
+
+    return NULL;
+}
+
+static uint64_t internal_wall_ms() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/**
+ * @return  expiry of a key put now without one, 0 for dbs without a ttl
+ */
+static uint64_t internal_ttl_expiry(struct OpenDb *db) {
+    if(!(db->flags & TRASH_DB_TTL) || db->ttlsecs == 0)
+        return 0;
+
+    return internal_wall_ms() + (uint64_t)db->ttlsecs * 1000;
+}
+
+/**
+ * Strips the expiry off a value of a TRASH_DB_TTL db
+ * 
+ * @return  false when the value has expired
+ */
+static bool internal_ttl_live(MDB_val *val, uint64_t now) {
+    uint64_t expiry;
+
+    if(val->mv_size < TTL_PREFIX)
+        return false;
+
+    memcpy(&expiry, val->mv_data, sizeof(expiry));
+    val->mv_data = (char *)val->mv_data + TTL_PREFIX;
+    val->mv_size -= TTL_PREFIX;
+
+    return expiry == 0 || expiry > now;
+}
+
+static void internal_ttl_index_key(MDB_val *ikey, unsigned char *buf, MDB_val *key, uint64_t expiry) {
+    for (size_t i = 0; i < TTL_PREFIX; i++)
+        buf[i] = (unsigned char)(expiry >> ((TTL_PREFIX - 1 - i) * 8));
+    memcpy(buf + TTL_PREFIX, key->mv_data, key->mv_size);
+
+    ikey->mv_data = buf;
+    ikey->mv_size = TTL_PREFIX + key->mv_size;
+}
+
+/**
+ * Puts the value behind its expiry with MDB_RESERVE, through cur when it is set, and indexes the key by the expiry.
+ * stored is set to the value as it is in the db.
+ * 
+ * @note    the old index entry of a key written again is left for the reaper, it only deletes keys whose expiry still matches
+ */
+static int internal_ttl_put(MDB_txn *txn, MDB_cursor *cur, struct OpenDb *db, MDB_val *key, MDB_val *val, unsigned int flags, uint64_t expiry, MDB_val *stored) {
+    unsigned char ibuf[TTL_KEY_MAX];
+    MDB_val ikey, empty, curkey, data;
+    int rc;
+
+    // MDB_CURRENT writes the key the cursor is on
+    curkey = *key;
+    if(cur != NULL && (flags & MDB_CURRENT))
+        mdb_cursor_get(cur, &curkey, &data, MDB_GET_CURRENT);
+
+    // an index key lmdb would refuse is caught before the value goes in without it
+    if(expiry != 0 && (curkey.mv_size + TTL_PREFIX > sizeof(ibuf)
+            || curkey.mv_size + TTL_PREFIX > (size_t)mdb_env_get_maxkeysize(mdb_txn_env(txn))))
+        return TRASH_DB_ERROR;
+
+    stored->mv_size = val->mv_size + TTL_PREFIX;
+    if(cur != NULL) {
+        rc = mdb_cursor_put(cur, key, stored, flags | MDB_RESERVE);
+    } else {
+        rc = mdb_put(txn, db->dbi, key, stored, flags | MDB_RESERVE);
+    }
+
+    // an expired key the reaper has not got to yet does not stop MDB_NOOVERWRITE, stored is set to it
+    if(rc == MDB_KEYEXIST && !internal_ttl_live(stored, internal_wall_ms())) {
+        stored->mv_size = val->mv_size + TTL_PREFIX;
+        if(cur != NULL) {
+            rc = mdb_cursor_put(cur, key, stored, (flags & ~MDB_NOOVERWRITE) | MDB_RESERVE);
+        } else {
+            rc = mdb_put(txn, db->dbi, key, stored, (flags & ~MDB_NOOVERWRITE) | MDB_RESERVE);
+        }
+    }
+    if(rc != 0)
+        return rc;
+
+    memcpy(stored->mv_data, &expiry, sizeof(expiry));
+    if(flags & MDB_RESERVE) {
+        val->mv_data = (char *)stored->mv_data + TTL_PREFIX;
+    } else {
+        memcpy((char *)stored->mv_data + TTL_PREFIX, val->mv_data, val->mv_size);
+    }
+
+    if(expiry == 0)
+        return 0;
+
+    internal_ttl_index_key(&ikey, ibuf, &curkey, expiry);
+    empty.mv_size = 0;
+    empty.mv_data = NULL;
+
+    return mdb_put(txn, db->ttldbi, &ikey, &empty, 0);
+}
+
+/**
+ * Logs a put of internal_ttl_put so it is replayed with its expiry when the map grows
+ */
+static void internal_ttl_log(TrashTxn *tt, struct OpenDb *db, MDB_val *key, MDB_val *stored, unsigned int flags) {
+    unsigned char ibuf[TTL_KEY_MAX];
+    MDB_val ikey, empty;
+    uint64_t expiry;
+
+    // the put went through, an expired key it replaced must not stop the replay
+    internal_log_put(tt, db->dbi, key, stored, flags & ~MDB_NOOVERWRITE);
+
+    memcpy(&expiry, stored->mv_data, sizeof(expiry));
+    if(expiry == 0)
+        return;
+
+    internal_ttl_index_key(&ikey, ibuf, key, expiry);
+    empty.mv_size = 0;
+    empty.mv_data = NULL;
+    internal_log_put(tt, db->ttldbi, &ikey, &empty, 0);
+}
+
+/**
+ * Deletes the keys whose expiry is before now, walking the index from the oldest expiry.
+ * At most max index entries are removed, visited is set to how many were and deleted to the keys deleted with them.
+ */
+static int internal_ttl_reap(TrashTxn *tt, struct OpenDb *db, uint64_t now, size_t max, size_t *visited, size_t *deleted) {
+    MDB_cursor *cur;
+    MDB_val ikey, ival, key, val;
+    unsigned char kbuf[TTL_KEY_MAX];
+    uint64_t expiry, stored;
+    size_t n = 0, dels = 0;
+    int rc;
+
+    *visited = 0;
+    *deleted = 0;
+    rc = mdb_cursor_open(tt->txn, db->ttldbi, &cur);
+    if(rc != 0)
+        return rc;
+
+    rc = mdb_cursor_get(cur, &ikey, &ival, MDB_FIRST);
+    while(rc == 0 && n < max) {
+        if(ikey.mv_size < TTL_PREFIX || ikey.mv_size > sizeof(kbuf))
+            break;
+
+        expiry = 0;
+        for (size_t i = 0; i < TTL_PREFIX; i++)
+            expiry = (expiry << 8) | ((unsigned char *)ikey.mv_data)[i];
+        if(expiry > now)
+            break;
+
+        // the index page can move once the db is written to
+        memcpy(kbuf, ikey.mv_data, ikey.mv_size);
+        key.mv_data = kbuf + TTL_PREFIX;
+        key.mv_size = ikey.mv_size - TTL_PREFIX;
+
+        // the key may have been written again since, with another expiry or none
+        if(mdb_get(tt->txn, db->dbi, &key, &val) == 0 && val.mv_size >= TTL_PREFIX) {
+            memcpy(&stored, val.mv_data, sizeof(stored));
+            if(stored == expiry) {
+                rc = mdb_del(tt->txn, db->dbi, &key, NULL);
+                if(rc != 0)
+                    break;
+                dels++;
+            }
+        }
+
+        rc = mdb_cursor_del(cur, 0);
+        if(rc != 0)
+            break;
+        n++;
+
+        // a bulk reaper commits its chunk like trash_put, the deleted entries are gone so it goes on from the first
+        if(internal_sched_due(tt)) {
+            mdb_cursor_close(cur);
+            cur = NULL;
+            rc = internal_sched_chunk(tt);
+            if(rc != 0)
+                break;
+            rc = mdb_cursor_open(tt->txn, db->ttldbi, &cur);
+            if(rc != 0) {
+                cur = NULL;
+                break;
+            }
+            rc = mdb_cursor_get(cur, &ikey, &ival, MDB_FIRST);
+            continue;
+        }
+
+        rc = mdb_cursor_get(cur, &ikey, &ival, MDB_NEXT);
+    }
+    if(cur != NULL)
+        mdb_cursor_close(cur);
+
+    if(rc != 0 && rc != MDB_NOTFOUND) {
+        tt->actions &= ~TRASH_TXN_COMMIT;
+        return rc;
+    }
+
+    if(n > 0)
+        tt->actions |= TRASH_TXN_COMMIT;
+    *visited = n;
+    *deleted = dels;
+
+    return 0;
+}
+
+/**
+ * Same order as an lmdb db without a comparator
+ */
+static int internal_shard_cmp(const MDB_val *a, const MDB_val *b) {
+    size_t len = (a->mv_size < b->mv_size) ? a->mv_size : b->mv_size;
+    int diff;
+
+    diff = memcmp(a->mv_data, b->mv_data, len);
+    if(diff != 0)
+        return diff;
+
+    return (a->mv_size < b->mv_size) ? -1 : (a->mv_size > b->mv_size);
+}
+
+static int internal_shard_open(struct ShardSet *ss, unsigned int i, struct TrashShardMeta *meta) {
+    struct Shard *sh = &ss->shards[i];
+    struct ShardLayout layout, prev, *stored;
+    struct EnvMeta em;
+    struct stat st;
+    MDB_dbi layoutdbi;
+    MDB_txn *txn;
+    MDB_val key, val;
+    char path[512];
+    int rc;
+
+    snprintf(path, sizeof(path), SHARD_DIR_FORMAT, DB_DIR, meta->name, i);
+    if(stat(path, &st) < 0 && trash_mkdir(path, strlen(path), 0755) != 0)
+        return TRASH_DB_ERROR;
+
+    memset(&em, 0, sizeof(em));
+    em.durability = meta->durability;
+
+    if(mdb_env_create(&sh->env) != 0) {
+        sh->env = NULL;
+        return TRASH_DB_ERROR;
+    }
+    if(internal_set_env_fields(sh->env, (meta->dbsize == 0) ? TRASH_DB_SIZE : meta->dbsize, 2,
+            (meta->numrdrs == 0) ? TRASH_MAX_READERS : meta->numrdrs) != TRASH_DB_SUCCESS
+            || mdb_env_open(sh->env, path, internal_env_flags(&em), 0664) != 0) {
+        mdb_env_close(sh->env);
+        sh->env = NULL;
+        return TRASH_DB_ERROR;
+    }
+
+    // the layout is written with the shard so a reopen with another one can not misroute keys
+    memset(&layout, 0, sizeof(layout));
+    layout.mode = ss->mode;
+    layout.numshards = ss->numshards;
+    layout.index = i;
+    layout.splithash = ss->splithash;
+
+    if(mdb_txn_begin(sh->env, NULL, 0, &txn) != 0)
+        return TRASH_DB_ERROR;
+
+    rc = mdb_dbi_open(txn, SHARD_DATA, MDB_CREATE, &sh->dbi);
+    if(rc == 0)
+        rc = mdb_dbi_open(txn, SHARD_LAYOUT, MDB_CREATE, &layoutdbi);
+    if(rc == 0) {
+        key.mv_data = SHARD_LAYOUT;
+        key.mv_size = sizeof(SHARD_LAYOUT) - 1;
+        rc = mdb_get(txn, layoutdbi, &key, &val);
+        if(rc == MDB_NOTFOUND) {
+            val.mv_data = &layout;
+            val.mv_size = sizeof(layout);
+            rc = mdb_put(txn, layoutdbi, &key, &val, 0);
+        } else if(rc == 0) {
+            // lmdb only aligns values to 2 bytes
+            if(val.mv_size != sizeof(layout)) {
+                rc = TRASH_DB_ERROR;
+            } else {
+                stored = (struct ShardLayout *)memcpy(&prev, val.mv_data, sizeof(prev));
+                if(stored->mode != layout.mode || stored->numshards != layout.numshards
+                        || stored->index != layout.index || stored->splithash != layout.splithash)
+                    rc = TRASH_DB_ERROR;
+            }
+        }
+    }
+
+    if(rc != 0) {
+        mdb_txn_abort(txn);
+        return TRASH_DB_ERROR;
+    }
+
+    return (mdb_txn_commit(txn) == 0) ? TRASH_DB_SUCCESS : TRASH_DB_ERROR;
+}
+
+/**
+ * The txn of the shard, a reader is begun on first use
+ */
+static int internal_shard_txn(struct ShardTxn *st, unsigned int i, MDB_txn **txn) {
+    int rc;
+
+    if(st->txns[i] == NULL) {
+        rc = mdb_txn_begin(st->ss->shards[i].env, NULL, MDB_RDONLY, &st->txns[i]);
+        if(rc != 0) {
+            st->txns[i] = NULL;
+            return rc;
+        }
+    }
+
+    *txn = st->txns[i];
+    return 0;
+}
+
+/**
+ * Binds the write txn to the shard of its first write, a reader already begun on that shard is replaced
+ */
+static int internal_shard_wrtxn(struct ShardTxn *st, MDB_val *key, MDB_txn **txn, MDB_dbi *dbi) {
+    unsigned int i;
+    int rc;
+
+    if(st->rd != TRASH_WR_TXN)
+        return TRASH_TXN_INVALID;
+
+    i = trash_shard_of(st->ss, key);
+    if(st->wrshard < 0) {
+        if(st->txns[i] != NULL) {
+            mdb_txn_abort(st->txns[i]);
+            st->txns[i] = NULL;
+        }
+
+        rc = mdb_txn_begin(st->ss->shards[i].env, NULL, 0, &st->txns[i]);
+        if(rc != 0) {
+            st->txns[i] = NULL;
+            return rc;
+        }
+        st->wrshard = (int)i;
+    } else if((unsigned int)st->wrshard != i) {
+        return TRASH_DB_ERROR;
+    }
+
+    *txn = st->txns[i];
+    *dbi = st->ss->shards[i].dbi;
+    return 0;
+}
+
+static bool internal_shard_in_range(struct ShardIter *it, MDB_val *key) {
+    int diff;
+
+    if(it->hi.mv_data == NULL)
+        return true;
+
+    diff = internal_shard_cmp(key, &it->hi);
+    return (diff < 0) || (diff == 0 && (it->flags & TRASH_ITER_HI_INCL));
+}
+
+static void internal_shard_sift(struct ShardIter *it, unsigned int i) {
+    unsigned int least, l, r, tmp;
+
+    for(;;) {
+        least = i;
+        l = 2 * i + 1;
+        r = l + 1;
+        if(l < it->heaplen && internal_shard_cmp(&it->keys[it->heap[l]], &it->keys[it->heap[least]]) < 0)
+            least = l;
+        if(r < it->heaplen && internal_shard_cmp(&it->keys[it->heap[r]], &it->keys[it->heap[least]]) < 0)
+            least = r;
+        if(least == i)
+            return;
+
+        tmp = it->heap[i];
+        it->heap[i] = it->heap[least];
+        it->heap[least] = tmp;
+        i = least;
+    }
+}
+
+static void *internal_watchdog(void *arg) {
+    struct Watchdog *wd = (struct Watchdog *)arg;
+    struct TrashReaders rdrs;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&wd->mutex);
+    while(wd->running) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long)(wd->intervalms % 1000) * 1000000;
+        deadline.tv_sec += wd->intervalms / 1000 + deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+        while(wd->running) {
+            if(pthread_cond_timedwait(&wd->cond, &wd->mutex, &deadline) == ETIMEDOUT)
+                break;
+        }
+        if(!wd->running)
+            break;
+        pthread_mutex_unlock(&wd->mutex);
+
+        if(trash_check_readers(&rdrs, wd->expirems) == TRASH_DB_SUCCESS && wd->report != NULL)
+            wd->report(&rdrs);
+
+        pthread_mutex_lock(&wd->mutex);
+    }
+    pthread_mutex_unlock(&wd->mutex);
+
+    internal_stats_release();
+
+    return NULL;
+}
+
+/**
+ * Waits until no writer holds the scheduler and none of a higher class waits
+ * 
+ * @return  TRASH_WRITE_BUSY when bounded and the queue is full
+ */
+static int internal_sched_acquire(bool bounded) {
+    struct WriteSched *ws = gSched;
+    bool ahead;
+
+    if(ws == NULL || wrHeld)
+        return TRASH_DB_SUCCESS;
+
+    pthread_mutex_lock(&ws->mutex);
+    if(bounded && ws->numwaiting >= ws->maxqueue) {
+        pthread_mutex_unlock(&ws->mutex);
+        STATS_ADD(wrbusy, 1);
+        return TRASH_WRITE_BUSY;
+    }
+
+    ws->waiting[wrPrio]++;
+    ws->numwaiting++;
+    for(;;) {
+        ahead = false;
+        for (unsigned int p = 0; p < wrPrio; p++)
+            ahead = ahead || ws->waiting[p] > 0;
+        if(!ws->held && !ahead)
+            break;
+        pthread_cond_wait(&ws->cond, &ws->mutex);
+    }
+    ws->waiting[wrPrio]--;
+    ws->numwaiting--;
+    ws->held = 1;
+    pthread_mutex_unlock(&ws->mutex);
+
+    wrHeld = 1;
+    wrSince = internal_now_ns();
+    wrOps = 0;
+
+    return TRASH_DB_SUCCESS;
+}
+
+static void internal_sched_release() {
+    struct WriteSched *ws = gSched;
+
+    if(!wrHeld)
+        return;
+
+    wrHeld = 0;
+    if(ws == NULL)
+        return;
+
+    pthread_mutex_lock(&ws->mutex);
+    ws->held = 0;
+    if(ws->numwaiting > 0)
+        pthread_cond_broadcast(&ws->cond);
+    pthread_mutex_unlock(&ws->mutex);
+}
+
+/**
+ * Counts one write of a bulk txn
+ * 
+ * @return  true when the chunk is due to be committed with internal_sched_chunk
+ */
+static bool internal_sched_due(TrashTxn *tt) {
+    struct WriteSched *ws = gSched;
+    bool due;
+
+    if(ws == NULL || !wrHeld || wrPrio != TRASH_PRIO_BULK || tt->numsaves > 0 || (tt->actions & TRASH_TXN_NOREPLAY))
+        return false;
+
+    due = ++wrOps > ws->chunkops;
+    if(!due && internal_now_ns() - wrSince >= ws->maxholdns)
+        due = __atomic_load_n(&ws->numwaiting, __ATOMIC_RELAXED) > 0;
+
+    return due;
+}
+
+/**
+ * Commits the writes of a bulk txn so far and begins it again behind the writers waiting.
+ * Cursors of the txn have to be closed first.
+ * 
+ * @return  the lmdb error of the commit, the writes of the chunk are lost and the txn goes on empty
+ */
+static int internal_sched_chunk(TrashTxn *tt) {
+    size_t txnid;
+    int rc;
+
+    txnid = mdb_txn_id(tt->txn);
+    internal_cache_inval_begin(tt);
+    rc = mdb_txn_commit(tt->txn);
+    if(rc == 0)
+        internal_txn_committed(txnid, tt->wbytes);
+    internal_cache_inval_end(tt, (rc == 0) ? txnid : 0);
+    internal_bloom_txn_end(tt, rc == 0);
+    internal_txn_exit();
+    STATS_ADD(wrchunks, 1);
+
+    internal_sched_release();
+    internal_sched_acquire(false);
+
+    internal_txn_enter();
+    assert(mdb_txn_begin(oEnv->env, NULL, 0, &tt->txn) == 0);
+    tt->actions &= ~TRASH_TXN_COMMIT;
+    tt->wbytes = 0;
+    if(tt->log != NULL)
+        tt->log->len = 0;
+    // this put is the first of the new chunk
+    wrOps = 1;
+
+    return rc;
+}
+
+static void *internal_reaper(void *arg) {
+    struct Reaper *rp = (struct Reaper *)arg;
+    struct timespec deadline;
+    struct IL *curr;
+    char **names;
+    size_t numnames, cap;
+
+    // reaping can always wait for the writers in front of it
+    trash_write_priority(TRASH_PRIO_BULK);
+
+    pthread_mutex_lock(&rp->mutex);
+    while(rp->running) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long)(rp->intervalms % 1000) * 1000000;
+        deadline.tv_sec += rp->intervalms / 1000 + deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+        while(rp->running) {
+            if(pthread_cond_timedwait(&rp->cond, &rp->mutex, &deadline) == ETIMEDOUT)
+                break;
+        }
+        if(!rp->running)
+            break;
+        pthread_mutex_unlock(&rp->mutex);
+
+        // the names are copied so no lock is held while reaping, a db closed since is skipped by trash_txn
+        names = NULL;
+        numnames = cap = 0;
+        internal_env_rdlock();
+        for_each(&oEnv->dbs.head, curr) {
+            struct OpenDb *db = CONTAINER_OF(curr, struct OpenDb, moveenv);
+
+            if(!(db->flags & TRASH_DB_TTL) || db->state != DB_OPEN)
+                continue;
+
+            if(numnames == cap) {
+                cap = (cap == 0) ? 8 : cap * 2;
+                names = (char **)realloc(names, cap * sizeof(char *));
+                assert(names != NULL);
+            }
+            names[numnames] = strdup(db->name);
+            assert(names[numnames] != NULL);
+            numnames++;
+        }
+        pthread_rwlock_unlock(&oEnv->envLock);
+
+        for (size_t i = 0; i < numnames; i++) {
+            trash_reap(names[i], NULL);
+            free(names[i]);
+        }
+        free(names);
+
+        pthread_mutex_lock(&rp->mutex);
+    }
+    pthread_mutex_unlock(&rp->mutex);
+
+    internal_stats_release();
+
+    return NULL;
 }
 
-static struct OpenDb *internal_get_open_db_locked(const char *dbname) {
-    struct OpenDb *db;
+/**
+ * Copies the env into the pipe, the copy takes a reader slot like any other read txn
+ */
+static void *internal_backup_copier(void *arg) {
+    struct BackupJob *job = (struct BackupJob *)arg;
+
+    job->copyrc = internal_reserve_reader(true);
+    if(job->copyrc == TRASH_DB_SUCCESS) {
+        // the copy is a txn the map can not be resized under
+        __atomic_add_fetch(&oEnv->backups, 1, __ATOMIC_SEQ_CST);
+        internal_txn_enter();
+        job->copyrc = mdb_env_copyfd2(oEnv->env, job->pipefd[1], (job->bk->flags & TRASH_BACKUP_COMPACT) ? MDB_CP_COMPACT : 0);
+        internal_txn_exit();
+        __atomic_sub_fetch(&oEnv->backups, 1, __ATOMIC_SEQ_CST);
+        internal_release_reader();
+    }
 
-    pthread_rwlock_rdlock(&oEnv->envLock);
-    db = internal_get_open_db(dbname);
-    pthread_rwlock_unlock(&oEnv->envLock);
+    // the relay sees the end of the copy
+    close(job->pipefd[1]);
 
-    return db;
+    return NULL;
 }
 
-static struct OpenDb *internal_get_open_db(const char *dbname) {
-    struct OpenDb *db = NULL;
-    struct IL *curr;
+static void *internal_backup_relay(void *arg) {
+    struct BackupJob *job = (struct BackupJob *)arg;
+    struct TrashBackup *bk = job->bk;
+    struct timespec pause;
+    unsigned long start, elapsed, due;
+    size_t copied = 0, total;
+    char *buf;
+    ssize_t n;
+    int rc = 0;
+
+    buf = (char *)malloc(TRASH_BACKUP_CHUNK);
+    assert(buf != NULL);
+
+    start = internal_now_ns();
+    if(pthread_create(&job->copier, NULL, internal_backup_copier, job) != 0) {
+        close(job->pipefd[1]);
+        job->copyrc = TRASH_DB_ERROR;
+    } else {
+        for(;;) {
+            n = read(job->pipefd[0], buf, TRASH_BACKUP_CHUNK);
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                break;
+
+            // after a failed write the rest is drained so the copy can finish and give back its txn
+            if(rc != 0)
+                continue;
+
+            rc = internal_write_all(job->outfd, buf, (size_t)n);
+            copied += (size_t)n;
+
+            elapsed = internal_now_ns() - start;
+            if(bk->ratebytes > 0) {
+                due = (unsigned long)((double)copied * 1e9 / (double)bk->ratebytes);
+                if(due > elapsed) {
+                    pause.tv_sec = (due - elapsed) / 1000000000;
+                    pause.tv_nsec = (long)((due - elapsed) % 1000000000);
+                    nanosleep(&pause, NULL);
+                    elapsed = due;
+                }
+            }
 
-    for_each(&oEnv->dbs.head, curr) {
-        struct OpenDb *tempdb;
-        tempdb = CONTAINER_OF(curr, struct OpenDb, moveenv);
-        if(db_match(tempdb, dbname) == TRASH_DB_SUCCESS) {
-            db = tempdb;
-            break;
+            total = __atomic_load_n(&bk->total, __ATOMIC_RELAXED);
+            if(total < copied) {
+                total = copied;
+                __atomic_store_n(&bk->total, total, __ATOMIC_RELAXED);
+            }
+            __atomic_store_n(&bk->copied, copied, __ATOMIC_RELAXED);
+            // at the rate seen so far
+            __atomic_store_n(&bk->etams, (unsigned long)((double)(total - copied) * ((double)elapsed / 1e6) / (double)copied), __ATOMIC_RELAXED);
+
+            if(bk->progress != NULL)
+                bk->progress(bk);
         }
+
+        pthread_join(job->copier, NULL);
     }
+    close(job->pipefd[0]);
+    free(buf);
 
-    return db;
+    if(rc == 0 && job->copyrc == 0 && bk->fd < 0 && fsync(job->outfd) != 0)
+        rc = TRASH_DB_ERROR;
+    if(bk->fd < 0)
+        close(job->outfd);
+
+    __atomic_store_n(&bk->total, copied, __ATOMIC_RELAXED);
+    __atomic_store_n(&bk->etams, 0, __ATOMIC_RELAXED);
+    bk->rc = (job->copyrc != 0) ? job->copyrc : rc;
+    __atomic_store_n(&bk->done, 1, __ATOMIC_RELEASE);
+
+    internal_stats_release();
+
+    return NULL;
 }
 
-static void internal_create_open_env(struct OpenEnv **oEnv, MDB_env *env) {
-    *oEnv = (struct OpenEnv *)malloc(sizeof(struct OpenEnv));
-    assert((*oEnv) != NULL);
+static int internal_write_all(int fd, const char *buf, size_t len) {
+    ssize_t n;
 
-    (*oEnv)->env = env;
-    init_list(&(*oEnv)->dbs);
+    while(len > 0) {
+        n = write(fd, buf, len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return TRASH_DB_ERROR;
 
-    pthread_rwlock_init(&(*oEnv)->envLock, NULL);
+        buf += n;
+        len -= (size_t)n;
+    }
 
-    (*oEnv)->envFlags = mdb_env_get_flags(env, &(*oEnv)->envFlags);
-    (*oEnv)->state = ENV_OPEN;
+    return TRASH_DB_SUCCESS;
+}
+
+static void *internal_committer(void *arg) {
+    struct GroupCommit *gc = (struct GroupCommit *)arg;
+    struct LL reqs;
+    struct IL *curr;
+    struct timespec deadline;
+    size_t ops;
+
+    pthread_mutex_lock(&gc->gcMutex);
+    for(;;) {
+        while(gc->running && gc->queue.len == 0)
+            pthread_cond_wait(&gc->gcCond, &gc->gcMutex);
+
+        if(gc->queue.len == 0)
+            break;
+
+        // give other writers until the deadline to join this tick
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long)gc->maxwaitus * 1000;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+        while(gc->running && gc->queuedops < gc->maxops) {
+            if(pthread_cond_timedwait(&gc->gcCond, &gc->gcMutex, &deadline) == ETIMEDOUT)
+                break;
+        }
+
+        // take at least one batch and stop once the tick is full
+        init_list(&reqs);
+        ops = 0;
+        while(gc->queue.len > 0 && ops < gc->maxops) {
+            struct CommitReq *req;
+
+            curr = (&gc->queue.head)->next;
+            item_remove(curr);
+            gc->queue.len--;
+
+            req = CONTAINER_OF(curr, struct CommitReq, movequeue);
+            ops += req->numops;
+            list_append(&reqs, curr);
+        }
+        gc->queuedops -= ops;
+        pthread_mutex_unlock(&gc->gcMutex);
+
+        internal_commit_reqs(&reqs);
+
+        pthread_mutex_lock(&gc->gcMutex);
+        for_each(&reqs.head, curr) {
+            CONTAINER_OF(curr, struct CommitReq, movequeue)->done = 1;
+        }
+        pthread_cond_broadcast(&gc->doneCond);
+    }
+    pthread_mutex_unlock(&gc->gcMutex);
+
+    return NULL;
 }
 
 /**
- * @note    this function will need to check if their is room for the desired db size
- * @todo    make this function better    
-*/
-static int internal_set_env_fields(MDB_env *env, size_t dbsize, unsigned int numdbs, unsigned int numrdrs) {
-    if(mdb_env_set_maxdbs(env, numdbs) != 0) {
-        return TRASH_DB_ERROR;
+ * Commits every request in one write txn.
+ * Each request runs in a nested txn so a failing request is rolled back on its own.
+ * Requests that filled the map are committed again once the map is grown.
+ */
+static void internal_commit_reqs(struct LL *reqs) {
+    size_t seen, full;
+    int pass;
+
+    for(pass = 0; ; pass++) {
+        seen = internal_mapsize();
+        full = internal_commit_pass(reqs, pass);
+        if(full == 0 || internal_grow_map(seen) != TRASH_DB_SUCCESS)
+            break;
     }
-    if(mdb_env_set_maxreaders(env, numrdrs) != 0) {
-        return TRASH_DB_ERROR;
+}
+
+/**
+ * After the first pass only the requests that filled the map are run again
+ * 
+ * @return  number of requests that failed with MDB_MAP_FULL
+ */
+static size_t internal_commit_pass(struct LL *reqs, int pass) {
+    TrashTxn *tt;
+    MDB_txn *parent, *child;
+    struct IL *curr;
+    size_t full = 0, mark;
+    int rc;
+
+    rc = internal_begin_txn(&tt, TRASH_WR_TXN);
+    assert(rc == TRASH_DB_SUCCESS);
+
+    for_each(&reqs->head, curr) {
+        struct CommitReq *req;
+        req = CONTAINER_OF(curr, struct CommitReq, movequeue);
+
+        if(pass > 0 && req->rc != MDB_MAP_FULL)
+            continue;
+        req->pass = pass;
+
+        parent = tt->txn;
+        rc = mdb_txn_begin(oEnv->env, parent, 0, &child);
+        if(rc != 0) {
+            req->rc = rc;
+            continue;
+        }
+
+        mark = tt->numblooms;
+        rc = internal_apply_ops(child, req->ops, req->numops, &tt->wbytes);
+        // the stored bloom filters are deleted in the child so a failed batch takes that with it
+        tt->txn = child;
+        for (size_t i = 0; i < req->numops && rc == 0; i++)
+            rc = internal_bloom_write(tt, req->ops[i].db, &req->ops[i].key);
+        tt->txn = parent;
+        if(rc != 0) {
+            internal_bloom_undo(tt, mark);
+            mdb_txn_abort(child);
+            req->rc = rc;
+            if(rc == MDB_MAP_FULL)
+                full++;
+            continue;
+        }
+
+        req->rc = mdb_txn_commit(child);
+        if(req->rc == 0) {
+            for (size_t i = 0; i < req->numops; i++)
+                internal_cache_note(tt, req->ops[i].db, &req->ops[i].key);
+        } else {
+            internal_bloom_undo(tt, mark);
+        }
     }
-    if(mdb_env_set_mapsize(env, dbsize) != 0) {
-        return TRASH_DB_ERROR;
+
+    // the requests of this pass are only durable once the outer txn is, a full map is retried after growing it
+    rc = internal_return_txn(tt);
+    if(rc != 0) {
+        for_each(&reqs->head, curr) {
+            struct CommitReq *req;
+            req = CONTAINER_OF(curr, struct CommitReq, movequeue);
+
+            if(req->pass != pass || req->rc != 0)
+                continue;
+
+            req->rc = rc;
+            if(rc == MDB_MAP_FULL)
+                full++;
+        }
     }
-    return TRASH_DB_SUCCESS;
+
+    return full;
 }
 
-static int db_match(struct OpenDb *db, const char *dbname) {
-    if(db == NULL) {
-        return TRASH_DB_ERROR;
+static int internal_apply_ops(MDB_txn *txn, struct TrashOp *ops, size_t numops, size_t *wbytes) {
+    size_t bytes = 0;
+    int rc = 0;
+
+    for (size_t i = 0; i < numops && rc == 0; i++) {
+        struct TrashOp *op = &ops[i];
+
+        if(op->db == NULL)
+            return TRASH_DB_DNE;
+        if(op->op == TRASH_OP_PUT && !internal_key_ok(op->db, &op->key))
+            return TRASH_DB_ERROR;
+
+        switch (op->op) {
+        case TRASH_OP_PUT:
+            if(op->db->flags & TRASH_DB_TTL) {
+                MDB_val stored;
+                rc = internal_ttl_put(txn, NULL, op->db, &op->key, &op->val, op->flags, internal_ttl_expiry(op->db), &stored);
+            } else {
+                rc = mdb_put(txn, op->db->dbi, &op->key, &op->val, op->flags);
+            }
+            break;
+        case TRASH_OP_DEL:
+            rc = mdb_del(txn, op->db->dbi, &op->key, (op->val.mv_data == NULL) ? NULL : &op->val);
+            break;
+        default:
+            rc = TRASH_DB_ERROR;
+            break;
+        }
+        bytes += op->key.mv_size + op->val.mv_size;
     }
 
+    if(rc == 0)
+        *wbytes += bytes;
+
+    return rc;
+}
+
+static int internal_bulk_cmp(MDB_txn *txn, MDB_dbi dbi, bool dups, struct BulkRec *a, struct BulkRec *b) {
     int rc;
-    rc = (strcmp(db->name, dbname) == 0) ? TRASH_DB_SUCCESS : TRASH_DB_ERROR;
+
+    rc = mdb_cmp(txn, dbi, &a->key, &b->key);
+    if(rc == 0 && dups)
+        rc = mdb_dcmp(txn, dbi, &a->val, &b->val);
 
     return rc;
 }
 
+static int internal_bulk_sort_cmp(const void *a, const void *b, void *ctx) {
+    struct BulkSort *bs = (struct BulkSort *)ctx;
+
+    return internal_bulk_cmp(bs->txn, bs->dbi, bs->dups, (struct BulkRec *)a, (struct BulkRec *)b);
+}
+
 /**
- * @note    the calling function needs to handle locking for the oenv struct
+ * Sorts one slice, run on its own thread
  */
-static struct OpenDb *internal_add_db(struct DbMeta *dbmeta, MDB_dbi dbi) {
-    struct OpenDb *db;
+static void *internal_bulk_sort(void *arg) {
+    struct BulkSort *bs = (struct BulkSort *)arg;
 
-    db = (struct OpenDb *)malloc(sizeof(struct OpenDb));
-    assert(db != NULL);
+    if(internal_merge_sort(bs->recs, bs->tmp, bs->len, sizeof(struct BulkRec), internal_bulk_sort_cmp, bs) != bs->recs)
+        memcpy(bs->recs, bs->tmp, bs->len * sizeof(struct BulkRec));
 
-    db->curs = (TrashCursor **)calloc(dbmeta->slots, sizeof(TrashCursor *));
-    db->curcount = dbmeta->slots;
+    return NULL;
+}
 
-    db->name = dbmeta->name;
-    db->dbi = dbi;
-    db->state = DB_OPEN;
-    db->txncount = 0;
-    pthread_mutex_init(&db->odbMutex, NULL);
-    pthread_cond_init(&db->odbCond, NULL);
+/**
+ * Sorts the records in memory as up to bl->threads slices in parallel.
+ * mdb_cmp only reads the txn, so the threads share it.
+ * 
+ * @return  number of runs, one per sorted slice
+ */
+static size_t internal_bulk_sort_slices(struct BulkLoad *ld, MDB_txn *txn, struct BulkRun *runs) {
+    struct BulkSort *sorts;
+    pthread_t *threads;
+    bool *started;
+    size_t numslices, per, off;
+
+    if(ld->numrecs == 0)
+        return 0;
+
+    ld->tmp = (struct BulkRec *)realloc(ld->tmp, ld->reccap * sizeof(struct BulkRec));
+    assert(ld->tmp != NULL);
+
+    numslices = ld->bl->threads;
+    if(numslices > ld->numrecs)
+        numslices = ld->numrecs;
+    per = (ld->numrecs + numslices - 1) / numslices;
+
+    sorts = (struct BulkSort *)calloc(numslices, sizeof(struct BulkSort));
+    threads = (pthread_t *)calloc(numslices, sizeof(pthread_t));
+    // a pthread_t has no value that means no thread
+    started = (bool *)calloc(numslices, sizeof(bool));
+    assert(sorts != NULL && threads != NULL && started != NULL);
+
+    off = 0;
+    for (size_t i = 0; i < numslices; i++) {
+        sorts[i].recs = ld->recs + off;
+        sorts[i].tmp = ld->tmp + off;
+        sorts[i].len = (off + per < ld->numrecs) ? per : ld->numrecs - off;
+        sorts[i].txn = txn;
+        sorts[i].dbi = ld->dbi;
+        sorts[i].dups = ld->dups;
+
+        runs[i].recs = sorts[i].recs;
+        runs[i].pos = 0;
+        runs[i].len = sorts[i].len;
+        runs[i].fp = NULL;
+
+        // the calling thread sorts the first slice
+        if(i > 0)
+            started[i] = pthread_create(&threads[i], NULL, internal_bulk_sort, &sorts[i]) == 0;
+        if(i > 0 && !started[i])
+            internal_bulk_sort(&sorts[i]);
+        off += sorts[i].len;
+    }
 
-    init_il(&db->moveenv);
-    list_append(&oEnv->dbs, &db->moveenv);
+    internal_bulk_sort(&sorts[0]);
+    for (size_t i = 1; i < numslices; i++) {
+        if(started[i])
+            pthread_join(threads[i], NULL);
+    }
 
-    return db;
+    free(sorts);
+    free(threads);
+    free(started);
+
+    return numslices;
 }
 
-static int internal_add_db_curs(struct OpenDb *db, TrashTxn *tt) {
-    int rc;
+/**
+ * Sorts the records in memory and writes them to an unlinked temp file next to the env as one run
+ */
+static int internal_bulk_spill(struct BulkLoad *ld) {
+    struct BulkRun *runs;
+    struct BulkMerge m;
+    struct BulkRec rec;
+    TrashTxn *tt;
+    char path[256];
+    size_t numruns;
+    FILE *fp;
+    int fd, rc, done = MDB_NOTFOUND;
+
+    snprintf(path, sizeof(path), "%s%sbulk.XXXXXX", DB_DIR, filename);
+    fd = mkstemp(path);
+    if(fd < 0)
+        return TRASH_DB_ERROR;
+    unlink(path);
 
-    if(tt == NULL || (tt->actions & TRASH_WR_TXN)) {
-        return TRASH_TXN_INVALID;
+    fp = fdopen(fd, "w+");
+    if(fp == NULL) {
+        close(fd);
+        return TRASH_DB_ERROR;
     }
 
-    for (size_t i = 0; i < db->curcount; i++) {
-        internal_create_trash_cursor(&db->curs[i], db, READ);
-        rc = mdb_cursor_open(tt->txn, db->dbi, &(db->curs[i])->cur);
-        assert(rc == 0);
+    rc = trash_txn_db(&tt, ld->bl->db, TRASH_RD_TXN);
+    if(rc != TRASH_DB_SUCCESS) {
+        fclose(fp);
+        return rc;
+    }
+
+    runs = (struct BulkRun *)calloc(ld->bl->threads, sizeof(struct BulkRun));
+    assert(runs != NULL);
+    numruns = internal_bulk_sort_slices(ld, tt->txn, runs);
+
+    m.txn = tt->txn;
+    m.dbi = ld->dbi;
+    m.dups = ld->dups;
+    rc = internal_merge_init(&m, runs, numruns);
+
+    while(rc == TRASH_DB_SUCCESS && (done = internal_merge_next(&m, &rec)) == 0) {
+        if(fwrite(&rec.key.mv_size, sizeof(size_t), 1, fp) != 1 ||
+            fwrite(&rec.val.mv_size, sizeof(size_t), 1, fp) != 1 ||
+            fwrite(rec.key.mv_data, 1, rec.key.mv_size, fp) != rec.key.mv_size ||
+            fwrite(rec.val.mv_data, 1, rec.val.mv_size, fp) != rec.val.mv_size) {
+            rc = TRASH_DB_ERROR;
+        }
     }
+    if(rc == TRASH_DB_SUCCESS && done != MDB_NOTFOUND)
+        rc = done;
+
+    free(m.heap);
+    free(runs);
+    return_txn(tt);
+
+    if(rc != TRASH_DB_SUCCESS || fflush(fp) != 0 || fseek(fp, 0, SEEK_SET) != 0) {
+        fclose(fp);
+        return TRASH_DB_ERROR;
+    }
+
+    ld->spills = (FILE **)realloc(ld->spills, (ld->numspills + 1) * sizeof(FILE *));
+    assert(ld->spills != NULL);
+    ld->spills[ld->numspills++] = fp;
+
+    ld->numrecs = 0;
+    ld->arenalen = 0;
 
     return TRASH_DB_SUCCESS;
 }
 
-static void internal_add_db_txn(TrashTxn *tt, struct OpenDb *db) {
-    pthread_mutex_lock(&db->odbMutex);
-    db->txncount++;
-    pthread_mutex_unlock(&db->odbMutex);
+/**
+ * Loads the next record of the run into run->cur
+ * 
+ * @return  MDB_NOTFOUND once the run is done, TRASH_DB_ERROR when a spilled run fails to read or ends inside a record
+ */
+static int internal_bulk_run_next(struct BulkRun *run) {
+    size_t sizes[2], n;
+
+    if(run->fp == NULL) {
+        if(run->pos >= run->len)
+            return MDB_NOTFOUND;
+        run->cur = run->recs[run->pos++];
+        return 0;
+    }
+
+    // only the end of the file right after a record is the end of the run
+    n = fread(sizes, 1, sizeof(sizes), run->fp);
+    if(n == 0 && feof(run->fp) && !ferror(run->fp))
+        return MDB_NOTFOUND;
+    if(n != sizeof(sizes))
+        return TRASH_DB_ERROR;
 
-    if(tt->dbscount == tt->dbscap)
-        assert(NULL);
+    if(sizes[0] + sizes[1] > run->bufcap) {
+        run->bufcap = sizes[0] + sizes[1];
+        run->buf = (char *)realloc(run->buf, run->bufcap);
+        assert(run->buf != NULL);
+    }
 
-    tt->dbs[tt->dbscount] = db;
-    tt->dbscount++;
+    if(fread(run->buf, 1, sizes[0] + sizes[1], run->fp) != sizes[0] + sizes[1])
+        return TRASH_DB_ERROR;
+
+    run->cur.key.mv_data = run->buf;
+    run->cur.key.mv_size = sizes[0];
+    run->cur.val.mv_data = run->buf + sizes[0];
+    run->cur.val.mv_size = sizes[1];
+
+    return 0;
 }
 
-static int internal_begin_txn(TrashTxn **tt, int rdwr) {
-    MDB_txn *txn;
-    int rc, flags = 0;
-    
-    if(rdwr == TRASH_RD_TXN) {
-        *tt = internal_get_read_txn();
-        if(*tt == NULL)
-            return TRASH_OUT_OF_READER_SLOTS;
-    } else {
-        rc = mdb_txn_begin(oEnv->env, NULL, flags, &txn);
-        assert(rc == 0);
+/**
+ * Min heap compare, ties go to the earlier run so the input order is kept
+ */
+static bool internal_merge_less(struct BulkMerge *m, size_t a, size_t b) {
+    int rc;
 
-        internal_create_trash_txn(tt, txn, TRASH_WR_TXN);
+    rc = internal_bulk_cmp(m->txn, m->dbi, m->dups, &m->runs[a].cur, &m->runs[b].cur);
+    return rc < 0 || (rc == 0 && a < b);
+}
+
+static void internal_merge_sift(struct BulkMerge *m, size_t i) {
+    for(;;) {
+        size_t l = 2 * i + 1, r = l + 1, min = i, swap;
+
+        if(l < m->numheap && internal_merge_less(m, m->heap[l], m->heap[min]))
+            min = l;
+        if(r < m->numheap && internal_merge_less(m, m->heap[r], m->heap[min]))
+            min = r;
+        if(min == i)
+            return;
+
+        swap = m->heap[i];
+        m->heap[i] = m->heap[min];
+        m->heap[min] = swap;
+        i = min;
+    }
+}
+
+/**
+ * m->heap is set even when a run fails, the caller frees it
+ * 
+ * @return  TRASH_DB_ERROR when a spilled run can not be read
+ * @note    m->txn, m->dbi and m->dups need to be set by the caller
+ */
+static int internal_merge_init(struct BulkMerge *m, struct BulkRun *runs, size_t numruns) {
+    int rc;
+
+    m->runs = runs;
+    m->heap = (size_t *)malloc((numruns > 0 ? numruns : 1) * sizeof(size_t));
+    assert(m->heap != NULL);
+    m->numheap = 0;
+    m->haslast = false;
+
+    for (size_t i = 0; i < numruns; i++) {
+        rc = internal_bulk_run_next(&runs[i]);
+        if(rc == 0) {
+            m->heap[m->numheap++] = i;
+        } else if(rc != MDB_NOTFOUND) {
+            return rc;
+        }
     }
 
+    for (size_t i = m->numheap / 2; i-- > 0; )
+        internal_merge_sift(m, i);
+
     return TRASH_DB_SUCCESS;
 }
 
-static TrashTxn *internal_get_read_txn() {
-    TrashTxn *tt;
+/**
+ * The record handed out stays valid until the next call
+ * 
+ * @return  MDB_NOTFOUND once every run is done, TRASH_DB_ERROR when a spilled run can not be read
+ */
+static int internal_merge_next(struct BulkMerge *m, struct BulkRec *rec) {
+    int rc;
 
-    if(rdrPool == NULL) {
-        // the rdr pool should never be NULL unless the calling function is on env set up
-        // in that case return a reader txn
-        MDB_txn *txn;
-        
-        // create and rd txn and return
-        mdb_txn_begin(oEnv->env, NULL, MDB_RDONLY, &txn);
-        internal_create_trash_txn(&tt, txn, TRASH_RD_TXN);
-        return tt;
+    if(m->haslast) {
+        m->haslast = false;
+        rc = internal_bulk_run_next(&m->runs[m->last]);
+        if(rc == MDB_NOTFOUND) {
+            m->heap[0] = m->heap[--m->numheap];
+        } else if(rc != 0) {
+            return rc;
+        }
+        if(m->numheap > 0)
+            internal_merge_sift(m, 0);
     }
 
-    if(rdrPool->numTxns == 0) {
-        /**
-         * @note    idk what to do here
-         * @note    we run out of readers in the pool
-         * @note    have to be careful creating new readers since we set a msx_readers arg for lmdb
-         * 
-         * @note    this is a problem when we begin nesting txns. how many can we nest per thread?
-         */
-        return NULL;
-    }
+    if(m->numheap == 0)
+        return MDB_NOTFOUND;
 
-    tt = rdrPool->txns[--rdrPool->numTxns];
-    assert(mdb_txn_renew(tt->txn) == 0);
+    m->last = m->heap[0];
+    m->haslast = true;
+    *rec = m->runs[m->last].cur;
 
-    return tt;
+    return 0;
 }
 
-static void internal_create_trash_txn(TrashTxn **tt, MDB_txn *txn, int rdwr) {
-    unsigned int actions = 0;
+/**
+ * Merges the sorted runs into the db in write txns of at most bl->txnops pairs
+ */
+static int internal_bulk_insert(struct BulkLoad *ld, struct BulkRun *runs, size_t numruns) {
+    struct TrashBulk *bl = ld->bl;
+    struct BulkMerge m;
+    struct BulkRec rec, pending;
+    TrashTxn *tt;
+    char *pbuf = NULL;
+    size_t pcap = 0, ops = 0;
+    unsigned int flags;
+    bool haspending = false;
+    int rc, done;
 
-    *tt = (TrashTxn *)malloc(sizeof(TrashTxn));
-    assert(*tt);
+    flags = ld->dups ? MDB_APPENDDUP : MDB_APPEND;
 
-    /**
-     * @todo    change the capacity later, should be the max num of dbs available
-     */
-    (*tt)->dbs = (struct OpenDb **)calloc(10, sizeof(struct OpenDb *));
-    assert((*tt)->dbs);
-    (*tt)->dbscap = 10;
-    (*tt)->dbscount = 0;
+    rc = trash_txn_db(&tt, bl->db, TRASH_WR_TXN);
+    if(rc != TRASH_DB_SUCCESS)
+        return rc;
 
-    (*tt)->txn = txn;
-    (*tt)->cur = NULL;
-    (*tt)->fin_db = internal_fin_db_locked;
-    (*tt)->open_db = internal_get_open_db_locked;
+    m.txn = tt->txn;
+    m.dbi = ld->dbi;
+    m.dups = ld->dups;
+    rc = internal_merge_init(&m, runs, numruns);
+
+    while(rc == TRASH_DB_SUCCESS) {
+        // the write txn is replaced on every chunk and whenever the map is grown
+        m.txn = tt->txn;
+        done = internal_merge_next(&m, &rec);
+        // a run that can not be read fails the load, the pending pair is dropped with the txn
+        if(done != 0 && done != MDB_NOTFOUND) {
+            rc = done;
+            break;
+        }
 
-    // assume the tt will always be returned with fin
-    // negate fin if wanting to keep the txn
-    actions = rdwr;
-    if(actions == TRASH_WR_TXN) {
-        actions |= TRASH_TXN_COMMIT;
+        // a repeated key replaces the pending pair so the last value wins
+        if(done == 0 && haspending && !ld->dups && mdb_cmp(tt->txn, ld->dbi, &rec.key, &pending.key) == 0)
+            haspending = false;
+
+        if(haspending) {
+            rc = trash_put(tt, &pending.key, &pending.val, flags);
+            if(rc == MDB_KEYEXIST)
+                rc = trash_put(tt, &pending.key, &pending.val, 0);
+            if(rc != 0)
+                break;
+
+            bl->loaded++;
+            if(++ops >= bl->txnops) {
+                return_txn(tt);
+                ops = 0;
+                rc = trash_txn_db(&tt, bl->db, TRASH_WR_TXN);
+                if(rc != TRASH_DB_SUCCESS) {
+                    tt = NULL;
+                    break;
+                }
+            }
+        }
+
+        if(done != 0)
+            break;
+
+        // the run reuses its buffer on the next merge call, so keep a copy
+        if(rec.key.mv_size + rec.val.mv_size > pcap) {
+            pcap = rec.key.mv_size + rec.val.mv_size;
+            pbuf = (char *)realloc(pbuf, pcap);
+            assert(pbuf != NULL);
+        }
+        memcpy(pbuf, rec.key.mv_data, rec.key.mv_size);
+        memcpy(pbuf + rec.key.mv_size, rec.val.mv_data, rec.val.mv_size);
+        pending.key.mv_data = pbuf;
+        pending.key.mv_size = rec.key.mv_size;
+        pending.val.mv_data = pbuf + rec.key.mv_size;
+        pending.val.mv_size = rec.val.mv_size;
+        haspending = true;
     }
-    (*tt)->actions = actions;
-}
 
-static void internal_create_trash_cursor(TrashCursor **tc, struct OpenDb *db, enum RWTxn rw) {
-    *tc = (TrashCursor *)malloc(sizeof(TrashCursor));
-    (*tc)->db = db;
-    (*tc)->rw = rw;
-}
\ No newline at end of file
+    if(tt != NULL) {
+        // a failed put leaves the txn to be aborted
+        if(rc != 0)
+            tt->actions &= ~TRASH_TXN_COMMIT;
+        return_txn(tt);
+    }
+
+    free(m.heap);
+    free(pbuf);
+
+    return rc;
+}
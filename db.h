@@ -1,6 +1,8 @@
 #ifndef DB_H
 #define DB_H
 
+#include <stdint.h>
+
 #include "lmdb.h"
 
 #define DEFAULT_VAR_PATH "/var/local/trashdb/"
@@ -23,12 +25,118 @@
 #define TRASH_TXN_INVALID 666
 #define TRASH_CUR_INVALID 777
 #define TRASH_OUT_OF_READER_SLOTS 888
+#define TRASH_WRITE_BUSY 999
 
 #define TRASH_RD_TXN 0x01
 #define TRASH_WR_TXN 0x02
 #define TRASH_TXN_COMMIT 0X04
 #define TRASH_TXN_RENEW 0x08
 
+#define TRASH_GET_PREFETCH 0x01
+
+#define TRASH_ITER_PREFIX 0x01
+#define TRASH_ITER_REVERSE 0x02
+#define TRASH_ITER_HI_INCL 0x04
+
+#define TRASH_OP_PUT 0x01
+#define TRASH_OP_DEL 0x02
+#define TRASH_OP_GET 0x04
+#define TRASH_OP_SCAN 0x08
+
+#define TRASH_ASYNC_WORKERS 4
+#define TRASH_ASYNC_BATCH 64
+
+// trash_counter_get flag, deltas not yet flushed are added to the value
+#define TRASH_COUNTER_PENDING 0x01
+#define TRASH_COUNTER_FLUSH_MS 100
+
+// write priorities, a waiting writer goes before every writer of a lower class
+#define TRASH_PRIO_HIGH 0
+#define TRASH_PRIO_NORMAL 1
+#define TRASH_PRIO_BULK 2
+#define TRASH_PRIO_NUM 3
+
+#define TRASH_SCHED_QUEUE 64
+#define TRASH_SCHED_HOLD_MS 10
+#define TRASH_SCHED_CHUNK_OPS 1000
+
+#define TRASH_GC_MAX_OPS 1024
+#define TRASH_GC_MAX_WAIT_US 200
+
+#define TRASH_SYNC_NONE 0
+#define TRASH_SYNC_PERIODIC 1
+#define TRASH_SYNC_META 2
+#define TRASH_SYNC_FULL 3
+
+#define TRASH_SYNC_MS 1000
+
+#define TRASH_GROW_PCT 100
+#define TRASH_GROW_WAIT_MS 1000
+
+#define TRASH_BULK_MEM 67108864
+#define TRASH_BULK_TXN_OPS 100000
+#define TRASH_BULK_THREADS 4
+
+// TrashBackup flag, free pages are left out and the pages renumbered
+#define TRASH_BACKUP_COMPACT 0x01
+#define TRASH_BACKUP_CHUNK 1048576
+
+#define TRASH_WARM_THREADS 4
+
+// DbMeta flag, the pages of the db are walked by open_env after a restart
+#define TRASH_DB_WARM 0x1000000
+// DbMeta flag, trash_cache_get keeps the values it reads in a cache of the db
+#define TRASH_DB_CACHE 0x2000000
+
+#define TRASH_CACHE_BYTES 8388608
+#define TRASH_CACHE_SHARDS 16
+
+// DbMeta flag, gets of keys that were never written skip lmdb
+#define TRASH_DB_BLOOM 0x4000000
+
+#define TRASH_BLOOM_KEYS 1048576
+#define TRASH_BLOOM_BITS_PER_KEY 10
+#define TRASH_BLOOM_HASHES 7
+
+// DbMeta key types, at most one in flags, without one keys are bytes ordered by lmdb
+// native uint32_t, compared as integers by lmdb
+#define TRASH_DB_KEY_U32 0x10000000
+// native uint64_t, compared as integers by lmdb
+#define TRASH_DB_KEY_U64 0x20000000
+// native int64_t
+#define TRASH_DB_KEY_I64 0x30000000
+// keywidth bytes, every key has the same size
+#define TRASH_DB_KEY_FIXED 0x40000000
+// parts packed by trash_key_pack, ordered part by part
+#define TRASH_DB_KEY_TUPLE 0x50000000
+#define TRASH_DB_KEY_MASK 0x70000000
+
+// DbMeta flag, values carry an expiry and expired keys read as missing until the reaper deletes them
+#define TRASH_DB_TTL 0x8000000
+
+#define TRASH_REAP_MS 1000
+#define TRASH_REAP_BATCH 256
+
+#define TRASH_WATCH_MS 1000
+
+// TrashShardMeta modes
+#define TRASH_SHARD_HASH 0x01
+#define TRASH_SHARD_RANGE 0x02
+#define TRASH_SHARD_MAX 64
+
+// TrashKeyPart types
+#define TRASH_PART_U32 1
+#define TRASH_PART_U64 2
+#define TRASH_PART_I64 3
+#define TRASH_PART_BYTES 4
+
+#define TRASH_HIST_BEGIN 0
+#define TRASH_HIST_COMMIT 1
+#define TRASH_HIST_GET 2
+#define TRASH_HIST_PUT 3
+#define TRASH_HIST_NUM 4
+#define TRASH_HIST_BUCKETS 32
+
 #define TRASH_DB_NAME_LEN 256
 #define TRASH_DB_OPENED 0
 #define TRASH_DB_WRITE_META 1
@@ -38,40 +146,336 @@
 #define TRASH_NUM_DBS 50
 
 /**
- * @note    currently only support 1 lmdb file
+ * @note    currently only support 1 lmdb file, sharded dbs (trash_shards_open) get lmdb files of their own
  */ 
 extern const char *filename;
 
 typedef struct TrashTxn TrashTxn;
 typedef struct TrashCursor TrashCursor;
+typedef struct TrashIter TrashIter;
+/**
+ * @note    a db handle stays valid until the db is closed with close_db
+ */
+typedef struct OpenDb TrashDb;
+typedef struct ShardSet TrashShards;
+typedef struct ShardTxn TrashShardTxn;
+typedef struct ShardIter TrashShardIter;
 
+/**
+ * TRASH_SYNC_NONE      never syncs, the os decides when commits reach the disk
+ * TRASH_SYNC_PERIODIC  commits do not sync, a flusher syncs every syncms or once syncbytes were written
+ * TRASH_SYNC_META      commits sync the data but not the meta page, a crash can undo the last commit
+ * TRASH_SYNC_FULL      every commit is synced
+ * 
+ * When mapmax is larger than the dbsize given to open_env, a write that fills the map grows it
+ * by growpct percent (TRASH_GROW_PCT when 0), up to mapmax, and is retried.
+ * When the map can not be grown the write fails with MDB_MAP_FULL and the writes of the txn are lost,
+ * every later call with the txn fails with MDB_BAD_TXN and return_txn aborts it.
+ * 
+ * A read txn that finds no idle reader waits up to rdrwaitms for one before failing with TRASH_OUT_OF_READER_SLOTS.
+ * 
+ * open_env opens every db in the metadata db and builds their cursor pools with warmthreads threads (TRASH_WARM_THREADS when 0).
+ * The pages of dbs created with TRASH_DB_WARM are walked by the same threads, up to warmbytes in total (no limit when 0).
+ * 
+ * Every db created with TRASH_DB_CACHE caches up to cachebytes of keys and values (TRASH_CACHE_BYTES when 0).
+ * 
+ * @note    a zeroed struct is the same as passing NULL to open_env
+ */
+struct EnvMeta {
+    unsigned int durability;
+    unsigned int syncms;
+    size_t syncbytes;
+
+    size_t mapmax;
+    unsigned int growpct;
+
+    unsigned int rdrwaitms;
+
+    unsigned int warmthreads;
+    size_t warmbytes;
+
+    size_t cachebytes;
+};
+
+/**
+ * bloomkeys is the number of keys the filter of a TRASH_DB_BLOOM db is sized for (TRASH_BLOOM_KEYS when 0),
+ * it is only read with that flag.
+ * 
+ * keywidth is the size of the keys of a TRASH_DB_KEY_FIXED db, it is only read with that key type.
+ * Puts with a key of the wrong size for the key type are refused.
+ * 
+ * ttlsecs is how long the keys of a TRASH_DB_TTL db live when they are put without an expiry (forever when 0),
+ * it is only read with that flag. TTL dbs can not be dupsort or cached.
+ */
 struct DbMeta {
     const char *name;
     unsigned int flags;
     unsigned int slots;
+    size_t bloomkeys;
+    unsigned int keywidth;
+    unsigned int ttlsecs;
+};
+
+/**
+ * One part of a TRASH_DB_KEY_TUPLE key, type is one of the TRASH_PART_* types.
+ * TRASH_PART_U32 and TRASH_PART_U64 use unum, TRASH_PART_I64 uses snum and TRASH_PART_BYTES uses bytes.
+ */
+struct TrashKeyPart {
+    unsigned int type;
+    uint64_t unum;
+    int64_t snum;
+    MDB_val bytes;
+};
+
+/**
+ * A single put or delete submitted to the group commit pipeline.
+ * For TRASH_OP_DEL a NULL val.mv_data deletes every value of the key.
+ */
+struct TrashOp {
+    TrashDb *db;
+    MDB_val key;
+    MDB_val val;
+    unsigned int flags;
+    int op;
+};
+
+/**
+ * A request served by the async workers, the caller owns it until it completes.
+ * op is the operation, for TRASH_OP_GET and TRASH_OP_SCAN op.val is unused.
+ * A scan starts at op.key and ends at hi, a NULL mv_data leaves that end open. op.flags and limit are passed to trash_iter.
+ * 
+ * done is called on the worker when the request completes.
+ * Without done the request is queued for trash_async_reap and the eventfd of trash_async_fd is signaled.
+ * 
+ * @note    results are copies, they are freed with trash_async_free
+ */
+struct TrashReq {
+    struct TrashOp op;
+    MDB_val hi;
+    size_t limit;
+
+    void (*done)(struct TrashReq *req);
+    void *ctx;
+
+    // set when the request completes
+    int rc;
+    MDB_val val;
+    MDB_val *keys;
+    MDB_val *vals;
+    size_t count;
+    void *res;
+
+    struct TrashReq *next;
+};
+
+/**
+ * Source for trash_bulk_load. next is called until it returns non zero, the pair it hands out is copied.
+ * Up to membytes of pairs are sorted in memory by threads threads, larger loads are spilled to sorted runs on disk.
+ * Every txnops pairs the write txn is committed. Zero fields take the TRASH_BULK defaults.
+ */
+struct TrashBulk {
+    TrashDb *db;
+    int (*next)(void *ctx, MDB_val *key, MDB_val *val);
+    void *ctx;
+
+    size_t membytes;
+    size_t txnops;
+    unsigned int threads;
+
+    // set by trash_bulk_load
+    size_t loaded;
+};
+
+/**
+ * A copy of the env taken in the background by trash_backup_start, from a single read txn.
+ * The copy is written to fd, or to a file created at path when fd is negative.
+ * A TRASH_BACKUP_COMPACT copy has no free pages, it can replace the data file to reclaim the space freed in it.
+ * ratebytes caps the bytes written per second (no cap when 0), the copy reads the map only as fast as it is written.
+ * progress is called on the backup thread after every chunk written.
+ * 
+ * @note    the read txn of the copy keeps the pages it reads from being reused until it is done.
+ *          The map is not grown while a backup runs, a write that fills it fails with MDB_MAP_FULL right away.
+ */
+struct TrashBackup {
+    int fd;
+    const char *path;
+    unsigned int flags;
+    size_t ratebytes;
+
+    void (*progress)(struct TrashBackup *bk);
+    void *ctx;
+
+    // read with trash_backup_progress while the backup runs, total is an upper bound until it is done
+    size_t copied;
+    size_t total;
+    unsigned long etams;
+    int rc;
+    int done;
+
+    void *job;
+};
+
+/**
+ * A logical db split over numshards lmdb envs of its own, each a file under DB_DIR "<name>.shard<i>/" with its own writer lock.
+ * The shards do not go through open_env, writes to different shards run in parallel.
+ * 
+ * TRASH_SHARD_HASH routes a key by its hash. TRASH_SHARD_RANGE routes it by the numshards - 1 ascending splits,
+ * shard i holds the keys from splits[i - 1] up to but not including splits[i].
+ * Keys are ordered like an lmdb db without flags. The layout is checked against the one the shards were created with.
+ * 
+ * dbsize is the map size of each shard (TRASH_DB_SIZE when 0) and numrdrs its reader slots (TRASH_MAX_READERS when 0).
+ * durability is one of the TRASH_SYNC_* modes, without a flusher TRASH_SYNC_PERIODIC only syncs when the shards are closed.
+ */
+struct TrashShardMeta {
+    const char *name;
+    unsigned int mode;
+    unsigned int numshards;
+    MDB_val *splits;
+
+    size_t dbsize;
+    unsigned int numrdrs;
+    unsigned int durability;
+};
+
+/**
+ * Filled by trash_check_readers, only readers taken from the thread pools are tracked
+ */
+struct TrashReaders {
+    // pooled readers begun and not yet returned
+    unsigned int active;
+    // how long the oldest one has been active and how many write txns committed since its snapshot
+    unsigned long oldestms;
+    size_t oldestlag;
+    // reader slots of dead processes cleared by mdb_reader_check
+    int stale;
+    // readers marked expired by this check because they were active past the deadline
+    unsigned int expired;
+};
+
+/**
+ * Counters summed over every thread by trash_stats_snapshot, all times are in nanoseconds.
+ * hist[h][i] counts the calls of h that took between 2^i and 2^(i+1) ns.
+ * 
+ * @note    everything stays zero when built with TRASH_NO_STATS
+ */
+struct TrashStats {
+    unsigned long rdtxns;
+    unsigned long wrtxns;
+    unsigned long outofrdrs;
+    unsigned long rdrsteals;
+    unsigned long curhits;
+    unsigned long curmisses;
+    unsigned long cachehits;
+    unsigned long cachemisses;
+    unsigned long bloomnegs;
+    unsigned long wrbusy;
+    unsigned long wrchunks;
+
+    unsigned long envlockns;
+    unsigned long writerns;
+    unsigned long curwaitns;
+    unsigned long rdrwaitns;
+
+    unsigned long hist[TRASH_HIST_NUM][TRASH_HIST_BUCKETS];
 };
 
 void init_thread_local_readers(size_t numrdrs);
 void clean_thread_local_readers();
 
-int open_env(size_t dbsize, unsigned int numdbs, unsigned int numthreads);
+int open_env(size_t dbsize, unsigned int numdbs, unsigned int numthreads, struct EnvMeta *meta);
 void close_env();
 void emergency_cleanup();
+size_t trash_durable_txnid();
+size_t trash_map_resizes();
+void trash_stats_snapshot(struct TrashStats *st);
 
 int change_txn_db(TrashTxn *tt, const char *dbname);
-// int nest_txn(TrashTxn **tt, const char *db, TrashTxn *pTxn);
+int change_txn_handle(TrashTxn *tt, TrashDb *db);
+int trash_savepoint(TrashTxn *tt);
+int trash_rollback(TrashTxn *tt);
+int trash_release(TrashTxn *tt);
 
 // int open_db(TrashTxn *tt, const char *dbname);
 void close_db(const char *dbname);
 int write_db_meta(struct DbMeta *db);
 
+int trash_db(TrashDb **db, const char *dbname);
 int trash_txn(TrashTxn **tt, const char *dbname, int rd);
+int trash_txn_db(TrashTxn **tt, TrashDb *db, int rd);
 void return_txn(TrashTxn *tt);
+void trash_abort(TrashTxn *tt);
 int trash_cursor(TrashCursor **cur, TrashTxn *tt);
 void return_cursor(TrashCursor *cur);
 int trash_put(TrashTxn *tt, MDB_val *key, MDB_val *val, unsigned int flags);
+int trash_put_expire(TrashTxn *tt, MDB_val *key, MDB_val *val, unsigned int flags, uint64_t expiry);
 int trash_get(TrashTxn *tt, MDB_val *key, MDB_val *data);
+int trash_get_many(TrashTxn *tt, MDB_val *keys, MDB_val *vals, int *rcs, size_t numkeys, unsigned int flags);
+int trash_cache_get(TrashDb *db, MDB_val *key, void *buf, size_t *len);
 int trash_cur_put(TrashCursor *tc, MDB_val *key, MDB_val *val, unsigned int flags);
 int trash_cur_get(TrashCursor *tc, MDB_val *key, MDB_val *val, MDB_cursor_op op);
 
+void trash_key_num(MDB_val *key, void *num, unsigned int keytype);
+uint64_t trash_key_to_num(const MDB_val *key);
+int trash_key_fixed(MDB_val *key, void *buf, size_t width, const void *data, size_t len);
+int trash_key_pack(MDB_val *key, void *buf, size_t cap, const struct TrashKeyPart *parts, size_t numparts);
+int trash_key_unpack(const MDB_val *key, struct TrashKeyPart *parts, size_t numparts, void *buf, size_t cap);
+
+/**
+ * On a write txn trash_iter opens a write cursor like trash_cursor does, and the writes of the txn are no longer logged.
+ * For the rest of the txn a full map is not grown, the write fails with MDB_MAP_FULL, and a TRASH_PRIO_BULK txn is not chunked.
+ */
+int trash_iter(TrashIter **it, TrashTxn *tt, MDB_val *lo, MDB_val *hi, unsigned int flags, size_t limit);
+void return_iter(TrashIter *it);
+int trash_iter_next(TrashIter *it, MDB_val *key, MDB_val *val);
+size_t trash_iter_batch(TrashIter *it, MDB_val *keys, MDB_val *vals, size_t max);
+
+int trash_bulk_load(struct TrashBulk *bl);
+
+int start_write_sched(unsigned int maxqueue, unsigned int maxholdms, size_t chunkops);
+void stop_write_sched();
+void trash_write_priority(unsigned int prio);
+
+int start_group_commit(size_t maxops, unsigned int maxwaitus);
+void stop_group_commit();
+int trash_submit(struct TrashOp *ops, size_t numops);
+
+int trash_backup_start(struct TrashBackup *bk);
+int trash_backup_wait(struct TrashBackup *bk);
+void trash_backup_progress(struct TrashBackup *bk, size_t *copied, size_t *total, unsigned long *etams);
+
+int trash_shards_open(TrashShards **ss, struct TrashShardMeta *meta);
+void trash_shards_close(TrashShards *ss);
+unsigned int trash_shard_of(TrashShards *ss, MDB_val *key);
+int trash_shard_txn(TrashShardTxn **st, TrashShards *ss, int rd);
+int return_shard_txn(TrashShardTxn *st);
+void trash_shard_abort(TrashShardTxn *st);
+int trash_shard_put(TrashShardTxn *st, MDB_val *key, MDB_val *val, unsigned int flags);
+int trash_shard_get(TrashShardTxn *st, MDB_val *key, MDB_val *val);
+int trash_shard_del(TrashShardTxn *st, MDB_val *key, MDB_val *val);
+int trash_shard_write(TrashShards *ss, struct TrashOp *ops, size_t numops);
+int trash_shard_iter(TrashShardIter **it, TrashShardTxn *st, MDB_val *lo, MDB_val *hi, unsigned int flags);
+int trash_shard_iter_next(TrashShardIter *it, MDB_val *key, MDB_val *val);
+void return_shard_iter(TrashShardIter *it);
+
+int start_reaper(unsigned int intervalms);
+void stop_reaper();
+int trash_reap(const char *dbname, size_t *reaped);
+
+int start_watchdog(unsigned int intervalms, unsigned long expirems, void (*report)(const struct TrashReaders *rdrs));
+void stop_watchdog();
+int trash_check_readers(struct TrashReaders *rdrs, unsigned long expirems);
+
+int start_counters(unsigned int flushms);
+void stop_counters();
+int trash_counter_add(TrashDb *db, MDB_val *key, int64_t delta);
+int trash_counter_get(TrashTxn *tt, MDB_val *key, uint64_t *value, unsigned int flags);
+int trash_counter_flush();
+
+int start_async(unsigned int numworkers, size_t numrdrs);
+struct TrashReq *stop_async();
+int trash_async(struct TrashReq *req);
+int trash_async_fd();
+size_t trash_async_reap(struct TrashReq **reqs, size_t max);
+void trash_async_free(struct TrashReq *req);
+
 #endif //DB_H
\ No newline at end of file
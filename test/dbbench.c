@@ -0,0 +1,394 @@
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "../db.h"
+
+#define BENCH_DB "bench"
+#define BENCH_KEYS 100000
+#define BENCH_SECS 3
+#define BENCH_MAX_THREADS 32
+#define BENCH_READERS 4
+#define BENCH_SCAN_LEN 50
+#define BENCH_SAMPLES 200000
+#define BENCH_MAX_VAL 4096
+
+const char *filename = "dbbench/";
+
+enum Op {
+    OP_GET,
+    OP_PUT,
+    OP_SCAN,
+    OP_RMW
+};
+
+/**
+ * Percent of each op in a mix, in the order of enum Op
+ */
+struct Workload {
+    const char *name;
+    unsigned int pct[4];
+};
+
+static const struct Workload workloads[] = {
+    {"readheavy", {95, 5, 0, 0}},
+    {"writeheavy", {50, 50, 0, 0}},
+    {"scan", {0, 5, 95, 0}},
+    {"rmw", {50, 0, 0, 50}},
+};
+
+static const size_t valsizes[] = {16, 128, 1024};
+
+struct Worker {
+    pthread_t thread;
+    const struct Workload *wl;
+    TrashDb *db;
+    size_t valsize;
+    unsigned long seed;
+    volatile int *stop;
+
+    unsigned long ops;
+    unsigned long errs;
+    // reservoir of op latencies in ns
+    unsigned long *samples;
+    size_t numsamples;
+};
+
+static unsigned long now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000ul + (unsigned long)ts.tv_nsec;
+}
+
+static unsigned long xorshift(unsigned long *s) {
+    unsigned long x = *s;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *s = x;
+    return x;
+}
+
+/**
+ * 80% of the ops go to the hottest 20% of the keys
+ */
+static unsigned int pick_key(unsigned long *seed) {
+    unsigned long r = xorshift(seed);
+
+    if(r % 100 < 80)
+        return (unsigned int)((r >> 8) % (BENCH_KEYS / 5));
+    return (unsigned int)((r >> 8) % BENCH_KEYS);
+}
+
+static void make_key(char *buf, unsigned int k, MDB_val *key) {
+    snprintf(buf, 16, "k%09u", k);
+    key->mv_data = buf;
+    key->mv_size = 10;
+}
+
+static int op_get(struct Worker *w, MDB_val *key) {
+    TrashTxn *tt;
+    MDB_val val;
+    int rc;
+
+    if((rc = trash_txn_db(&tt, w->db, TRASH_RD_TXN)) != TRASH_DB_SUCCESS)
+        return rc;
+    rc = trash_get(tt, key, &val);
+    return_txn(tt);
+
+    return (rc == MDB_NOTFOUND) ? 0 : rc;
+}
+
+static int op_put(struct Worker *w, MDB_val *key, char *valbuf) {
+    TrashTxn *tt;
+    MDB_val val;
+    int rc;
+
+    val.mv_data = valbuf;
+    val.mv_size = w->valsize;
+
+    if((rc = trash_txn_db(&tt, w->db, TRASH_WR_TXN)) != TRASH_DB_SUCCESS)
+        return rc;
+    rc = trash_put(tt, key, &val, 0);
+    return_txn(tt);
+
+    return rc;
+}
+
+static int op_scan(struct Worker *w, MDB_val *key) {
+    TrashTxn *tt;
+    TrashIter *it;
+    MDB_val keys[BENCH_SCAN_LEN], vals[BENCH_SCAN_LEN];
+    int rc;
+
+    if((rc = trash_txn_db(&tt, w->db, TRASH_RD_TXN)) != TRASH_DB_SUCCESS)
+        return rc;
+
+    rc = trash_iter(&it, tt, key, NULL, 0, BENCH_SCAN_LEN);
+    if(rc == TRASH_DB_SUCCESS) {
+        trash_iter_batch(it, keys, vals, BENCH_SCAN_LEN);
+        return_iter(it);
+    }
+    return_txn(tt);
+
+    return rc;
+}
+
+static int op_rmw(struct Worker *w, MDB_val *key, char *valbuf) {
+    TrashTxn *tt;
+    MDB_val val;
+    int rc;
+
+    if((rc = trash_txn_db(&tt, w->db, TRASH_WR_TXN)) != TRASH_DB_SUCCESS)
+        return rc;
+
+    rc = trash_get(tt, key, &val);
+    if(rc == 0) {
+        size_t len = (val.mv_size < w->valsize) ? val.mv_size : w->valsize;
+        memcpy(valbuf, val.mv_data, len);
+        valbuf[0]++;
+        val.mv_data = valbuf;
+        val.mv_size = w->valsize;
+        rc = trash_put(tt, key, &val, 0);
+    }
+    return_txn(tt);
+
+    return (rc == MDB_NOTFOUND) ? 0 : rc;
+}
+
+static void *worker_function(void *arg) {
+    struct Worker *w = (struct Worker *)arg;
+    char keybuf[16];
+    char valbuf[BENCH_MAX_VAL];
+    MDB_val key;
+    unsigned long start, lat, r;
+    int rc;
+
+    init_thread_local_readers(BENCH_READERS);
+    memset(valbuf, 'v', sizeof(valbuf));
+
+    while(!*w->stop) {
+        enum Op op;
+
+        r = xorshift(&w->seed) % 100;
+        if(r < w->wl->pct[OP_GET]) {
+            op = OP_GET;
+        } else if(r < w->wl->pct[OP_GET] + w->wl->pct[OP_PUT]) {
+            op = OP_PUT;
+        } else if(r < w->wl->pct[OP_GET] + w->wl->pct[OP_PUT] + w->wl->pct[OP_SCAN]) {
+            op = OP_SCAN;
+        } else {
+            op = OP_RMW;
+        }
+
+        make_key(keybuf, pick_key(&w->seed), &key);
+
+        start = now_ns();
+        switch (op) {
+        case OP_GET:
+            rc = op_get(w, &key);
+            break;
+        case OP_PUT:
+            rc = op_put(w, &key, valbuf);
+            break;
+        case OP_SCAN:
+            rc = op_scan(w, &key);
+            break;
+        default:
+            rc = op_rmw(w, &key, valbuf);
+            break;
+        }
+        lat = now_ns() - start;
+
+        if(rc != 0)
+            w->errs++;
+
+        // keep a uniform sample of the latencies once the reservoir is full
+        if(w->numsamples < BENCH_SAMPLES) {
+            w->samples[w->numsamples++] = lat;
+        } else {
+            r = xorshift(&w->seed) % (w->ops + 1);
+            if(r < BENCH_SAMPLES)
+                w->samples[r] = lat;
+        }
+        w->ops++;
+    }
+
+    clean_thread_local_readers();
+    return NULL;
+}
+
+static int cmp_ulong(const void *a, const void *b) {
+    unsigned long x = *(const unsigned long *)a, y = *(const unsigned long *)b;
+    return (x > y) - (x < y);
+}
+
+struct LoadCtx {
+    unsigned int i;
+    size_t valsize;
+    char keybuf[16];
+    char valbuf[BENCH_MAX_VAL];
+};
+
+static int load_next(void *ctx, MDB_val *key, MDB_val *val) {
+    struct LoadCtx *lc = (struct LoadCtx *)ctx;
+
+    if(lc->i >= BENCH_KEYS)
+        return 1;
+
+    make_key(lc->keybuf, lc->i++, key);
+    val->mv_data = lc->valbuf;
+    val->mv_size = lc->valsize;
+    return 0;
+}
+
+static void load(TrashDb *db, size_t valsize) {
+    struct TrashBulk bl;
+    struct LoadCtx *lc;
+
+    lc = (struct LoadCtx *)calloc(1, sizeof(struct LoadCtx));
+    assert(lc != NULL);
+    lc->valsize = valsize;
+    memset(lc->valbuf, 'v', sizeof(lc->valbuf));
+
+    memset(&bl, 0, sizeof(bl));
+    bl.db = db;
+    bl.next = load_next;
+    bl.ctx = lc;
+    assert(trash_bulk_load(&bl) == TRASH_DB_SUCCESS);
+
+    free(lc);
+}
+
+/**
+ * Runs one mix and prints a json line with the throughput and latency percentiles
+ */
+static void run(const struct Workload *wl, TrashDb *db, unsigned int numthreads, size_t valsize, unsigned int secs) {
+    struct Worker workers[BENCH_MAX_THREADS];
+    volatile int stop = 0;
+    unsigned long *all, ops = 0, errs = 0, start, elapsed;
+    size_t total = 0;
+
+    for (unsigned int i = 0; i < numthreads; i++) {
+        memset(&workers[i], 0, sizeof(struct Worker));
+        workers[i].wl = wl;
+        workers[i].db = db;
+        workers[i].valsize = valsize;
+        workers[i].seed = 0x9e3779b97f4a7c15ul * (i + 1);
+        workers[i].stop = &stop;
+        workers[i].samples = (unsigned long *)malloc(BENCH_SAMPLES * sizeof(unsigned long));
+        assert(workers[i].samples != NULL);
+    }
+
+    start = now_ns();
+    for (unsigned int i = 0; i < numthreads; i++)
+        assert(pthread_create(&workers[i].thread, NULL, worker_function, &workers[i]) == 0);
+
+    sleep(secs);
+    stop = 1;
+
+    for (unsigned int i = 0; i < numthreads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        ops += workers[i].ops;
+        errs += workers[i].errs;
+        total += workers[i].numsamples;
+    }
+    elapsed = now_ns() - start;
+
+    all = (unsigned long *)malloc((total > 0 ? total : 1) * sizeof(unsigned long));
+    assert(all != NULL);
+    total = 0;
+    for (unsigned int i = 0; i < numthreads; i++) {
+        memcpy(all + total, workers[i].samples, workers[i].numsamples * sizeof(unsigned long));
+        total += workers[i].numsamples;
+        free(workers[i].samples);
+    }
+    qsort(all, total, sizeof(unsigned long), cmp_ulong);
+
+    printf("{\"workload\":\"%s\",\"threads\":%u,\"valsize\":%zu,\"ops\":%lu,\"errors\":%lu,"
+        "\"secs\":%.3f,\"ops_per_sec\":%.1f,\"p50_ns\":%lu,\"p99_ns\":%lu,\"p999_ns\":%lu}\n",
+        wl->name, numthreads, valsize, ops, errs, elapsed / 1e9, ops / (elapsed / 1e9),
+        total ? all[total / 2] : 0, total ? all[total * 99 / 100] : 0, total ? all[total * 999 / 1000] : 0);
+    fflush(stdout);
+
+    free(all);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-s secs] [-t maxthreads] [-w workload]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    struct EnvMeta meta;
+    struct DbMeta dbmeta;
+    TrashDb *db;
+    const char *only = NULL;
+    char path[256];
+    unsigned int secs = BENCH_SECS, maxthreads = BENCH_MAX_THREADS;
+    int opt;
+
+    while((opt = getopt(argc, argv, "s:t:w:")) != -1) {
+        switch (opt) {
+        case 's':
+            secs = (unsigned int)atoi(optarg);
+            break;
+        case 't':
+            maxthreads = (unsigned int)atoi(optarg);
+            if(maxthreads == 0 || maxthreads > BENCH_MAX_THREADS)
+                maxthreads = BENCH_MAX_THREADS;
+            break;
+        case 'w':
+            only = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    // every run starts from an empty env
+    snprintf(path, sizeof(path), "%s%sdata.mdb", DB_DIR, filename);
+    remove(path);
+    snprintf(path, sizeof(path), "%s%slock.mdb", DB_DIR, filename);
+    remove(path);
+
+    memset(&meta, 0, sizeof(meta));
+    meta.mapmax = (size_t)16 << 30;
+    meta.rdrwaitms = 100;
+    assert(open_env((size_t)1 << 30, TRASH_NUM_DBS, BENCH_MAX_THREADS * BENCH_READERS + 2, &meta) == 0);
+
+    for (size_t v = 0; v < sizeof(valsizes) / sizeof(valsizes[0]); v++) {
+        char dbname[32];
+
+        // a db per value size, the puts of the mixes only overwrite its keys with values of the same size
+        snprintf(dbname, sizeof(dbname), "%s%zu", BENCH_DB, valsizes[v]);
+        memset(&dbmeta, 0, sizeof(dbmeta));
+        dbmeta.flags = MDB_CREATE;
+        dbmeta.name = dbname;
+        dbmeta.slots = BENCH_MAX_THREADS;
+        assert(write_db_meta(&dbmeta) == TRASH_DB_SUCCESS);
+        assert(trash_db(&db, dbname) == TRASH_DB_SUCCESS);
+        load(db, valsizes[v]);
+
+        for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++) {
+            if(only != NULL && strcmp(only, workloads[w].name) != 0)
+                continue;
+
+            for (unsigned int t = 1; t <= maxthreads; t <<= 1)
+                run(&workloads[w], db, t, valsizes[v], secs);
+        }
+
+        close_db(dbname);
+    }
+
+    close_db(METADATA);
+    close_env();
+
+    return 0;
+}
@@ -119,7 +119,7 @@ int main(int argc, char *argv[]) {
     pthread_t threads[NUM_THREADS];
     int rc;
 
-    assert(open_env(TRASH_DB_SIZE, TRASH_NUM_DBS, LMDB_DEFAULT_READERS) == 0);
+    assert(open_env(TRASH_DB_SIZE, TRASH_NUM_DBS, LMDB_DEFAULT_READERS, NULL) == 0);
 
     for (int i = 0; i < NUM_THREADS; i++) {
         void *(*func)(void *);
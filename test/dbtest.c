@@ -1,4 +1,7 @@
 #include <string.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sched.h>
 
 #include "../db.c"
 
@@ -18,13 +21,13 @@ void db_test1() {
     dbmeta->slots = 1;
 
     assert(trash_txn(&tt, METADATA, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
-    assert(strcmp(METADATA, tt->dbs[tt->dbscount - 1]->name) == 0);
+    assert(strcmp(METADATA, tt->dbs[tt->curdb]->name) == 0);
 
     assert(change_txn_db(tt, notdbname) == TRASH_DB_DNE);
 
     assert(write_db_meta(dbmeta) == TRASH_DB_SUCCESS);
     assert(change_txn_db(tt, dbname) == TRASH_DB_SUCCESS);
-    assert(strcmp(dbname, tt->dbs[tt->dbscount - 1]->name) == 0);
+    assert(strcmp(dbname, tt->dbs[tt->curdb]->name) == 0);
 
     return_txn(tt);
 
@@ -84,6 +87,131 @@ void db_test2() {
     assert(internal_get_open_db(dbname) == NULL);
 }
 
+/**
+ * Closes the test env and opens the one under DB_DIR name, fresh removes the files left by the last run first
+ */
+static void db_test_swap_env(const char *name, size_t dbsize, struct EnvMeta *meta, bool fresh) {
+    char path[256];
+
+    clean_thread_local_readers();
+    close_db(METADATA);
+    close_env();
+
+    filename = name;
+    if(fresh) {
+        snprintf(path, sizeof(path), "%s%sdata.mdb", DB_DIR, name);
+        remove(path);
+        snprintf(path, sizeof(path), "%s%slock.mdb", DB_DIR, name);
+        remove(path);
+    }
+
+    assert(open_env(dbsize, TRASH_NUM_DBS, 3, meta) == 0);
+    init_thread_local_readers(2);
+}
+
+void db_test_grow() {
+    struct EnvMeta meta;
+    struct DbMeta dbmeta;
+    TrashTxn *tt;
+    TrashCursor *tc;
+    TrashDb *db;
+    MDB_val key, val, res;
+    char kbuf[32], vbuf[1024];
+    size_t resizes, mapsize, i;
+    int rc;
+
+    const char *dbname = "testgrow";
+
+    // a 1MB map that can grow to 64MB
+    memset(&meta, 0, sizeof(meta));
+    meta.mapmax = 64 * 1048576;
+    db_test_swap_env("dbtest_grow/", 1048576, &meta, true);
+
+    memset(&dbmeta, 0, sizeof(dbmeta));
+    dbmeta.flags = MDB_CREATE;
+    dbmeta.name = dbname;
+    dbmeta.slots = 1;
+    assert(write_db_meta(&dbmeta) == TRASH_DB_SUCCESS);
+    assert(trash_db(&db, dbname) == TRASH_DB_SUCCESS);
+
+    memset(vbuf, 'v', sizeof(vbuf));
+    key.mv_data = kbuf;
+    key.mv_size = 6;
+    val.mv_data = vbuf;
+    val.mv_size = sizeof(vbuf);
+
+    // about 3MB in one txn, the puts that hit the end of the map grow it and replay the txn
+    resizes = trash_map_resizes();
+    assert(trash_txn_db(&tt, db, TRASH_WR_TXN) == TRASH_DB_SUCCESS);
+    for (i = 0; i < 2000; i++) {
+        snprintf(kbuf, sizeof(kbuf), "%06zu", i);
+        vbuf[0] = 'a' + i % 26;
+        assert(trash_put(tt, &key, &val, 0) == 0);
+    }
+    return_txn(tt);
+    assert(trash_map_resizes() > resizes);
+    assert(internal_mapsize() > 1048576);
+
+    // the puts from before every regrow made it into the commit
+    assert(trash_txn_db(&tt, db, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    for (i = 0; i < 2000; i++) {
+        snprintf(kbuf, sizeof(kbuf), "%06zu", i);
+        assert(trash_get(tt, &key, &res) == 0);
+        assert(res.mv_size == sizeof(vbuf) && ((char *)res.mv_data)[0] == (char)('a' + i % 26));
+    }
+    return_txn(tt);
+
+    // a write cursor can not be moved to the txn of a grown map, the write fails instead
+    resizes = trash_map_resizes();
+    mapsize = internal_mapsize();
+    assert(trash_txn_db(&tt, db, TRASH_WR_TXN) == TRASH_DB_SUCCESS);
+    assert(trash_cursor(&tc, tt) == TRASH_DB_SUCCESS);
+    rc = 0;
+    for (i = 0; rc == 0 && i < 2 * mapsize / sizeof(vbuf); i++) {
+        snprintf(kbuf, sizeof(kbuf), "n%05zu", i);
+        rc = trash_put(tt, &key, &val, 0);
+    }
+    assert(rc == MDB_MAP_FULL);
+    assert(trash_map_resizes() == resizes && internal_mapsize() == mapsize);
+    return_cursor(tc);
+    return_txn(tt);
+
+    // a running backup would hold the grow up for the whole copy, so the map is not grown while one runs
+    __atomic_store_n(&oEnv->backups, 1, __ATOMIC_SEQ_CST);
+    assert(trash_txn_db(&tt, db, TRASH_WR_TXN) == TRASH_DB_SUCCESS);
+    rc = 0;
+    for (i = 0; rc == 0 && i < 2 * mapsize / sizeof(vbuf); i++) {
+        snprintf(kbuf, sizeof(kbuf), "b%05zu", i);
+        rc = trash_put(tt, &key, &val, 0);
+    }
+    assert(rc == MDB_MAP_FULL);
+    assert(trash_map_resizes() == resizes && internal_mapsize() == mapsize);
+    return_txn(tt);
+    __atomic_store_n(&oEnv->backups, 0, __ATOMIC_SEQ_CST);
+
+    // past mapmax the txn fails as a whole, later writes can not commit without the earlier ones
+    oEnv->meta.mapmax = mapsize;
+    assert(trash_txn_db(&tt, db, TRASH_WR_TXN) == TRASH_DB_SUCCESS);
+    rc = 0;
+    for (i = 0; rc == 0 && i < 2 * mapsize / sizeof(vbuf); i++) {
+        snprintf(kbuf, sizeof(kbuf), "f%05zu", i);
+        rc = trash_put(tt, &key, &val, 0);
+    }
+    assert(rc == MDB_MAP_FULL);
+    kbuf[0] = 'g';
+    assert(trash_put(tt, &key, &val, 0) == MDB_BAD_TXN);
+    assert(trash_get(tt, &key, &res) == MDB_BAD_TXN);
+    return_txn(tt);
+
+    assert(trash_txn_db(&tt, db, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    snprintf(kbuf, sizeof(kbuf), "f%05d", 0);
+    assert(trash_get(tt, &key, &res) == MDB_NOTFOUND);
+    return_txn(tt);
+
+    close_db(dbname);
+    db_test_swap_env("dbtest/", TRASH_DB_SIZE, NULL, false);
+}
+
 void db_test3() {
     TrashTxn *tt;
     TrashCursor *tc;
@@ -132,14 +260,1563 @@ void db_test3() {
     return_txn(tt);
 }
 
+void db_test4() {
+    TrashTxn *tt;
+    TrashDb *db;
+    MDB_val key, val, res;
+    struct DbMeta dbmeta;
+
+    const char *dbname = "test4";
+
+    memset(&dbmeta, 0, sizeof(dbmeta));
+    dbmeta.flags = MDB_CREATE;
+    dbmeta.name = dbname;
+    dbmeta.slots = 1;
+
+    assert(trash_db(&db, dbname) == TRASH_DB_DNE);
+    assert(write_db_meta(&dbmeta) == TRASH_DB_SUCCESS);
+    assert(trash_db(&db, dbname) == TRASH_DB_SUCCESS);
+    assert(db == internal_get_open_db(dbname));
+
+    key.mv_data = "testkey";
+    key.mv_size = 7;
+    val.mv_data = "testval";
+    val.mv_size = 7;
+    assert(trash_txn_db(&tt, db, TRASH_WR_TXN) == TRASH_DB_SUCCESS);
+    assert(trash_put(tt, &key, &val, 0) == TRASH_DB_SUCCESS);
+    return_txn(tt);
+
+    assert(trash_txn(&tt, METADATA, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    assert(change_txn_handle(tt, db) == TRASH_DB_SUCCESS);
+    assert(trash_get(tt, &key, &res) == 0);
+    assert(res.mv_size == 7 && memcmp(res.mv_data, "testval", 7) == 0);
+    return_txn(tt);
+
+    close_db(dbname);
+    assert(internal_get_open_db(dbname) == NULL);
+}
+
+void db_test5() {
+    TrashTxn *tt;
+    TrashDb *db;
+    MDB_val key, res;
+    struct DbMeta dbmeta;
+    struct TrashOp ops[2];
+
+    const char *dbname = "test5";
+
+    memset(&dbmeta, 0, sizeof(dbmeta));
+    dbmeta.flags = MDB_CREATE;
+    dbmeta.name = dbname;
+    dbmeta.slots = 1;
+    assert(write_db_meta(&dbmeta) == TRASH_DB_SUCCESS);
+    assert(trash_db(&db, dbname) == TRASH_DB_SUCCESS);
+
+    assert(start_group_commit(TRASH_GC_MAX_OPS, TRASH_GC_MAX_WAIT_US) == TRASH_DB_SUCCESS);
+
+    ops[0].db = db;
+    ops[0].op = TRASH_OP_PUT;
+    ops[0].flags = 0;
+    ops[0].key.mv_data = "gckey1";
+    ops[0].key.mv_size = 6;
+    ops[0].val.mv_data = "gcval1";
+    ops[0].val.mv_size = 6;
+
+    ops[1] = ops[0];
+    ops[1].key.mv_data = "gckey2";
+    ops[1].val.mv_data = "gcval2";
+    assert(trash_submit(ops, 2) == TRASH_DB_SUCCESS);
+
+    // a failing batch is rolled back on its own
+    ops[0].flags = MDB_NOOVERWRITE;
+    assert(trash_submit(ops, 1) == MDB_KEYEXIST);
+
+    ops[1].op = TRASH_OP_DEL;
+    ops[1].val.mv_data = NULL;
+    assert(trash_submit(&ops[1], 1) == TRASH_DB_SUCCESS);
+
+    stop_group_commit();
+
+    assert(trash_txn_db(&tt, db, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    key.mv_data = "gckey1";
+    key.mv_size = 6;
+    assert(trash_get(tt, &key, &res) == 0);
+    assert(res.mv_size == 6 && memcmp(res.mv_data, "gcval1", 6) == 0);
+    key.mv_data = "gckey2";
+    assert(trash_get(tt, &key, &res) == MDB_NOTFOUND);
+    return_txn(tt);
+
+    close_db(dbname);
+}
+
+void db_test6() {
+    TrashTxn *tt;
+    MDB_val keys[4], vals[4];
+    int rcs[4];
+    const char *names[4] = {"key7", "key0", "nokey", "key3"};
+
+    for(unsigned int i = 0; i < 4; i++) {
+        keys[i].mv_data = (void *)names[i];
+        keys[i].mv_size = strlen(names[i]) + 1;
+    }
+
+    assert(trash_txn(&tt, METADATA, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    assert(trash_get_many(tt, keys, vals, rcs, 4, TRASH_GET_PREFETCH) == TRASH_DB_SUCCESS);
+
+    assert(rcs[0] == 0 && strcmp("val7", (char *)vals[0].mv_data) == 0);
+    assert(rcs[1] == 0 && strcmp("val0", (char *)vals[1].mv_data) == 0);
+    assert(rcs[2] == MDB_NOTFOUND);
+    assert(rcs[3] == 0 && strcmp("val3", (char *)vals[3].mv_data) == 0);
+
+    return_txn(tt);
+}
+
+void db_test7() {
+    TrashTxn *tt;
+    TrashIter *it;
+    MDB_val prefix, lo, hi, key, val;
+    MDB_val keys[4], vals[4];
+    size_t n, total;
+
+    prefix.mv_data = "key";
+    prefix.mv_size = 3;
+
+    assert(trash_txn(&tt, METADATA, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+
+    // forward prefix scan in batches
+    assert(trash_iter(&it, tt, &prefix, NULL, TRASH_ITER_PREFIX, 0) == TRASH_DB_SUCCESS);
+    total = 0;
+    while((n = trash_iter_batch(it, keys, vals, 4)) > 0) {
+        for(size_t i = 0; i < n; i++) {
+            char exp[5];
+            snprintf(exp, sizeof(exp), "%s%zu", "val", total + i);
+            assert(strcmp(exp, (char *)vals[i].mv_data) == 0);
+        }
+        total += n;
+    }
+    assert(total == 10);
+    return_iter(it);
+
+    // reverse prefix scan with a limit
+    assert(trash_iter(&it, tt, &prefix, NULL, TRASH_ITER_PREFIX | TRASH_ITER_REVERSE, 2) == TRASH_DB_SUCCESS);
+    assert(trash_iter_next(it, &key, &val) == 0);
+    assert(strcmp("val9", (char *)val.mv_data) == 0);
+    assert(trash_iter_next(it, &key, &val) == 0);
+    assert(strcmp("val8", (char *)val.mv_data) == 0);
+    assert(trash_iter_next(it, &key, &val) == MDB_NOTFOUND);
+    return_iter(it);
+
+    // range scan [key2, key5)
+    lo.mv_data = "key2";
+    lo.mv_size = 5;
+    hi.mv_data = "key5";
+    hi.mv_size = 5;
+    assert(trash_iter(&it, tt, &lo, &hi, 0, 0) == TRASH_DB_SUCCESS);
+    assert(trash_iter_batch(it, keys, vals, 4) == 3);
+    assert(strcmp("val2", (char *)vals[0].mv_data) == 0);
+    assert(strcmp("val4", (char *)vals[2].mv_data) == 0);
+    return_iter(it);
+
+    return_txn(tt);
+}
+
+struct BulkCtx {
+    unsigned int i;
+    unsigned int n;
+    char keybuf[16];
+    char valbuf[16];
+};
+
+// hands out keys n-1 .. 0 and then key 0 again with a new value
+int bulk_next(void *ctx, MDB_val *key, MDB_val *val) {
+    struct BulkCtx *bc = (struct BulkCtx *)ctx;
+
+    if(bc->i > bc->n)
+        return 1;
+
+    if(bc->i == bc->n) {
+        snprintf(bc->keybuf, sizeof(bc->keybuf), "bk%06u", 0);
+        snprintf(bc->valbuf, sizeof(bc->valbuf), "last");
+    } else {
+        snprintf(bc->keybuf, sizeof(bc->keybuf), "bk%06u", bc->n - 1 - bc->i);
+        snprintf(bc->valbuf, sizeof(bc->valbuf), "bv%06u", bc->n - 1 - bc->i);
+    }
+    bc->i++;
+
+    key->mv_data = bc->keybuf;
+    key->mv_size = strlen(bc->keybuf);
+    val->mv_data = bc->valbuf;
+    val->mv_size = strlen(bc->valbuf);
+    return 0;
+}
+
+void db_test8() {
+    TrashTxn *tt;
+    TrashIter *it;
+    TrashDb *db;
+    MDB_val key, val, prev;
+    struct DbMeta dbmeta;
+    struct TrashBulk bl;
+    struct BulkCtx bc;
+    struct BulkRun run;
+    size_t count, sizes[2];
+
+    const char *dbname = "test8";
+
+    memset(&dbmeta, 0, sizeof(dbmeta));
+    dbmeta.flags = MDB_CREATE;
+    dbmeta.name = dbname;
+    dbmeta.slots = 1;
+    assert(write_db_meta(&dbmeta) == TRASH_DB_SUCCESS);
+    assert(trash_db(&db, dbname) == TRASH_DB_SUCCESS);
+
+    memset(&bc, 0, sizeof(bc));
+    bc.n = 2000;
+
+    // small enough to spill a few runs to disk
+    memset(&bl, 0, sizeof(bl));
+    bl.db = db;
+    bl.next = bulk_next;
+    bl.ctx = &bc;
+    bl.membytes = 8192;
+    bl.txnops = 500;
+    assert(trash_bulk_load(&bl) == TRASH_DB_SUCCESS);
+    assert(bl.loaded == 2000);
+
+    assert(trash_txn_db(&tt, db, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    assert(trash_iter(&it, tt, NULL, NULL, 0, 0) == TRASH_DB_SUCCESS);
+    count = 0;
+    while(trash_iter_next(it, &key, &val) == 0) {
+        if(count > 0)
+            assert(memcmp(prev.mv_data, key.mv_data, key.mv_size) < 0);
+        if(count == 0)
+            assert(val.mv_size == 4 && memcmp(val.mv_data, "last", 4) == 0);
+        prev = key;
+        count++;
+    }
+    assert(count == 2000);
+    return_iter(it);
+    return_txn(tt);
+
+    // a spilled run that ends inside a record is an error, not the end of the run
+    memset(&run, 0, sizeof(run));
+    run.fp = tmpfile();
+    assert(run.fp != NULL);
+    sizes[0] = 1;
+    sizes[1] = 2;
+    assert(fwrite(sizes, sizeof(size_t), 2, run.fp) == 2);
+    assert(fwrite("kvv", 1, 3, run.fp) == 3);
+    rewind(run.fp);
+    assert(internal_bulk_run_next(&run) == 0);
+    assert(run.cur.key.mv_size == 1 && run.cur.val.mv_size == 2);
+    assert(internal_bulk_run_next(&run) == MDB_NOTFOUND);
+
+    assert(fseek(run.fp, 0, SEEK_END) == 0);
+    assert(fwrite(sizes, sizeof(size_t), 2, run.fp) == 2);
+    assert(fwrite("k", 1, 1, run.fp) == 1);
+    rewind(run.fp);
+    assert(internal_bulk_run_next(&run) == 0);
+    assert(internal_bulk_run_next(&run) == TRASH_DB_ERROR);
+    fclose(run.fp);
+    free(run.buf);
+
+    close_db(dbname);
+}
+
+void db_test9() {
+    TrashTxn *tt;
+    MDB_val key, val;
+    struct DbMeta dbmeta;
+    char dbnames[24][16];
+
+    memset(&dbmeta, 0, sizeof(dbmeta));
+    dbmeta.flags = MDB_CREATE;
+    dbmeta.slots = 1;
+    for (int i = 0; i < 24; i++) {
+        snprintf(dbnames[i], sizeof(dbnames[i]), "test9_%d", i);
+        dbmeta.name = dbnames[i];
+        assert(write_db_meta(&dbmeta) == TRASH_DB_SUCCESS);
+    }
+
+    key.mv_data = "key";
+    key.mv_size = 3;
+
+    // more dbs than a new txn has room for, each put goes to the db it was switched to
+    assert(trash_txn(&tt, dbnames[0], TRASH_WR_TXN) == TRASH_DB_SUCCESS);
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < 24; i++) {
+            assert(change_txn_db(tt, dbnames[i]) == TRASH_DB_SUCCESS);
+            assert(strcmp(dbnames[i], tt->dbs[tt->curdb]->name) == 0);
+            val.mv_data = dbnames[i];
+            val.mv_size = strlen(dbnames[i]);
+            assert(trash_put(tt, &key, &val, 0) == 0);
+        }
+    }
+    assert(tt->dbscount == 24);
+    for (int i = 0; i < 24; i++)
+        assert(tt->dbs[i]->txncount == 1);
+    return_txn(tt);
+
+    assert(trash_txn(&tt, dbnames[23], TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    for (int i = 23; i >= 0; i--) {
+        assert(change_txn_db(tt, dbnames[i]) == TRASH_DB_SUCCESS);
+        assert(trash_get(tt, &key, &val) == 0);
+        assert(val.mv_size == strlen(dbnames[i]) && memcmp(val.mv_data, dbnames[i], val.mv_size) == 0);
+    }
+    return_txn(tt);
+
+    for (int i = 0; i < 24; i++)
+        close_db(dbnames[i]);
+}
+
+void db_test10() {
+    TrashTxn *tt;
+    MDB_val key, val;
+    struct DbMeta dbmeta;
+    const char *keys[] = {"sp_a", "sp_b", "sp_c", "sp_d"};
+
+    const char *dbname = "test10";
+
+    memset(&dbmeta, 0, sizeof(dbmeta));
+    dbmeta.flags = MDB_CREATE;
+    dbmeta.name = dbname;
+    dbmeta.slots = 1;
+    assert(write_db_meta(&dbmeta) == TRASH_DB_SUCCESS);
+
+    val.mv_data = "v";
+    val.mv_size = 1;
+
+    assert(trash_txn(&tt, dbname, TRASH_WR_TXN) == TRASH_DB_SUCCESS);
+    assert(trash_rollback(tt) == TRASH_DB_ERROR);
+
+    key.mv_data = (void *)keys[0];
+    key.mv_size = 4;
+    assert(trash_put(tt, &key, &val, 0) == 0);
+
+    // undone, the put before the savepoint is kept
+    assert(trash_savepoint(tt) == TRASH_DB_SUCCESS);
+    key.mv_data = (void *)keys[1];
+    assert(trash_put(tt, &key, &val, 0) == 0);
+    assert(trash_rollback(tt) == TRASH_DB_SUCCESS);
+    assert(trash_get(tt, &key, &val) == MDB_NOTFOUND);
+
+    // kept through two levels, the inner one undone
+    val.mv_data = "v";
+    val.mv_size = 1;
+    assert(trash_savepoint(tt) == TRASH_DB_SUCCESS);
+    key.mv_data = (void *)keys[2];
+    assert(trash_put(tt, &key, &val, 0) == 0);
+    assert(trash_savepoint(tt) == TRASH_DB_SUCCESS);
+    key.mv_data = (void *)keys[3];
+    assert(trash_put(tt, &key, &val, 0) == 0);
+    assert(trash_rollback(tt) == TRASH_DB_SUCCESS);
+    assert(trash_release(tt) == TRASH_DB_SUCCESS);
+    assert(tt->numsaves == 0);
+
+    // left open, return_txn merges it
+    assert(trash_savepoint(tt) == TRASH_DB_SUCCESS);
+    return_txn(tt);
+
+    assert(trash_txn(&tt, dbname, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    assert(trash_savepoint(tt) == TRASH_TXN_INVALID);
+    for (int i = 0; i < 4; i++) {
+        key.mv_data = (void *)keys[i];
+        key.mv_size = 4;
+        assert(trash_get(tt, &key, &val) == ((i == 0 || i == 2) ? 0 : MDB_NOTFOUND));
+    }
+    return_txn(tt);
+
+    close_db(dbname);
+}
+
+static void async_wait(struct TrashReq **reqs, size_t num) {
+    struct pollfd pfd;
+    size_t got = 0;
+
+    pfd.fd = trash_async_fd();
+    pfd.events = POLLIN;
+    while(got < num) {
+        assert(poll(&pfd, 1, 5000) == 1);
+        got += trash_async_reap(reqs + got, num - got);
+    }
+}
+
+static void async_done(struct TrashReq *req) {
+    __atomic_store_n((int *)req->ctx, 1, __ATOMIC_RELEASE);
+}
+
+void db_test11() {
+    TrashDb *db;
+    struct DbMeta dbmeta;
+    struct TrashReq put, get, scan, cb, *done[2];
+    struct pollfd pfd;
+    int called = 0;
+
+    const char *dbname = "test11";
+
+    memset(&dbmeta, 0, sizeof(dbmeta));
+    dbmeta.flags = MDB_CREATE;
+    dbmeta.name = dbname;
+    dbmeta.slots = 1;
+    assert(write_db_meta(&dbmeta) == TRASH_DB_SUCCESS);
+    assert(trash_db(&db, dbname) == TRASH_DB_SUCCESS);
+
+    assert(start_async(1, 1) == TRASH_DB_SUCCESS);
+
+    memset(&put, 0, sizeof(put));
+    put.op.db = db;
+    put.op.op = TRASH_OP_PUT;
+    put.op.key.mv_data = "ak1";
+    put.op.key.mv_size = 3;
+    put.op.val.mv_data = "av1";
+    put.op.val.mv_size = 3;
+    assert(trash_async(&put) == TRASH_DB_SUCCESS);
+    async_wait(done, 1);
+    assert(done[0] == &put && put.rc == 0);
+
+    memset(&get, 0, sizeof(get));
+    get.op.db = db;
+    get.op.op = TRASH_OP_GET;
+    get.op.key = put.op.key;
+
+    memset(&scan, 0, sizeof(scan));
+    scan.op.db = db;
+    scan.op.op = TRASH_OP_SCAN;
+    scan.op.key.mv_data = "ak";
+    scan.op.key.mv_size = 2;
+    scan.op.flags = TRASH_ITER_PREFIX;
+
+    assert(trash_async(&get) == TRASH_DB_SUCCESS);
+    assert(trash_async(&scan) == TRASH_DB_SUCCESS);
+    async_wait(done, 2);
+    assert(get.rc == 0 && get.val.mv_size == 3 && memcmp(get.val.mv_data, "av1", 3) == 0);
+    assert(scan.rc == 0 && scan.count == 1);
+    assert(scan.keys[0].mv_size == 3 && memcmp(scan.keys[0].mv_data, "ak1", 3) == 0);
+    trash_async_free(&get);
+    trash_async_free(&scan);
+
+    memset(&cb, 0, sizeof(cb));
+    cb.op.db = db;
+    cb.op.op = TRASH_OP_GET;
+    cb.op.key.mv_data = "nokey";
+    cb.op.key.mv_size = 5;
+    cb.done = async_done;
+    cb.ctx = &called;
+    assert(trash_async(&cb) == TRASH_DB_SUCCESS);
+    while(!__atomic_load_n(&called, __ATOMIC_ACQUIRE))
+        usleep(1000);
+    assert(cb.rc == MDB_NOTFOUND);
+
+    // a completion that was never reaped is handed back by the stop
+    assert(trash_async(&get) == TRASH_DB_SUCCESS);
+    pfd.fd = trash_async_fd();
+    pfd.events = POLLIN;
+    assert(poll(&pfd, 1, 5000) == 1);
+    assert(stop_async() == &get);
+    assert(get.rc == 0 && get.next == NULL);
+    trash_async_free(&get);
+    assert(trash_async(&cb) == TRASH_TXN_INVALID);
+
+    close_db(dbname);
+}
+
+void db_test12() {
+    TrashTxn *tt;
+    TrashDb *db;
+    MDB_val key, val;
+    struct DbMeta dbmeta;
+    struct TrashStats st;
+    struct TrashOp op;
+    char buf[16];
+    size_t len;
+    unsigned long hits;
+
+    const char *dbname = "test12";
+
+    memset(&dbmeta, 0, sizeof(dbmeta));
+    dbmeta.flags = MDB_CREATE | TRASH_DB_CACHE;
+    dbmeta.name = dbname;
+    dbmeta.slots = 1;
+    assert(write_db_meta(&dbmeta) == TRASH_DB_SUCCESS);
+    assert(trash_db(&db, dbname) == TRASH_DB_SUCCESS);
+    assert(db->cache != NULL);
+
+    key.mv_data = "hot";
+    key.mv_size = 3;
+    val.mv_data = "v1";
+    val.mv_size = 2;
+    assert(trash_txn_db(&tt, db, TRASH_WR_TXN) == TRASH_DB_SUCCESS);
+    assert(trash_put(tt, &key, &val, 0) == 0);
+    return_txn(tt);
+
+    // the miss fills the cache, the second read is a hit
+    len = sizeof(buf);
+    assert(trash_cache_get(db, &key, buf, &len) == 0);
+    assert(len == 2 && memcmp(buf, "v1", 2) == 0);
+    trash_stats_snapshot(&st);
+    hits = st.cachehits;
+    len = sizeof(buf);
+    assert(trash_cache_get(db, &key, buf, &len) == 0);
+    assert(len == 2 && memcmp(buf, "v1", 2) == 0);
+#ifndef TRASH_NO_STATS
+    trash_stats_snapshot(&st);
+    assert(st.cachehits == hits + 1);
+#endif
+
+    len = 1;
+    assert(trash_cache_get(db, &key, buf, &len) == TRASH_DB_ERROR);
+    assert(len == 2);
+
+    // a committed write drops the cached value
+    val.mv_data = "v2";
+    assert(trash_txn_db(&tt, db, TRASH_WR_TXN) == TRASH_DB_SUCCESS);
+    assert(trash_put(tt, &key, &val, 0) == 0);
+    return_txn(tt);
+    len = sizeof(buf);
+    assert(trash_cache_get(db, &key, buf, &len) == 0);
+    assert(len == 2 && memcmp(buf, "v2", 2) == 0);
+
+    // so does one through trash_submit
+    memset(&op, 0, sizeof(op));
+    op.db = db;
+    op.op = TRASH_OP_PUT;
+    op.key = key;
+    op.val.mv_data = "v3";
+    op.val.mv_size = 2;
+    assert(trash_submit(&op, 1) == 0);
+    len = sizeof(buf);
+    assert(trash_cache_get(db, &key, buf, &len) == 0);
+    assert(len == 2 && memcmp(buf, "v3", 2) == 0);
+
+    key.mv_data = "cold";
+    key.mv_size = 4;
+    len = sizeof(buf);
+    assert(trash_cache_get(db, &key, buf, &len) == MDB_NOTFOUND);
+
+    close_db(dbname);
+}
+
+void db_test13() {
+    TrashTxn *tt;
+    TrashDb *db;
+    MDB_val key, val, res;
+    struct DbMeta dbmeta;
+    struct TrashStats st;
+    unsigned long negs;
+    char buf[16];
+
+    const char *dbname = "test13";
+
+    memset(&dbmeta, 0, sizeof(dbmeta));
+    dbmeta.flags = MDB_CREATE | TRASH_DB_BLOOM;
+    dbmeta.name = dbname;
+    dbmeta.slots = 1;
+    dbmeta.bloomkeys = 1024;
+    assert(write_db_meta(&dbmeta) == TRASH_DB_SUCCESS);
+    assert(trash_db(&db, dbname) == TRASH_DB_SUCCESS);
+    assert(db->bloom != NULL && db->bloom->ready);
+
+    assert(trash_txn_db(&tt, db, TRASH_WR_TXN) == TRASH_DB_SUCCESS);
+    for (int i = 0; i < 100; i++) {
+        snprintf(buf, sizeof(buf), "key%d", i);
+        key.mv_data = buf;
+        key.mv_size = strlen(buf);
+        val.mv_data = buf;
+        val.mv_size = key.mv_size;
+        assert(trash_put(tt, &key, &val, 0) == 0);
+    }
+    // the txn sees its own puts through the filter
+    assert(trash_get(tt, &key, &res) == 0);
+    return_txn(tt);
+
+    trash_stats_snapshot(&st);
+    negs = st.bloomnegs;
+
+    assert(trash_txn_db(&tt, db, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    for (int i = 0; i < 100; i++) {
+        snprintf(buf, sizeof(buf), "key%d", i);
+        key.mv_data = buf;
+        key.mv_size = strlen(buf);
+        assert(trash_get(tt, &key, &res) == 0);
+        assert(res.mv_size == key.mv_size && memcmp(res.mv_data, buf, key.mv_size) == 0);
+    }
+
+    key.mv_data = "missing";
+    key.mv_size = 7;
+    assert(trash_get(tt, &key, &res) == MDB_NOTFOUND);
+    return_txn(tt);
+#ifndef TRASH_NO_STATS
+    trash_stats_snapshot(&st);
+    assert(st.bloomnegs == negs + 1);
+#endif
+
+    close_db(dbname);
+}
+
+void db_test14() {
+    TrashTxn *tt;
+    TrashDb *db;
+    TrashIter *it;
+    MDB_val key, val, res;
+    struct DbMeta dbmeta;
+    struct TrashKeyPart parts[3], out[3];
+    uint64_t nums[] = {65536, 1, 256};
+    uint32_t small = 7;
+    uint64_t prev = 0;
+    unsigned char buf[64], buf2[64], unpacked[16];
+    MDB_val packed;
+
+    const char *dbname = "test14";
+
+    memset(&dbmeta, 0, sizeof(dbmeta));
+    dbmeta.flags = MDB_CREATE | TRASH_DB_KEY_U64;
+    dbmeta.name = dbname;
+    dbmeta.slots = 1;
+    assert(write_db_meta(&dbmeta) == TRASH_DB_SUCCESS);
+    assert(trash_db(&db, dbname) == TRASH_DB_SUCCESS);
+
+    val.mv_data = "v";
+    val.mv_size = 1;
+    assert(trash_txn_db(&tt, db, TRASH_WR_TXN) == TRASH_DB_SUCCESS);
+    for (int i = 0; i < 3; i++) {
+        trash_key_num(&key, &nums[i], TRASH_DB_KEY_U64);
+        assert(trash_put(tt, &key, &val, 0) == 0);
+    }
+    // a key of the wrong width is refused
+    trash_key_num(&key, &small, TRASH_DB_KEY_U32);
+    assert(trash_put(tt, &key, &val, 0) == TRASH_DB_ERROR);
+    return_txn(tt);
+
+    // integer order, not byte order
+    assert(trash_txn_db(&tt, db, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    assert(trash_iter(&it, tt, NULL, NULL, 0, 0) == TRASH_DB_SUCCESS);
+    for (int i = 0; i < 3; i++) {
+        assert(trash_iter_next(it, &key, &res) == 0);
+        assert(trash_key_to_num(&key) > prev);
+        prev = trash_key_to_num(&key);
+    }
+    assert(prev == 65536);
+    assert(trash_iter_next(it, &key, &res) == MDB_NOTFOUND);
+    return_iter(it);
+    return_txn(tt);
+
+    close_db(dbname);
+
+    // tuples order part by part under memcmp
+    memset(parts, 0, sizeof(parts));
+    parts[0].type = TRASH_PART_I64;
+    parts[0].snum = -5;
+    parts[1].type = TRASH_PART_BYTES;
+    parts[1].bytes.mv_data = "a\0b";
+    parts[1].bytes.mv_size = 3;
+    parts[2].type = TRASH_PART_U32;
+    parts[2].unum = 9;
+    assert(trash_key_pack(&packed, buf, sizeof(buf), parts, 3) == TRASH_DB_SUCCESS);
+
+    memcpy(out, parts, sizeof(out));
+    assert(trash_key_unpack(&packed, out, 3, unpacked, sizeof(unpacked)) == TRASH_DB_SUCCESS);
+    assert(out[0].snum == -5 && out[2].unum == 9);
+    assert(out[1].bytes.mv_size == 3 && memcmp(out[1].bytes.mv_data, "a\0b", 3) == 0);
+
+    parts[0].snum = 3;
+    assert(trash_key_pack(&key, buf2, sizeof(buf2), parts, 3) == TRASH_DB_SUCCESS);
+    assert(memcmp(packed.mv_data, key.mv_data, 8) < 0);
+
+    // a shorter string orders before one it prefixes
+    parts[0].snum = -5;
+    parts[1].bytes.mv_size = 1;
+    assert(trash_key_pack(&key, buf2, sizeof(buf2), parts, 3) == TRASH_DB_SUCCESS);
+    assert(memcmp(key.mv_data, packed.mv_data, (key.mv_size < packed.mv_size) ? key.mv_size : packed.mv_size) < 0);
+
+    assert(trash_key_pack(&key, buf2, 4, parts, 3) == TRASH_DB_ERROR);
+}
+
+void db_test15() {
+    TrashTxn *tt;
+    TrashDb *db;
+    MDB_val key;
+    struct DbMeta dbmeta;
+    uint64_t num;
+
+    const char *dbname = "test15";
+
+    memset(&dbmeta, 0, sizeof(dbmeta));
+    dbmeta.flags = MDB_CREATE;
+    dbmeta.name = dbname;
+    dbmeta.slots = 1;
+    assert(write_db_meta(&dbmeta) == TRASH_DB_SUCCESS);
+    assert(trash_db(&db, dbname) == TRASH_DB_SUCCESS);
+
+    key.mv_data = "hits";
+    key.mv_size = 4;
+    for (int i = 0; i < 10; i++)
+        assert(trash_counter_add(db, &key, 3) == TRASH_DB_SUCCESS);
+    assert(trash_counter_add(db, &key, -5) == TRASH_DB_SUCCESS);
+
+    // nothing is stored until a flush, the pending deltas are only seen when asked for
+    assert(trash_txn_db(&tt, db, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    assert(trash_counter_get(tt, &key, &num, 0) == MDB_NOTFOUND);
+    assert(trash_counter_get(tt, &key, &num, TRASH_COUNTER_PENDING) == 0);
+    assert(num == 25);
+    return_txn(tt);
+
+    assert(trash_counter_flush() == TRASH_DB_SUCCESS);
+    assert(trash_counter_add(db, &key, 1) == TRASH_DB_SUCCESS);
+
+    assert(trash_txn_db(&tt, db, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    assert(trash_counter_get(tt, &key, &num, 0) == 0);
+    assert(num == 25);
+    assert(trash_counter_get(tt, &key, &num, TRASH_COUNTER_PENDING) == 0);
+    assert(num == 26);
+    return_txn(tt);
+
+    // the periodic flusher folds in the rest before it stops
+    assert(start_counters(10) == TRASH_DB_SUCCESS);
+    stop_counters();
+
+    assert(trash_txn_db(&tt, db, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    assert(trash_counter_get(tt, &key, &num, 0) == 0);
+    assert(num == 26);
+    return_txn(tt);
+
+    // the deltas of a closed db are dropped by the flush, a reopen does not pick them up
+    assert(trash_counter_add(db, &key, 4) == TRASH_DB_SUCCESS);
+    close_db(dbname);
+    assert(trash_counter_flush() == TRASH_DB_SUCCESS);
+
+    assert(write_db_meta(&dbmeta) == TRASH_DB_SUCCESS);
+    assert(trash_db(&db, dbname) == TRASH_DB_SUCCESS);
+    assert(trash_txn_db(&tt, db, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    assert(trash_counter_get(tt, &key, &num, TRASH_COUNTER_PENDING) == 0);
+    assert(num == 26);
+    return_txn(tt);
+
+    close_db(dbname);
+}
+
+void db_test16() {
+    TrashTxn *tt;
+    TrashDb *db;
+    TrashIter *it;
+    MDB_val key, val, res;
+    struct DbMeta dbmeta;
+    size_t reaped, n = 0;
+    char longkey[505];
+
+    const char *dbname = "test16";
+
+    memset(&dbmeta, 0, sizeof(dbmeta));
+    dbmeta.flags = MDB_CREATE | TRASH_DB_TTL | TRASH_DB_CACHE;
+    dbmeta.name = dbname;
+    dbmeta.slots = 1;
+    assert(write_db_meta(&dbmeta) == TRASH_DB_ERROR);
+    dbmeta.flags = MDB_CREATE | TRASH_DB_TTL;
+    assert(write_db_meta(&dbmeta) == TRASH_DB_SUCCESS);
+    assert(trash_db(&db, dbname) == TRASH_DB_SUCCESS);
+
+    val.mv_data = "value";
+    val.mv_size = 5;
+    assert(trash_txn_db(&tt, db, TRASH_WR_TXN) == TRASH_DB_SUCCESS);
+    key.mv_data = "live";
+    key.mv_size = 4;
+    assert(trash_put(tt, &key, &val, 0) == 0);
+    key.mv_data = "gone";
+    assert(trash_put_expire(tt, &key, &val, 0, 1) == 0);
+    key.mv_data = "back";
+    assert(trash_put_expire(tt, &key, &val, 0, 1) == 0);
+    // an expired key does not stop MDB_NOOVERWRITE
+    assert(trash_put(tt, &key, &val, MDB_NOOVERWRITE) == 0);
+    return_txn(tt);
+
+    assert(trash_txn_db(&tt, db, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    key.mv_data = "gone";
+    assert(trash_get(tt, &key, &res) == MDB_NOTFOUND);
+    key.mv_data = "live";
+    assert(trash_get(tt, &key, &res) == 0);
+    assert(res.mv_size == 5 && memcmp(res.mv_data, "value", 5) == 0);
+
+    assert(trash_iter(&it, tt, NULL, NULL, 0, 0) == TRASH_DB_SUCCESS);
+    while(trash_iter_next(it, &key, &res) == 0) {
+        assert(memcmp(key.mv_data, "gone", 4) != 0);
+        assert(res.mv_size == 5);
+        n++;
+    }
+    assert(n == 2);
+    return_iter(it);
+    return_txn(tt);
+
+    // only gone is deleted, back was written again without an expiry
+    assert(trash_reap(dbname, &reaped) == TRASH_DB_SUCCESS);
+    assert(reaped == 1);
+    assert(trash_reap(dbname, &reaped) == TRASH_DB_SUCCESS);
+    assert(reaped == 0);
+
+    assert(trash_txn_db(&tt, db, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    key.mv_data = "back";
+    assert(trash_get(tt, &key, &res) == 0);
+    return_txn(tt);
+
+    // a key lmdb takes but the expiry index can not is refused before the value goes in
+    memset(longkey, 'k', sizeof(longkey));
+    key.mv_data = longkey;
+    key.mv_size = sizeof(longkey);
+    assert(trash_txn_db(&tt, db, TRASH_WR_TXN) == TRASH_DB_SUCCESS);
+    assert(trash_put_expire(tt, &key, &val, 0, internal_wall_ms() + 60000) == TRASH_DB_ERROR);
+    assert(trash_get(tt, &key, &res) == MDB_NOTFOUND);
+    assert(trash_put(tt, &key, &val, 0) == 0);
+    return_txn(tt);
+
+    close_db(dbname);
+}
+
+void db_test17() {
+    struct TrashBackup bk;
+    struct stat st;
+    size_t copied, total;
+    unsigned long etams;
+
+    const char *path = DB_DIR "backup.mdb";
+
+    memset(&bk, 0, sizeof(bk));
+    bk.fd = -1;
+    bk.path = path;
+    bk.flags = TRASH_BACKUP_COMPACT;
+    bk.ratebytes = 64 * 1048576;
+
+    assert(trash_backup_start(&bk) == TRASH_DB_SUCCESS);
+    trash_backup_progress(&bk, &copied, &total, &etams);
+    assert(copied <= total);
+    assert(trash_backup_wait(&bk) == 0);
+    assert(bk.done);
+    assert(bk.copied > 0 && bk.total == bk.copied);
+
+    assert(stat(path, &st) == 0);
+    assert((size_t)st.st_size == bk.copied);
+    unlink(path);
+
+    // no file and no fd
+    bk.path = NULL;
+    assert(trash_backup_start(&bk) == TRASH_DB_ERROR);
+}
+
+void db_test18() {
+    struct DbMeta dbmeta;
+    struct TrashReaders rdrs;
+    struct timespec pause = {0, 20000000};
+    TrashTxn *tt, *old;
+    TrashDb *db;
+    MDB_val key, val, res;
+
+    const char *dbname = "test18";
+
+    memset(&dbmeta, 0, sizeof(dbmeta));
+    dbmeta.flags = MDB_CREATE;
+    dbmeta.name = dbname;
+    dbmeta.slots = 1;
+    assert(write_db_meta(&dbmeta) == TRASH_DB_SUCCESS);
+    assert(trash_db(&db, dbname) == TRASH_DB_SUCCESS);
+
+    key.mv_data = "k";
+    key.mv_size = 1;
+    val.mv_data = "v";
+    val.mv_size = 1;
+
+    assert(trash_txn_db(&old, db, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    assert(trash_txn_db(&tt, db, TRASH_WR_TXN) == TRASH_DB_SUCCESS);
+    assert(trash_put(tt, &key, &val, 0) == 0);
+    return_txn(tt);
+    nanosleep(&pause, NULL);
+
+    // the old reader is still on the snapshot from before the put
+    assert(trash_check_readers(&rdrs, 0) == TRASH_DB_SUCCESS);
+    assert(rdrs.active == 1);
+    assert(rdrs.oldestms >= 20 && rdrs.oldestlag >= 1);
+    assert(rdrs.expired == 0);
+    assert(trash_get(old, &key, &res) == MDB_NOTFOUND);
+
+    // expired readers keep their snapshot until the owner touches them again
+    assert(trash_check_readers(&rdrs, 10) == TRASH_DB_SUCCESS);
+    assert(rdrs.expired == 1 && rdrs.active == 1);
+    assert(trash_get(old, &key, &res) == TRASH_TXN_INVALID);
+    assert(trash_check_readers(&rdrs, 10) == TRASH_DB_SUCCESS);
+    assert(rdrs.expired == 0 && rdrs.active == 0);
+    return_txn(old);
+
+    // the reader renews from the pool like any other
+    assert(trash_txn_db(&tt, db, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    assert(trash_get(tt, &key, &res) == 0);
+    return_txn(tt);
+
+    assert(trash_check_readers(&rdrs, 10) == TRASH_DB_SUCCESS);
+    assert(rdrs.active == 0 && rdrs.expired == 0);
+
+    close_db(dbname);
+}
+
+void db_test19() {
+    struct TrashShardMeta meta;
+    struct TrashOp ops[100];
+    TrashShards *ss;
+    TrashShardTxn *st;
+    TrashShardIter *it;
+    MDB_val key, val, lo, split;
+    char keys[100][4];
+    char prev[4] = {0};
+    int n = 0;
+
+    memset(&meta, 0, sizeof(meta));
+    meta.name = "test19";
+    meta.mode = TRASH_SHARD_HASH;
+    meta.numshards = 4;
+    assert(trash_shards_open(&ss, &meta) == TRASH_DB_SUCCESS);
+
+    memset(ops, 0, sizeof(ops));
+    for (int i = 0; i < 100; i++) {
+        snprintf(keys[i], sizeof(keys[i]), "%03d", 99 - i);
+        ops[i].op = TRASH_OP_PUT;
+        ops[i].key.mv_data = keys[i];
+        ops[i].key.mv_size = 3;
+        ops[i].val = ops[i].key;
+    }
+    assert(trash_shard_write(ss, ops, 100) == 0);
+
+    // the merged scan is in key order over every shard
+    assert(trash_shard_txn(&st, ss, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    lo.mv_data = "010";
+    lo.mv_size = 3;
+    assert(trash_shard_iter(&it, st, &lo, NULL, 0) == TRASH_DB_SUCCESS);
+    while(trash_shard_iter_next(it, &key, &val) == 0) {
+        assert(key.mv_size == 3 && memcmp(key.mv_data, val.mv_data, 3) == 0);
+        assert(memcmp(prev, key.mv_data, 3) < 0);
+        memcpy(prev, key.mv_data, 3);
+        n++;
+    }
+    assert(n == 90);
+    return_shard_iter(it);
+
+    key.mv_data = "042";
+    key.mv_size = 3;
+    assert(trash_shard_get(st, &key, &val) == 0);
+    assert(memcmp(val.mv_data, "042", 3) == 0);
+    assert(return_shard_txn(st) == 0);
+    trash_shards_close(ss);
+
+    // the layout on disk is checked
+    meta.numshards = 2;
+    assert(trash_shards_open(&ss, &meta) == TRASH_DB_ERROR);
+
+    split.mv_data = "m";
+    split.mv_size = 1;
+    meta.name = "test19r";
+    meta.mode = TRASH_SHARD_RANGE;
+    meta.splits = &split;
+    assert(trash_shards_open(&ss, &meta) == TRASH_DB_SUCCESS);
+
+    key.mv_data = "apple";
+    key.mv_size = 5;
+    assert(trash_shard_of(ss, &key) == 0);
+    assert(trash_shard_of(ss, &split) == 1);
+
+    // a write txn stays on the shard of its first write
+    assert(trash_shard_txn(&st, ss, TRASH_WR_TXN) == TRASH_DB_SUCCESS);
+    assert(trash_shard_put(st, &key, &key, 0) == 0);
+    key.mv_data = "zebra";
+    assert(trash_shard_put(st, &key, &key, 0) == TRASH_DB_ERROR);
+    assert(return_shard_txn(st) == 0);
+
+    assert(trash_shard_txn(&st, ss, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    assert(trash_shard_get(st, &key, &val) == MDB_NOTFOUND);
+    key.mv_data = "apple";
+    assert(trash_shard_get(st, &key, &val) == 0);
+    trash_shard_abort(st);
+
+    trash_shards_close(ss);
+
+    // so are the range splits
+    split.mv_data = "n";
+    assert(trash_shards_open(&ss, &meta) == TRASH_DB_ERROR);
+    split.mv_data = "m";
+    assert(trash_shards_open(&ss, &meta) == TRASH_DB_SUCCESS);
+    trash_shards_close(ss);
+}
+
+static void *db_test20_writer(void *arg) {
+    TrashTxn *tt;
+    int rc;
+
+    rc = trash_txn(&tt, "test20", TRASH_WR_TXN);
+    if(rc == TRASH_DB_SUCCESS)
+        return_txn(tt);
+    __atomic_store_n((int *)arg, rc, __ATOMIC_RELEASE);
+
+    return NULL;
+}
+
+void db_test20() {
+    struct DbMeta dbmeta;
+    TrashTxn *tt, *rd;
+    TrashDb *db;
+    MDB_val key, val, res;
+    struct TrashStats before, after;
+    pthread_t one, two;
+    int rc1 = -1, rc2 = -1;
+    size_t reaped;
+    char buf[8];
+
+    const char *dbname = "test20";
+    const char *ttlname = "test20_ttl";
+
+    memset(&dbmeta, 0, sizeof(dbmeta));
+    dbmeta.flags = MDB_CREATE;
+    dbmeta.name = dbname;
+    dbmeta.slots = 1;
+    assert(write_db_meta(&dbmeta) == TRASH_DB_SUCCESS);
+    assert(trash_db(&db, dbname) == TRASH_DB_SUCCESS);
+
+    assert(start_write_sched(1, 1000, 10) == TRASH_DB_SUCCESS);
+
+    // a bulk txn commits every 10 puts
+    trash_write_priority(TRASH_PRIO_BULK);
+    val.mv_data = "v";
+    val.mv_size = 1;
+    assert(trash_txn_db(&tt, db, TRASH_WR_TXN) == TRASH_DB_SUCCESS);
+    for (int i = 0; i < 25; i++) {
+        snprintf(buf, sizeof(buf), "%02d", i);
+        key.mv_data = buf;
+        key.mv_size = 2;
+        assert(trash_put(tt, &key, &val, 0) == 0);
+    }
+
+    assert(trash_txn_db(&rd, db, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    key.mv_data = "19";
+    assert(trash_get(rd, &key, &res) == 0);
+    key.mv_data = "20";
+    assert(trash_get(rd, &key, &res) == MDB_NOTFOUND);
+    return_txn(rd);
+
+    // of two writers one waits and the other is turned away
+    assert(pthread_create(&one, NULL, db_test20_writer, &rc1) == 0);
+    assert(pthread_create(&two, NULL, db_test20_writer, &rc2) == 0);
+    while(__atomic_load_n(&rc1, __ATOMIC_ACQUIRE) != TRASH_WRITE_BUSY
+            && __atomic_load_n(&rc2, __ATOMIC_ACQUIRE) != TRASH_WRITE_BUSY)
+        sched_yield();
+
+    // only the chunk in flight is lost
+    trash_abort(tt);
+    pthread_join(one, NULL);
+    pthread_join(two, NULL);
+    assert(rc1 == TRASH_DB_SUCCESS || rc2 == TRASH_DB_SUCCESS);
+
+    assert(trash_txn_db(&rd, db, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    key.mv_data = "00";
+    assert(trash_get(rd, &key, &res) == 0);
+    key.mv_data = "24";
+    assert(trash_get(rd, &key, &res) == MDB_NOTFOUND);
+    return_txn(rd);
+
+    // a bulk reap is chunked the same way
+    memset(&dbmeta, 0, sizeof(dbmeta));
+    dbmeta.flags = MDB_CREATE | TRASH_DB_TTL;
+    dbmeta.name = ttlname;
+    dbmeta.slots = 1;
+    assert(write_db_meta(&dbmeta) == TRASH_DB_SUCCESS);
+
+    trash_write_priority(TRASH_PRIO_NORMAL);
+    assert(trash_txn(&tt, ttlname, TRASH_WR_TXN) == TRASH_DB_SUCCESS);
+    for (int i = 0; i < 25; i++) {
+        snprintf(buf, sizeof(buf), "%02d", i);
+        key.mv_data = buf;
+        key.mv_size = 2;
+        assert(trash_put_expire(tt, &key, &val, 0, 1) == 0);
+    }
+    return_txn(tt);
+
+    trash_write_priority(TRASH_PRIO_BULK);
+    trash_stats_snapshot(&before);
+    assert(trash_reap(ttlname, &reaped) == TRASH_DB_SUCCESS);
+    assert(reaped == 25);
+    trash_stats_snapshot(&after);
+#ifndef TRASH_NO_STATS
+    assert(after.wrchunks - before.wrchunks == 2);
+#endif
+
+    trash_write_priority(TRASH_PRIO_NORMAL);
+    stop_write_sched();
+    close_db(ttlname);
+    close_db(dbname);
+}
+
+void db_test21() {
+    struct DbMeta dbmeta;
+    TrashTxn *tt;
+    TrashCursor *tc;
+    TrashDb *warm, *nums;
+    MDB_val key, val, res;
+    int64_t keys[] = { 7, -5, 3, -1 };
+    int64_t order[] = { -5, -3, -1, 3, 7 };
+    int64_t num;
+
+    const char *warmname = "test21_warm";
+    const char *numsname = "test21_i64";
+
+    memset(&dbmeta, 0, sizeof(dbmeta));
+    dbmeta.flags = MDB_CREATE | TRASH_DB_WARM;
+    dbmeta.name = warmname;
+    dbmeta.slots = 1;
+    assert(write_db_meta(&dbmeta) == TRASH_DB_SUCCESS);
+
+    memset(&dbmeta, 0, sizeof(dbmeta));
+    dbmeta.flags = MDB_CREATE | TRASH_DB_KEY_I64;
+    dbmeta.name = numsname;
+    dbmeta.slots = 1;
+    assert(write_db_meta(&dbmeta) == TRASH_DB_SUCCESS);
+
+    assert(trash_db(&warm, warmname) == TRASH_DB_SUCCESS);
+    assert(trash_db(&nums, numsname) == TRASH_DB_SUCCESS);
+
+    assert(trash_txn_db(&tt, warm, TRASH_WR_TXN) == TRASH_DB_SUCCESS);
+    key.mv_data = "k";
+    key.mv_size = 1;
+    val.mv_data = "v";
+    val.mv_size = 1;
+    assert(trash_put(tt, &key, &val, 0) == 0);
+    assert(change_txn_handle(tt, nums) == TRASH_DB_SUCCESS);
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        trash_key_num(&key, &keys[i], TRASH_DB_KEY_I64);
+        assert(trash_put(tt, &key, &val, 0) == 0);
+    }
+    return_txn(tt);
+
+    close_db(warmname);
+    close_db(numsname);
+
+    // the dbs are opened from the metadata again, nothing is written for them
+    db_test_swap_env("dbtest/", TRASH_DB_SIZE, NULL, false);
+
+    assert(trash_db(&warm, warmname) == TRASH_DB_SUCCESS);
+    assert(trash_db(&nums, numsname) == TRASH_DB_SUCCESS);
+    assert(warm->flags & TRASH_DB_WARM);
+    assert((nums->flags & TRASH_DB_KEY_MASK) == TRASH_DB_KEY_I64);
+
+    assert(trash_txn_db(&tt, warm, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    key.mv_data = "k";
+    key.mv_size = 1;
+    assert(trash_get(tt, &key, &res) == 0);
+    assert(res.mv_size == 1 && memcmp(res.mv_data, "v", 1) == 0);
+    return_txn(tt);
+
+    // a put after the reopen only lands in order when the comparator was set again
+    num = -3;
+    assert(trash_txn_db(&tt, nums, TRASH_WR_TXN) == TRASH_DB_SUCCESS);
+    trash_key_num(&key, &num, TRASH_DB_KEY_I64);
+    assert(trash_put(tt, &key, &val, 0) == 0);
+    return_txn(tt);
+
+    assert(trash_txn_db(&tt, nums, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    assert(trash_cursor(&tc, tt) == TRASH_DB_SUCCESS);
+    for (size_t i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+        assert(trash_cur_get(tc, &key, &res, i == 0 ? MDB_FIRST : MDB_NEXT) == 0);
+        assert((int64_t)trash_key_to_num(&key) == order[i]);
+    }
+    assert(trash_cur_get(tc, &key, &res, MDB_NEXT) == MDB_NOTFOUND);
+    return_cursor(tc);
+    return_txn(tt);
+
+    close_db(warmname);
+    close_db(numsname);
+}
+
+void db_test22() {
+    struct EnvMeta meta;
+    struct DbMeta dbmeta;
+    TrashTxn *tt;
+    TrashDb *db;
+    MDB_val key, val, res;
+    char kbuf[32], vbuf[1024], bname[TRASH_DB_NAME_LEN];
+    size_t resizes;
+
+    const char *dbname = "test22";
+
+    memset(&meta, 0, sizeof(meta));
+    meta.mapmax = 64 * 1048576;
+    db_test_swap_env("dbtest_grow/", 1048576, &meta, true);
+
+    memset(&dbmeta, 0, sizeof(dbmeta));
+    dbmeta.flags = MDB_CREATE | TRASH_DB_BLOOM;
+    dbmeta.name = dbname;
+    dbmeta.slots = 1;
+    dbmeta.bloomkeys = 4096;
+    assert(write_db_meta(&dbmeta) == TRASH_DB_SUCCESS);
+    assert(trash_db(&db, dbname) == TRASH_DB_SUCCESS);
+    internal_bloom_persist(db);
+    assert(db->bloom->persisted);
+
+    memset(vbuf, 'v', sizeof(vbuf));
+    key.mv_data = kbuf;
+    key.mv_size = 6;
+    val.mv_data = vbuf;
+    val.mv_size = sizeof(vbuf);
+
+    // the first put deletes the stored filter, the regrow has to delete it again in the new txn
+    resizes = trash_map_resizes();
+    assert(trash_txn_db(&tt, db, TRASH_WR_TXN) == TRASH_DB_SUCCESS);
+    for (size_t i = 0; i < 2000; i++) {
+        snprintf(kbuf, sizeof(kbuf), "%06zu", i);
+        assert(trash_put(tt, &key, &val, 0) == 0);
+    }
+    return_txn(tt);
+    assert(trash_map_resizes() > resizes);
+    assert(!db->bloom->persisted);
+
+    // a stale copy would be loaded after a crash and hide the keys above
+    snprintf(bname, sizeof(bname), BLOOM_KEY_FORMAT, dbname);
+    key.mv_data = bname;
+    key.mv_size = strlen(bname);
+    assert(trash_txn(&tt, METADATA, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    assert(mdb_get(tt->txn, oEnv->metadbi, &key, &res) == MDB_NOTFOUND);
+    return_txn(tt);
+
+    close_db(dbname);
+    db_test_swap_env("dbtest/", TRASH_DB_SIZE, NULL, false);
+}
+
+static size_t db_test23_write(const char *dbname) {
+    TrashTxn *tt;
+    MDB_val key;
+    size_t txnid;
+
+    key.mv_data = "k";
+    key.mv_size = 1;
+    assert(trash_txn(&tt, dbname, TRASH_WR_TXN) == TRASH_DB_SUCCESS);
+    assert(trash_put(tt, &key, &key, 0) == 0);
+    txnid = mdb_txn_id(tt->txn);
+    return_txn(tt);
+
+    return txnid;
+}
+
+void db_test23() {
+    struct EnvMeta meta;
+    struct DbMeta dbmeta;
+    size_t txnid;
+    int waited = 0;
+
+    const char *dbname = "test23";
+
+    memset(&dbmeta, 0, sizeof(dbmeta));
+    dbmeta.flags = MDB_CREATE;
+    dbmeta.name = dbname;
+    dbmeta.slots = 1;
+
+    // the flusher makes a periodic commit durable within syncms
+    memset(&meta, 0, sizeof(meta));
+    meta.durability = TRASH_SYNC_PERIODIC;
+    meta.syncms = 10;
+    db_test_swap_env("dbtest_grow/", 1048576, &meta, true);
+    assert(oEnv->flushing);
+    assert(write_db_meta(&dbmeta) == TRASH_DB_SUCCESS);
+    txnid = db_test23_write(dbname);
+    while(trash_durable_txnid() < txnid && waited++ < 500)
+        usleep(10000);
+    assert(trash_durable_txnid() >= txnid);
+    close_db(dbname);
+
+    // a full sync commit is durable when it returns
+    meta.durability = TRASH_SYNC_FULL;
+    db_test_swap_env("dbtest_grow/", 1048576, &meta, false);
+    assert(!oEnv->flushing);
+    assert(write_db_meta(&dbmeta) == TRASH_DB_SUCCESS);
+    txnid = db_test23_write(dbname);
+    assert(trash_durable_txnid() == txnid);
+    close_db(dbname);
+
+    // no sync never starts the flusher and never reports a commit as durable
+    meta.durability = TRASH_SYNC_NONE;
+    db_test_swap_env("dbtest_grow/", 1048576, &meta, false);
+    assert(!oEnv->flushing);
+    assert(write_db_meta(&dbmeta) == TRASH_DB_SUCCESS);
+    db_test23_write(dbname);
+    usleep(50000);
+    assert(trash_durable_txnid() == 0);
+    close_db(dbname);
+
+    db_test_swap_env("dbtest/", TRASH_DB_SIZE, NULL, false);
+}
+
+static unsigned long db_test24_calls(struct TrashStats *st, int h) {
+    unsigned long n = 0;
+
+    for (int i = 0; i < TRASH_HIST_BUCKETS; i++)
+        n += st->hist[h][i];
+
+    return n;
+}
+
+void db_test24() {
+    struct DbMeta dbmeta;
+    struct TrashStats before, after;
+    TrashTxn *tt;
+    TrashDb *db;
+    MDB_val key, res;
+    char buf[8];
+
+    const char *dbname = "test24";
+
+    memset(&dbmeta, 0, sizeof(dbmeta));
+    dbmeta.flags = MDB_CREATE;
+    dbmeta.name = dbname;
+    dbmeta.slots = 1;
+    assert(write_db_meta(&dbmeta) == TRASH_DB_SUCCESS);
+    assert(trash_db(&db, dbname) == TRASH_DB_SUCCESS);
+
+    // nothing else runs, so the snapshot moves by exactly what is done here
+    trash_stats_snapshot(&before);
+    key.mv_data = buf;
+    key.mv_size = 2;
+    for (int i = 0; i < 3; i++) {
+        assert(trash_txn_db(&tt, db, TRASH_WR_TXN) == TRASH_DB_SUCCESS);
+        for (int j = 0; j < 2; j++) {
+            snprintf(buf, sizeof(buf), "%d%d", i, j);
+            assert(trash_put(tt, &key, &key, 0) == 0);
+        }
+        return_txn(tt);
+    }
+
+    assert(trash_txn_db(&tt, db, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    for (int i = 0; i < 5; i++) {
+        snprintf(buf, sizeof(buf), "%d0", i);
+        trash_get(tt, &key, &res);
+    }
+    return_txn(tt);
+    trash_stats_snapshot(&after);
+
+#ifndef TRASH_NO_STATS
+    assert(after.wrtxns - before.wrtxns == 3);
+    assert(after.rdtxns - before.rdtxns == 1);
+    assert(db_test24_calls(&after, TRASH_HIST_BEGIN) - db_test24_calls(&before, TRASH_HIST_BEGIN) == 4);
+    assert(db_test24_calls(&after, TRASH_HIST_COMMIT) - db_test24_calls(&before, TRASH_HIST_COMMIT) == 3);
+    assert(db_test24_calls(&after, TRASH_HIST_PUT) - db_test24_calls(&before, TRASH_HIST_PUT) == 6);
+    assert(db_test24_calls(&after, TRASH_HIST_GET) - db_test24_calls(&before, TRASH_HIST_GET) == 5);
+#else
+    assert(after.wrtxns == 0 && db_test24_calls(&after, TRASH_HIST_PUT) == 0);
+#endif
+
+    close_db(dbname);
+}
+
+struct PoolTest {
+    struct Readers *mainpool;
+    struct Readers *pool;
+    int ready;
+    int done;
+};
+
+static void *db_test25_reader(void *arg) {
+    struct PoolTest *pt = (struct PoolTest *)arg;
+    TrashTxn *a, *b;
+
+    // without a pool the thread only has the reserve left out of the budget, the main pool holds the rest
+    assert(trash_txn(&a, METADATA, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    assert(trash_txn(&b, METADATA, TRASH_RD_TXN) == TRASH_OUT_OF_READER_SLOTS);
+    return_txn(a);
+
+    // the budget is taken, so the pool starts empty and drains the idle readers of the main thread
+    init_thread_local_readers(2);
+    assert(rdrPool->numTxns == 0);
+    assert(trash_txn(&a, METADATA, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    assert(trash_txn(&b, METADATA, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    assert(pt->mainpool->numTxns == 0);
+
+    // and keeps them once they are returned
+    return_txn(a);
+    return_txn(b);
+    assert(rdrPool->numTxns == 2);
+
+    pt->pool = rdrPool;
+    __atomic_store_n(&pt->ready, 1, __ATOMIC_RELEASE);
+    while(!__atomic_load_n(&pt->done, __ATOMIC_ACQUIRE))
+        usleep(1000);
+
+    clean_thread_local_readers();
+    return NULL;
+}
+
+void db_test25() {
+    struct PoolTest pt;
+    pthread_t reader;
+    TrashTxn *tt, *other;
+
+    // both readers of the main pool are idle
+    assert(rdrPool->numTxns == rdrPool->cap && rdrPool->cap == 2);
+
+    memset(&pt, 0, sizeof(pt));
+    pt.mainpool = rdrPool;
+    assert(pthread_create(&reader, NULL, db_test25_reader, &pt) == 0);
+    while(!__atomic_load_n(&pt.ready, __ATOMIC_ACQUIRE))
+        usleep(1000);
+
+    // the main thread takes one back and its pool refills on return
+    assert(rdrPool->numTxns == 0);
+    assert(trash_txn(&tt, METADATA, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    assert(pt.pool->numTxns == 1);
+    return_txn(tt);
+    assert(rdrPool->numTxns == 1);
+
+    __atomic_store_n(&pt.done, 1, __ATOMIC_RELEASE);
+    pthread_join(reader, NULL);
+
+    // the slot the other thread gave back is begun again
+    assert(trash_txn(&tt, METADATA, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    assert(trash_txn(&other, METADATA, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    return_txn(tt);
+    return_txn(other);
+    assert(rdrPool->numTxns == 2);
+}
+
+struct LockTest {
+    int held;
+    int done;
+};
+
+static void *db_test26_writer(void *arg) {
+    struct LockTest *lt = (struct LockTest *)arg;
+
+    pthread_rwlock_wrlock(&oEnv->envLock);
+    __atomic_store_n(&lt->held, 1, __ATOMIC_RELEASE);
+    while(!__atomic_load_n(&lt->done, __ATOMIC_ACQUIRE))
+        usleep(1000);
+    pthread_rwlock_unlock(&oEnv->envLock);
+
+    return NULL;
+}
+
+void db_test26() {
+    struct LockTest lt;
+    struct CurCache *slot;
+    struct OpenDb *db;
+    pthread_t writer;
+    TrashTxn *tt;
+    TrashCursor *tc, *other, *stale;
+    unsigned long dbid;
+    size_t pooled;
+
+    assert(trash_txn(&tt, METADATA, TRASH_RD_TXN) == TRASH_DB_SUCCESS);
+    db = tt->dbs[tt->curdb];
+    slot = &curCache[db->dbid & (CUR_CACHE_SLOTS - 1)];
+
+    // a returned cursor is kept in the slot of its db and handed out again
+    assert(trash_cursor(&tc, tt) == TRASH_DB_SUCCESS);
+    return_cursor(tc);
+    assert(slot->tc == tc);
+    assert(trash_cursor(&other, tt) == TRASH_DB_SUCCESS);
+    assert(other == tc && slot->tc == NULL);
+
+    // the slot holds one cursor, the second one returned goes to the shared pool
+    assert(trash_cursor(&tc, tt) == TRASH_DB_SUCCESS);
+    assert(tc != other);
+    pthread_mutex_lock(&db->odbMutex);
+    pooled = db->curcount;
+    pthread_mutex_unlock(&db->odbMutex);
+    return_cursor(other);
+    return_cursor(tc);
+    assert(slot->tc == other);
+    assert(db->curcount == pooled + 1 && db->curs[db->curcount - 1] == tc);
+
+    // and is taken from there once the slot is empty
+    assert(trash_cursor(&other, tt) == TRASH_DB_SUCCESS);
+    assert(trash_cursor(&tc, tt) == TRASH_DB_SUCCESS);
+    assert(db->curcount == pooled);
+
+    // the slot looks taken by a db that was closed since, which has to be looked up
+    stale = slot->tc = other;
+    dbid = slot->dbid = db->dbid + CUR_CACHE_SLOTS * 1024;
+    slot->closed = __atomic_load_n(&oEnv->closedDbs, __ATOMIC_ACQUIRE) - 1;
+
+    // a writer holding the envLock does not hold up the return, the cursor is pooled instead
+    memset(&lt, 0, sizeof(lt));
+    assert(pthread_create(&writer, NULL, db_test26_writer, &lt) == 0);
+    while(!__atomic_load_n(&lt.held, __ATOMIC_ACQUIRE))
+        usleep(1000);
+    return_cursor(tc);
+    assert(slot->tc == stale && slot->dbid == dbid);
+    assert(db->curcount == pooled + 1 && db->curs[db->curcount - 1] == tc);
+    __atomic_store_n(&lt.done, 1, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+
+    // once the envLock is free the stale cursor is dropped for the returned one
+    assert(trash_cursor(&tc, tt) == TRASH_DB_SUCCESS);
+    return_cursor(tc);
+    assert(slot->tc == tc && slot->dbid == db->dbid);
+
+    return_txn(tt);
+}
+
+void db_test27() {
+    TrashTxn *tt, *freed;
+    TrashCursor *tc, *freedcur;
+    size_t txns, curs;
+
+    assert(slab != NULL && slab->numTxns < SLAB_OBJS && slab->numCurs < SLAB_OBJS);
+
+    assert(trash_txn(&tt, METADATA, TRASH_WR_TXN) == TRASH_DB_SUCCESS);
+    assert(trash_cursor(&tc, tt) == TRASH_DB_SUCCESS);
+    txns = slab->numTxns;
+    curs = slab->numCurs;
+
+    // write cursors and write txns are not pooled, they go back to the slab of the thread
+    return_cursor(tc);
+    assert(slab->numCurs == curs + 1 && slab->curs[curs] == tc);
+    freedcur = tc;
+    return_txn(tt);
+    assert(slab->numTxns == txns + 1 && slab->txns[txns] == tt);
+    freed = tt;
+
+    // and are handed out again by the next begin
+    assert(trash_txn(&tt, METADATA, TRASH_WR_TXN) == TRASH_DB_SUCCESS);
+    assert(tt == freed && slab->numTxns == txns);
+    assert(tt->dbscount == 1 && tt->dbs[tt->curdb] != NULL);
+    assert(trash_cursor(&tc, tt) == TRASH_DB_SUCCESS);
+    assert(tc == freedcur && slab->numCurs == curs);
+    assert(tc->txn == tt && tc->rw == WRITE);
+
+    return_cursor(tc);
+    return_txn(tt);
+    assert(slab->numTxns == txns + 1 && slab->numCurs == curs + 1);
+}
+
 int main(int argc, char *argv[]) {
-    assert(open_env(TRASH_DB_SIZE, TRASH_NUM_DBS, 3) == 0);
+    assert(open_env(TRASH_DB_SIZE, TRASH_NUM_DBS, 3, NULL) == 0);
 
     init_thread_local_readers(2);
 
     // db_test1();
     // db_test2();
+    db_test_grow();
     db_test3();
+    db_test4();
+    db_test5();
+    db_test6();
+    db_test7();
+    db_test8();
+    db_test9();
+    db_test10();
+    db_test11();
+    db_test12();
+    db_test13();
+    db_test14();
+    db_test15();
+    db_test16();
+    db_test17();
+    db_test18();
+    db_test19();
+    db_test20();
+    db_test21();
+    db_test22();
+    db_test23();
+    db_test24();
+    db_test25();
+    db_test26();
+    db_test27();
     
     clean_thread_local_readers();
 